@@ -0,0 +1,46 @@
+#ifndef ARENA_IMPLEMENTATION_H
+#define ARENA_IMPLEMENTATION_H
+
+#include "basic_define.h"
+#include <stddef.h>
+
+/* Default size of an arena block in bytes */
+#define ARENA_BLOCK_SIZE (64ULL * 1024ULL)
+
+/* Alignment of every arena allocation */
+#define ARENA_ALIGN 16ULL
+
+/**
+ * @brief One chunk of arena memory
+ *
+ * Blocks are chained and kept across arena_reset() so a new
+ * compilation reuses the memory of the previous one. malloc returns
+ * blocks aligned for max_align_t (16 bytes on 64-bit targets), data
+ * starts on an ARENA_ALIGN boundary past the header.
+ */
+typedef struct ArenaBlock_s {
+    struct ArenaBlock_s *next;      /* Next block in the chain */
+    size_t              size;       /* Usable size of data in bytes */
+    size_t              used;       /* Bytes already handed out */
+    _Alignas(ARENA_ALIGN) u8 data[]; /* Block payload, the header is padded to ARENA_ALIGN */
+} ArenaBlock;
+
+/**
+ * @brief Bump-pointer allocator
+ *
+ * Every allocation lives until arena_reset() or arena_free(),
+ * there is no per-object free.
+ */
+typedef struct Arena {
+    ArenaBlock  *first;             /* First block of the chain */
+    ArenaBlock  *current;           /* Block we are allocating from */
+    size_t      allocated;          /* Bytes handed out since last reset */
+    u32         alloc_count;        /* Allocations since last reset */
+} Arena;
+
+/* utils/arena.c */
+void    *arena_alloc(Arena *a, size_t size);
+void    arena_reset(Arena *a);
+void    arena_free(Arena *a);
+
+#endif /* ARENA_IMPLEMENTATION_H */
@@ -3,9 +3,6 @@
 
 #include "basic_define.h"
 
-/* Bitmap Array Size in bytes */
-#define BITMAP_STATE_ARRAY_SIZE 10ULL
-
 /* Unsigned 64-bit integer type size in bits */
 #define U64_BITS_NB (sizeof(u64) * 8ULL)  /* Number of bits in u64 */
 
@@ -14,13 +11,40 @@
 /**
  * @brief Bitmap for efficient state set representation
  * 
- * Uses 8 64-bit unsigned integers to support up to 512 states efficiently.
+ * State sets are sized from the NFA state count (g_nfa.closure_words),
+ * every operation only touches size words.
  */
 typedef struct Bitmap {
     u64 *bits;
-    u32 size;  /* Size of the bitmap in bits (maximum number of states) */
+    u32 size;  /* Number of u64 words of bits */
 } Bitmap;
 
+/* Returned by bitmap_next_set when there is no further set bit */
+#define BITMAP_NONE ((u32)-1)
+
+/**
+ * @brief Find the first set bit at or after from
+ * @param b Bitmap to scan
+ * @param from First id to consider
+ * @return The id of the set bit or BITMAP_NONE
+ *
+ * Skips empty words, so iterating a sparse set costs one step per
+ * member instead of one test per possible id:
+ * for (u32 i = bitmap_next_set(b, 0); i != BITMAP_NONE; i = bitmap_next_set(b, i + 1))
+ */
+FT_INLINE u32 bitmap_next_set(Bitmap *b, u32 from) {
+    u32 w = from / U64_BITS_NB;
+
+    if (w >= b->size) return (BITMAP_NONE);
+
+    u64 bits = b->bits[w] & (~0ULL << (from % U64_BITS_NB));
+    while (!bits) {
+        if (++w >= b->size) return (BITMAP_NONE);
+        bits = b->bits[w];
+    }
+    return (w * U64_BITS_NB + __builtin_ctzll(bits));
+}
+
 void    bitmap_init(Bitmap *b, u32 size);
 void    bitmap_clear(Bitmap *b);
 void    bitmap_set(Bitmap *b, u32 id);
@@ -1,30 +1,62 @@
 #ifndef DFA_IMPLEMENTATION_H
 #define DFA_IMPLEMENTATION_H
 
-#define MAX_DFA_STATES 1024
 #define ALPHABET_SIZE 256
 
+/* No transition */
+#define DFA_DEAD ((u32)-1)
+
+/* Table row of a state not in the tables yet, see dfa_tables_extend */
+#define DFA_NO_ROW ((u32)-2)
+
+/* Initial number of states the DFA arrays are sized for */
+#define DFA_INITIAL_CAPACITY 64
+
+/* Default memory budget of the DFA in MB, -m on the command line */
+#define DFA_DEFAULT_BUDGET_MB 256ULL
+
+/* Default state cache of the lazy DFA in KB, -m on the command line */
+#define LAZY_DEFAULT_BUDGET_KB 8192ULL
+
 #include "bitmap.h"
 
 /**
  * @brief Represents a DFA state
  * 
- * Each DFA state corresponds to a set of NFA states.
+ * Each DFA state corresponds to a set of NFA states, stored in the set
+ * pool of the DFA (dfa_state_set). Its transitions are row id of g_dfa.trans.
  */
 typedef struct {
     u32     id;
-    u32     is_final;
-    u32     transitions[ALPHABET_SIZE];  /* transitions[c] = next state ID */
-    Bitmap  nfa_states;                  /* Set of NFA states this DFA state represents */
+    u32     is_final;                    /* Earliest rule of its NFA finals, NFA_NO_RULE if none */
+    u64     hash;                        /* Fingerprint of the NFA set, see dfa_set_key */
 } DFAState;
 
 /**
  * @brief The complete DFA
+ *
+ * Grown by doubling while it fits in budget bytes. Transition rows are
+ * indexed by byte class: trans[s * class_count + byte_class[c]] is the
+ * next state of s on byte c, every row in one contiguous block.
+ * A DFA loaded to be extended keeps the subset construction, row maps
+ * its states to the rows of the minimized tables.
  */
 typedef struct {
-    DFAState    states[MAX_DFA_STATES];
+    DFAState    *states;
     u32         state_count;
+    u32         capacity;       /* States the arrays are sized for */
     u32         start_id;
+    u32         *trans;         /* capacity rows of class_count next state ids */
+    u8          byte_class[ALPHABET_SIZE];  /* Class of every byte */
+    u8          class_rep[ALPHABET_SIZE];   /* A byte of every class */
+    u32         class_count;
+    u64         *set_pool;      /* NFA sets of the states, set_words words each */
+    u32         set_words;      /* u64 words of one NFA set */
+    u32         *index;         /* Hash index by fingerprint: state id + 1, 0 is empty */
+    u32         index_capacity; /* power of two */
+    u32         *row;           /* Table row of every state, DFA_DEAD for a dead one; NULL: the state id */
+    size_t      memory;         /* Bytes allocated for the arrays above */
+    size_t      budget;         /* Limit of memory, 0 for the default */
 } DFA;
 
 
@@ -32,9 +64,210 @@ DFA *__get_dfa(void);
 
 #define g_dfa (*__get_dfa())
 
-int find_dfa_state(Bitmap *nfa_set);
-u32 create_dfa_state(Bitmap *nfa_set);
+/**
+ * @brief Zobrist key of an NFA state (splitmix64 of its id)
+ *
+ * The fingerprint of a set is the XOR of the keys of its members, so it
+ * is updated in O(1) when a member joins and does not depend on the order
+ * or on the size of the bitmap.
+ */
+FT_INLINE u64 dfa_set_key(u32 nfa_state) {
+    u64 z = (u64)nfa_state + 0x9e3779b97f4a7c15ULL;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (z ^ (z >> 31));
+}
+
+/**
+ * @brief NFA set of a DFA state
+ */
+FT_INLINE Bitmap dfa_state_set(u32 id) {
+    return ((Bitmap){&g_dfa.set_pool[(size_t)id * g_dfa.set_words], g_dfa.set_words});
+}
+
+/**
+ * @brief Transition row of a DFA state, indexed by byte class
+ */
+FT_INLINE u32 *dfa_row(u32 id) {
+    return (&g_dfa.trans[(size_t)id * g_dfa.class_count]);
+}
+
+/**
+ * @brief Bytes taken by one state: its entry, its row and its NFA set
+ */
+FT_INLINE size_t dfa_state_bytes(void) {
+    return (sizeof(DFAState) + g_dfa.class_count * sizeof(u32) + g_dfa.set_words * sizeof(u64));
+}
+
+/**
+ * @brief State counts and memory around dfa_minimize
+ */
+typedef struct {
+    u32     states_before;
+    u32     states_after;
+    size_t  bytes_before;
+    size_t  bytes_after;
+} DFAMinimizeStats;
+
+/**
+ * @brief State and class counts around dfa_append
+ */
+typedef struct {
+    u32     states_before;
+    u32     states_reused;      /* Previous states still reached, rows kept */
+    u32     states_new;         /* States built for the new rules */
+    u32     states_dropped;     /* Previous states no longer reached */
+    u32     classes_before;
+    u32     classes_after;
+} DFAAppendStats;
+
+/**
+ * @brief Row counts around dfa_tables_extend
+ */
+typedef struct {
+    u32     rows_before;
+    u32     rows_new;           /* Rows of the states the tables did not have */
+    u32     rows_rewritten;     /* Previous rows laid out again for split classes */
+    u32     classes_before;     /* Equivalence classes */
+    u32     classes_after;
+} DFAExtendStats;
+
+/**
+ * @brief Counters of the lazy DFA
+ */
+typedef struct {
+    u64     hits;           /* Transitions found in the cache */
+    u64     misses;         /* Transitions computed from the NFA */
+    u32     flushes;        /* Times the full cache was dropped */
+    u32     states;         /* States built, flushed ones included */
+    u32     capacity;       /* States the cache holds */
+    s8      fallback;       /* Cache thrashed, scanning with the NFA */
+} LazyDFAStats;
+
+/**
+ * @brief Layout of the scanner tables, -C option as in flex
+ */
+typedef enum {
+    TABLES_FULL,        /* -Cf: rows of one next state per byte */
+    TABLES_EC,          /* -Ce: rows of one next state per equivalence class */
+    TABLES_COMB,        /* -Cem: equivalence and meta classes, comb compressed */
+    TABLES_RANGES,      /* -Cr: per state, a dense row or a short list of class ranges */
+    TABLES_MODE_COUNT,
+} TablesMode;
+
+/* Comb slot owned by no row */
+#define TABLES_FREE ((u32)-1)
+
+/* Most ranges of a range list row, their bounds fill one u64 */
+#define TABLES_MAX_RANGES 8
+
+/* Low bit of yy_row: the row is a range list */
+#define TABLES_ROW_RANGES 1
+
+/**
+ * @brief Scanner tables of the DFA, flex layout
+ *
+ * Only the arrays of the mode are built. Bytes map to equivalence
+ * classes (yy_ec), except in TABLES_FULL. Rows are packed in one comb:
+ * the next state of s on class c is yy_nxt[yy_base[s] + c] when yy_chk
+ * there names s, otherwise the lookup goes on with yy_def[s]. Rows from
+ * state_count are templates, rows shared by similar states, indexed by
+ * meta class (yy_meta of the class) instead of equivalence class.
+ * yy_def of a row with no default is DFA_DEAD.
+ *
+ * TABLES_RANGES keeps every row in one arena, yy_row[s] is its offset
+ * shifted left, with TABLES_ROW_RANGES set for a range list. A row starts
+ * with the rule of the state. A dense row then holds one next state per
+ * class. A range list splits the classes in at most TABLES_MAX_RANGES
+ * runs with the same next state: the last class of every run as bytes in
+ * two words (255 past the count), then the next state of every run. Next
+ * states are stored as their yy_row.
+ */
+typedef struct {
+    TablesMode  mode;
+    u8      yy_ec[ALPHABET_SIZE];       /* Equivalence class of every byte */
+    u8      yy_meta[ALPHABET_SIZE];     /* Meta class of every equivalence class */
+    u32     ec_count;
+    u32     meta_count;
+    u32     state_count;
+    u32     template_count;
+    u32     start;
+    u32     *yy_accept;     /* Rule accepted by every state, NFA_NO_RULE if none */
+    u32     *yy_base;       /* Offset of every row in the comb */
+    u32     *yy_def;        /* Default row of every row */
+    u32     *yy_nxt;        /* Comb: next state, DFA_DEAD */
+    u32     *yy_chk;        /* Comb: row owning the slot, TABLES_FREE */
+    u32     comb_size;
+    u32     comb_used;      /* Slots owned by a row */
+    u32     *dense;         /* TABLES_EC: state_count rows of ec_count next states */
+    u32     *full;          /* TABLES_FULL: state_count rows of ALPHABET_SIZE next states */
+    u32     *yy_row;        /* TABLES_RANGES: arena offset << 1 | encoding of every state */
+    u32     *arena;         /* TABLES_RANGES: rule and row of every state */
+    u32     arena_size;
+    u32     range_rows;     /* Rows encoded as range lists */
+    u8      *map;           /* Saved automaton the arrays point into, NULL if built */
+    size_t  map_size;
+} DFATables;
+
+DFATables *__get_tables(void);
+
+#define g_tables (*__get_tables())
+
+/**
+ * @brief Next state of s on equivalence class c in the comb
+ *
+ * Follows the defaults until a row owns the slot, the class becomes a
+ * meta class when the chain reaches a template.
+ */
+FT_INLINE u32 dfa_tables_next(u32 s, u32 c) {
+    while (g_tables.yy_chk[g_tables.yy_base[s] + c] != s) {
+        s = g_tables.yy_def[s];
+        if (s == DFA_DEAD) return (DFA_DEAD);
+        if (s >= g_tables.state_count) c = g_tables.yy_meta[c];
+    }
+    return (g_tables.yy_nxt[g_tables.yy_base[s] + c]);
+}
+
+u32 dfa_byte_classes(u8 *byte_class, u8 *class_rep);
+u64 dfa_set_fingerprint(Bitmap *nfa_set);
+int find_dfa_state(Bitmap *nfa_set, u64 hash);
+u32 create_dfa_state(Bitmap *nfa_set, u64 hash);
+s8 dfa_expand(u32 first, u32 threads);
+void dfa_index_rebuild(void);
+void dfa_release(DFA *dfa);
 void dfa_free(void);
 void print_dfa(void);
 
+/* dfa/dfa_minimize.c */
+void dfa_minimize(DFAMinimizeStats *stats, DFA *subset);
+
+/* dfa/dfa_parallel.c */
+s8 dfa_expand_parallel(u32 first, u32 threads);
+
+/* dfa/dfa_incremental.c */
+s8 dfa_append(u32 threads, DFAAppendStats *stats);
+
+/* dfa/dfa_lazy.c */
+void lazy_dfa_init(size_t budget);
+void lazy_dfa_free(void);
+LazyDFAStats *lazy_dfa_stats(void);
+void match_lazy_anywhere(char **rules, char *input);
+u32 match_lazy_count(char *input);
+
+/* dfa/dfa_tables.c */
+void dfa_tables_build(DFA *dfa, TablesMode mode);
+void dfa_tables_extend(DFA *dfa, DFAExtendStats *stats);
+void dfa_tables_free(void);
+const char *dfa_tables_mode_name(TablesMode mode);
+s8 dfa_tables_mode_parse(const char *name, TablesMode *mode);
+size_t dfa_tables_bytes(void);
+void match_tables_anywhere(char **rules, char *input);
+u32 match_tables_count(char *input);
+
+/* dfa/dfa_tables_io.c */
+s8 dfa_tables_save(const char *path, char **rules, u32 rule_count, DFA *subset);
+s8 dfa_tables_load(const char *path, char ***rules, u32 *rule_count);
+s8 dfa_tables_load_automaton(const char *path, char ***rules, u32 *rule_count);
+
 #endif /* DFA_IMPLEMENTATION_H */
\ No newline at end of file
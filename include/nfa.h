@@ -2,52 +2,95 @@
 #define NFA_IMPLEMENTATION_H
 
 #include "regex_tree.h"
+#include "sparse_set.h"
 #include "log.h"
 
 
 /* Initial capacity for the NFA states array */
 #define DEFAULT_NFA_CAPACITY 64
 
-/* Initial capacity for the transitions array in each state */
-#define INITIAL_TRANSITIONS_CAPACITY 8
+/* Initial capacity of the construction edge list */
+#define DEFAULT_NFA_EDGE_CAPACITY 128
 
-/* Special character code for wildcard (.) transitions */
-#define NFA_DOT_CHAR 200
+/* Label of an epsilon transition */
+#define NFA_EPSILON 0
+
+/* is_final of a state accepting no rule, rules are numbered from 1 */
+#define NFA_NO_RULE 0
+
+/* Labels from this value are byte sets: g_nfa.sets[label - NFA_LABEL_SET_BASE] */
+#define NFA_LABEL_SET_BASE 256
+
+/* Number of u64 words of a byte set */
+#define BYTE_SET_WORDS 4
+
+/**
+ * @brief Set of bytes matched by a transition (classes, '.')
+ */
+typedef struct {
+    u64     bits[BYTE_SET_WORDS];
+} ByteSet;
 
 /**
  * @brief Represents a transition from one state to another
  * 
- * A transition is triggered by a specific character or epsilon (0).
+ * The label is NFA_EPSILON, a single byte (1..255) or a byte set
+ * interned in the NFA, so a class of any size is a single edge.
  */
 typedef struct {
-    unsigned char    c;     /* Character to match (0 for epsilon transition) */
+    u32     label;          /* NFA_EPSILON, byte value or NFA_LABEL_SET_BASE + set index */
     int     to_id;          /* ID of the destination state */
 } Transition;
 
 /**
  * @brief Represents a state in the NFA
  * 
- * Each state has a unique ID, can be final, and contains a dynamic
- * array of transitions that automatically grows when needed.
+ * Transitions are not stored in the state: they are appended to the
+ * NFA edge list during construction and frozen into CSR arrays.
  */
 typedef struct {
     u32         id;
-    u32         is_final;
-    Transition  *trans;         /* Dynamic array of transitions */
-    u32         trans_count;    /* Current number of transitions */
-    u32         trans_capacity; /* Current capacity of the transitions array */
+    u32         is_final;       /* Rule accepted here, NFA_NO_RULE if none */
 } NFAState;
 
+/**
+ * @brief Transition recorded during construction
+ */
+typedef struct {
+    u32         from;           /* ID of the source state */
+    Transition  t;              /* Label and destination */
+} NFAEdge;
+
 /**
  * @brief Represents the complete NFA
  * 
  * Contains all states in a dynamic array and tracks the start state.
+ * Construction appends to edges; nfa_freeze() then lays the transitions
+ * out in compressed sparse rows, epsilon edges apart from labelled ones:
+ * the epsilon targets of state i are eps_to[eps_offsets[i] .. eps_offsets[i + 1]]
+ * and its labelled transitions sym_trans[sym_offsets[i] .. sym_offsets[i + 1]].
  */
 typedef struct {
     NFAState    *states;        /* Array of all NFA states */
     u32         state_count;    /* Current number of states */
     u32         capacity;       /* Current capacity of the states array */
     u32         start_id;       /* ID of the start state */
+    NFAEdge     *edges;         /* Construction edge list, freed by nfa_freeze */
+    u32         edge_count;
+    u32         edge_capacity;
+    u32         *eps_offsets;   /* CSR: state_count + 1 offsets into eps_to */
+    u32         *eps_to;        /* CSR: epsilon destinations */
+    u32         *sym_offsets;   /* CSR: state_count + 1 offsets into sym_trans */
+    Transition  *sym_trans;     /* CSR: labelled transitions */
+    u32         closure_words;  /* u64 words of every NFA state set, sized from state_count */
+    u32         *closure_offsets;   /* CSR: state_count + 1 offsets into closure_list */
+    u32         *closure_list;      /* CSR: members of the closure of each state */
+    u32         closure_count;  /* States the closures were computed for, see nfa_append */
+    ByteSet     *sets;          /* Interned byte sets of the set labels */
+    u32         set_count;
+    u32         set_capacity;
+    u32         *set_slots;     /* Hash index of sets (set index + 1, 0 is empty) */
+    u32         set_slot_capacity;
 } NFA;
 
 /**
@@ -63,6 +106,25 @@ typedef struct {
     u32     out_capacity;       /* Capacity of the out_ids array */
 } NFAFragment;
 
+/**
+ * @brief Longest match at a position of the input
+ */
+typedef struct {
+    u32     rule;               /* Rule matched, NFA_NO_RULE if none */
+    u32     len;                /* Bytes matched, 0 for an empty match */
+} LexMatch;
+
+/**
+ * @brief Position of the construction: next state and next edge to be created
+ * 
+ * A fragment built from a mark owns the states and edges created since,
+ * it has no transition outside that range until its parent glues it.
+ */
+typedef struct {
+    u32     state;
+    u32     edge;
+} NFAMark;
+
 
 /* nfa/nfa.c */
 
@@ -72,21 +134,131 @@ NFA             *__get_nfa(void);
 /* Macro to access the global NFA instance errno like macro */
 #define g_nfa   (*__get_nfa())
 
+/**
+ * @brief Check if a transition label matches byte c
+ */
+FT_INLINE s8 nfa_label_match(u32 label, u8 c) {
+    if (label < NFA_LABEL_SET_BASE) return (label == c);
+    return ((g_nfa.sets[label - NFA_LABEL_SET_BASE].bits[c >> 6] >> (c & 63)) & 1);
+}
+
+
+/**
+ * @brief Rule winning between two accepted rules, the earliest one as in lex
+ */
+FT_INLINE u32 nfa_rule_first(u32 a, u32 b) {
+    if (a == NFA_NO_RULE) return (b);
+    if (b == NFA_NO_RULE) return (a);
+    return (GET_MIN(a, b));
+}
 
 /* NFA construction functions nfa/nfa.c */
 void        nfa_init(u32 capacity);
 void        nfa_free(void);
-void        nfa_finalize(NFAFragment *frag);
+void        nfa_finalize(NFAFragment *frags, u32 count);
+void        nfa_freeze(void);
+void        nfa_thaw(void);
+void        nfa_append(NFAFragment *frags, u32 count, u32 first_rule);
 NFAFragment thompson_from_tree(RegexTreeNode *node);
 
+/* Construction primitives shared by the Thompson and Glushkov builders */
+u32         create_state(u32 is_final);
+void        add_transition(u32 from_id, u32 label, u32 to_id);
+u32         nfa_symbol_label(RegexTreeNode *node);
+NFAMark     nfa_mark(void);
+NFAFragment frag_create(u32 start_id);
+void        frag_add_out(NFAFragment *f, u32 state_id);
+void        frag_free(NFAFragment *f);
+
+/* nfa/nfa_closure.c */
+void        nfa_compute_closures(u32 first);
+
+/**
+ * @brief Add the precomputed epsilon closure of state to a set
+ */
+FT_INLINE void nfa_closure_add(Bitmap *set, u32 state) {
+    for (u32 j = g_nfa.closure_offsets[state]; j < g_nfa.closure_offsets[state + 1]; j++) {
+        u32 t = g_nfa.closure_list[j];
+        set->bits[t / U64_BITS_NB] |= 1ULL << (t % U64_BITS_NB);
+    }
+}
+
+/**
+ * @brief Add the precomputed epsilon closure of state to a sparse set
+ * @return Earliest rule of the final states that joined, NFA_NO_RULE if none
+ *
+ * Members only join through their closure, so a state already in the
+ * set has its closure in it too and costs a single lookup.
+ */
+FT_INLINE u32 nfa_closure_add_sparse(SparseSet *set, u32 state) {
+    u32 rule = NFA_NO_RULE;
+
+    if (sparse_set_has(set, state)) return (NFA_NO_RULE);
+    for (u32 j = g_nfa.closure_offsets[state]; j < g_nfa.closure_offsets[state + 1]; j++) {
+        u32 t = g_nfa.closure_list[j];
+        if (sparse_set_add(set, t) && g_nfa.states[t].is_final) rule = nfa_rule_first(rule, g_nfa.states[t].is_final);
+    }
+    return (rule);
+}
+
+/**
+ * @brief Epsilon closed set of the states reached from a set on byte c
+ * @param from Sparse NFA state set
+ * @param c Byte to move on
+ * @param result Receives the set, cleared first
+ *
+ * Each target adds its precomputed closure, no closure pass afterwards.
+ * Both sets are sparse: the cost follows the members, not the NFA size.
+ */
+FT_INLINE void nfa_move_sparse(SparseSet *from, u8 c, SparseSet *result) {
+    sparse_set_clear(result);
+    for (u32 k = 0; k < from->count; k++) {
+        u32 i = from->dense[k];
+        for (u32 j = g_nfa.sym_offsets[i]; j < g_nfa.sym_offsets[i + 1]; j++) {
+            /* Match on the byte or a byte set containing it */
+            if (nfa_label_match(g_nfa.sym_trans[j].label, c)) {
+                nfa_closure_add_sparse(result, g_nfa.sym_trans[j].to_id);
+            }
+        }
+    }
+}
+
+/**
+ * @brief State and transition counts around nfa_reduce
+ */
+typedef struct {
+    u32     states_before;
+    u32     trans_before;
+    u32     states_eps_free;    /* After epsilon removal */
+    u32     states_merged;      /* After the bisimulation merges */
+    u32     states_after;       /* After trimming */
+    u32     trans_after;
+} NFAReduceStats;
+
+/* nfa/nfa_reduce.c */
+void        nfa_reduce(NFAReduceStats *stats);
+
+/* nfa/glushkov.c */
+NFAFragment glushkov_from_tree(RegexTreeNode *root);
+
 
 /* nfa/nfa_match.c */
-void        match_nfa_anywhere(char *regex_str, char *input);
+LexMatch    match_nfa(char *input);
+void        match_nfa_anywhere(char **rules, char *input);
+u32         match_nfa_count(char *input);
+void        match_nfa_free(void);
 void        epsilon_closure(Bitmap *states);
 
+/* nfa/nfa_bitpar.c */
+s8          bitpar_build(void);
+void        bitpar_free(void);
+void        match_bitpar_anywhere(char **rules, char *input);
+u32         match_bitpar_count(char *input);
+
 /* nfa/nfa_display.c */
 void        print_nfa_tree(void);
 void        print_nfa(void);
+void        nfa_label_display(u32 label, char *buf, u32 size);
 
 
 
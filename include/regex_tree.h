@@ -3,12 +3,23 @@
 
 #include "string_handler.h"
 #include "bitmap.h"
+#include "arena.h"
+
+/* Number of u64 words for a class bitmap (4 * 64 = 256 bits, one per byte) */
+#define CLASS_BITMAP_WORDS 4ULL
+
+/* Upper bound of {n,} */
+#define REPEAT_INFINITE ((u32)-1)
+
+/* Largest bound accepted in {n,m} */
+#define REPEAT_MAX_BOUND 65535
 
 typedef enum RegexOperator {
     OP_NONE,
     OP_STAR,
     OP_PLUS,
-    OP_OPTIONAL
+    OP_OPTIONAL,
+    OP_REPEAT           /* {n}, {n,} or {n,m}, bounds in rep_min/rep_max */
 } RegexOperator;
 
 typedef enum RegexType{
@@ -16,12 +27,15 @@ typedef enum RegexType{
     REG_CLASS,          /* [abc] or [t%0-2^&(a-z] or [0-9] */
     REG_CONCAT,         /* AB */
     REG_ALT,            /* A|B */
+    REG_GROUP,          /* (A) carrying a second postfix operator, child in left ex: (a+)* */
+    REG_STRING,         /* literal run built by regex_simplify ex: "abc" */
 } RegexType;
 
 
 typedef struct ClassDef {
-    Bitmap  char_bitmap;        /* bitmap for characters in the class */
-    s8      reverse_match;      /* if 1, reverse the match */
+    Bitmap  char_bitmap;                    /* bitmap for characters in the class, bits point to char_bits */
+    u64     char_bits[CLASS_BITMAP_WORDS];  /* inline storage of char_bitmap */
+    s8      reverse_match;                  /* if 1, reverse the match */
 } ClassDef;
 
 
@@ -32,15 +46,49 @@ typedef struct RegexTreeNode_s {
     ClassDef                *class;           /* for character classes like [0-9] */
     char                    c;                /* for single characters */
     RegexOperator           op;               /* for operators like *, +, ? */
+    u32                     rep_min;          /* for OP_REPEAT: minimum count */
+    u32                     rep_max;          /* for OP_REPEAT: maximum count or REPEAT_INFINITE */
+    char                    *str;             /* for literal runs (REG_STRING), not NUL terminated */
+    u32                     str_len;          /* length of str */
+    u32                     id;               /* unique id given by regex_hashcons */
+    u32                     refs;             /* number of parents after regex_hashcons, 0 before */
 } RegexTreeNode;
 
 
 /* regex_tree.c */
+
+/* Get the arena owning every tree node and class of the current compilation */
+Arena           *__get_regex_arena(void);
+
+/* Macro to access the regex tree arena errno like macro */
+#define g_regex_arena   (*__get_regex_arena())
+
+ClassDef        *init_class();
+void            class_byte_set(ClassDef *class, u64 *set);
 RegexTreeNode   *RegexTreeNode_create(RegexType type, RegexTreeNode *left, RegexTreeNode *right, char *str, char c);
-void            RegexTreeNode_free(RegexTreeNode *root);
+void            regex_set_repeat(RegexTreeNode *node, u32 min, u32 max);
+void            regex_tree_free(void);
 void            print_regex_tree(RegexTreeNode* r);
 
 /* regex_parser.c */
 RegexTreeNode   *parse_regex(String *s);
 
+/* regex_simplify.c */
+RegexTreeNode   *regex_simplify(RegexTreeNode *root);
+u32             regex_tree_count(RegexTreeNode *root);
+
+/**
+ * @brief Counters of the hash-consing pass
+ */
+typedef struct {
+    u32     nodes;              /* nodes seen (tree size) */
+    u32     unique_nodes;       /* distinct nodes after sharing */
+    u32     classes;            /* class nodes seen */
+    u32     unique_classes;     /* distinct classes after sharing */
+} HashconsStats;
+
+/* regex_hashcons.c */
+RegexTreeNode   *regex_hashcons(RegexTreeNode *root, HashconsStats *stats);
+void            regex_hashcons_free(void);
+
 #endif /* REGEX_TREE_H */
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef SPARSE_SET_IMPLEMENTATION_H
+#define SPARSE_SET_IMPLEMENTATION_H
+
+#include "basic_define.h"
+
+/**
+ * @brief Sparse set of ids (Briggs and Torczon)
+ *
+ * dense lists the members in insertion order, sparse maps an id to its
+ * index in dense. An id is a member when sparse[id] < count and
+ * dense[sparse[id]] == id, so clearing only resets count and iterating
+ * costs the number of members, not the capacity.
+ */
+typedef struct SparseSet {
+    u32 *dense;     /* Members, dense[0 .. count] */
+    u32 *sparse;    /* Index of an id in dense, only meaningful for members */
+    u32 count;      /* Number of members */
+    u32 capacity;   /* Ids are lower than capacity */
+} SparseSet;
+
+/**
+ * @brief Check if id is a member of the set
+ */
+FT_INLINE s8 sparse_set_has(SparseSet *s, u32 id) {
+    u32 i = s->sparse[id];
+
+    return (i < s->count && s->dense[i] == id);
+}
+
+/**
+ * @brief Add id to the set
+ * @return TRUE if id was not a member yet
+ */
+FT_INLINE s8 sparse_set_add(SparseSet *s, u32 id) {
+    if (sparse_set_has(s, id)) return (FALSE);
+    s->sparse[id] = s->count;
+    s->dense[s->count++] = id;
+    return (TRUE);
+}
+
+/**
+ * @brief Remove every member in O(1)
+ */
+FT_INLINE void sparse_set_clear(SparseSet *s) {
+    s->count = 0;
+}
+
+/* utils/sparse_set.c */
+void    sparse_set_init(SparseSet *s, u32 capacity);
+void    sparse_set_free(SparseSet *s);
+void    sparse_set_swap(SparseSet *a, SparseSet *b);
+
+#endif /* SPARSE_SET_IMPLEMENTATION_H */
@@ -0,0 +1,21 @@
+#ifndef TIMER_IMPLEMENTATION_H
+#define TIMER_IMPLEMENTATION_H
+
+#include <time.h>
+#include "basic_define.h"
+
+/**
+ * @brief Get a monotonic timestamp
+ * @return Current time in nanoseconds
+ */
+FT_INLINE u64 get_time_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec);
+}
+
+/* Convert a nanoseconds delta to milliseconds */
+#define NS_TO_MS(ns) ((f64)(ns) / 1000000.0)
+
+#endif /* TIMER_IMPLEMENTATION_H */
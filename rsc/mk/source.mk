@@ -9,11 +9,25 @@ MAIN_MANDATORY 	=	main.c
 SRCS			=	log.c\
 					regex_tree.c\
 					parse_regex.c\
+					regex_simplify.c\
+					regex_hashcons.c\
 					nfa/nfa.c\
+					nfa/glushkov.c\
 					nfa/nfa_match.c\
+					nfa/nfa_closure.c\
+					nfa/nfa_reduce.c\
+					nfa/nfa_bitpar.c\
 					nfa/nfa_display.c\
 					dfa/dfa.c\
+					dfa/dfa_minimize.c\
+					dfa/dfa_parallel.c\
+					dfa/dfa_lazy.c\
+					dfa/dfa_tables.c\
+					dfa/dfa_tables_io.c\
+					dfa/dfa_incremental.c\
+					utils/arena.c\
 					utils/bitmap.c\
+					utils/sparse_set.c\
 					utils/trim.c\
 					utils/split.c\
 
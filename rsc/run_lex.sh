@@ -22,5 +22,5 @@ lex ${L_FILE}
 
 clang lex.yy.c -o lex.yy -ll
 
-echo -n ${ARGS} | ./lex.yy
+echo -n "${ARGS}" | ./lex.yy
 
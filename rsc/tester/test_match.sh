@@ -12,19 +12,30 @@ BOLD_PURPLE="\e[1;35m"
 LEX=${ROOT_DIR}/rsc/run_lex.sh
 
 LEXER_FILE="test_match.l"
-FT_LEX_TEST="./ft_lex"
+# Extra ft_lex options, ex: FT_LEX_FLAGS=-g to test the Glushkov construction,
+# FT_LEX_FLAGS=-b to test the bit-parallel engine, FT_LEX_FLAGS=-l the lazy DFA,
+# FT_LEX_FLAGS="-C f", "-C e" or "-C r" the other scanner table layouts
+FT_LEX_TEST="./ft_lex ${FT_LEX_FLAGS}"
 
 
 function create_lexer_file() {
-    local regex="${1}"
+    local rules=""
 
-    # log N "Creating rule: ${regex}"
+    # log N "Creating rules: ${*}"
+
+    # One line per rule, in priority order
+    for regex in "${@}"; do
+        # Printed as ft_lex prints it: escaped for the C string and the format
+        local shown=${regex//\\/\\\\}
+        shown=${shown//\"/\\\"}
+        shown=${shown//%/%%}
+        rules+="${regex} printf(\"\\nMatch Rule: ${shown} %s\\n\", yytext);"$'\n'
+    done
 
     cat << EOF > ${LEXER_FILE}
 %%
 
-${regex} printf("\nMatch Rule: ${regex} %s\\n", yytext);
-
+${rules}
 EOF
 }
 
@@ -36,9 +47,10 @@ function test_regex() {
 
     # log N "Testing regex: '${regex}' with input: '${test_str}'"
 
-    local lex_output=$(${LEX} ${LEXER_FILE} \'${test_str}\')
-    local lex_match=$(echo -e "${lex_output}" | grep "Match Rule" | cut -d ' ' -f 4-)
-    local ft_lex_match=$(${FT_LEX_TEST} "${regex}" \'${test_str}\' | grep "Match Rule" | cut -d ' ' -f 4- )
+    # The input as one argument: split, ft_lex would take its words as rules
+    local lex_output=$(${LEX} ${LEXER_FILE} "'${test_str}'")
+    local lex_match=$(echo "${lex_output}" | grep "Match Rule" | cut -d ' ' -f 4-)
+    local ft_lex_match=$(${FT_LEX_TEST} "${regex}" "'${test_str}'" | grep "Match Rule" | cut -d ' ' -f 4- )
 
     if [[ "${lex_match}" == "${ft_lex_match}" ]]; then
         log OK "${BOLD_YELLOW}${regex}${RESET} with input: ${BOLD_PURPLE}${test_str}${RESET}"
@@ -51,6 +63,82 @@ function test_regex() {
 
 }
 
+# Compare the matches of lex on ${LEXER_FILE} with the ones of an ft_lex command line
+# Usage: compare_rules <rules> <how> <test_str> <ft_lex command>...
+function compare_rules() {
+    local rules=${1}
+    local how=${2}
+    local test_str=${3}
+    shift 3
+
+    # The input as one argument: split, ft_lex would take its words as rules
+    local lex_output=$(${LEX} ${LEXER_FILE} "'${test_str}'")
+    local lex_match=$(echo "${lex_output}" | grep "Match Rule" | cut -d ' ' -f 3-)
+    local ft_lex_match=$("${@}" "'${test_str}'" | grep "Match Rule" | cut -d ' ' -f 3- )
+
+    if [[ "${lex_match}" == "${ft_lex_match}" ]]; then
+        log OK "${BOLD_YELLOW}${rules}${RESET} ${how}with input: ${BOLD_PURPLE}${test_str}${RESET}"
+        return 0
+    else
+        log KO "${BOLD_YELLOW}${rules}${RESET} ${how}with input: ${BOLD_PURPLE}${test_str}${RESET}"
+        log E "Expected:\n\n${lex_match}\n\nGot:\n${ft_lex_match}"
+        return 1
+    fi
+}
+
+# Several rules in one lexer: longest match first, then the earliest rule
+function test_rules() {
+    local test_str=${1}
+    shift
+
+    create_lexer_file "${@}"
+    compare_rules "${*}" "" "${test_str}" ${FT_LEX_TEST} "${@}"
+}
+
+# Same as test_rules, the rules compiled once with --save and scanned from the file
+function test_saved_rules() {
+    local test_str=${1}
+    local saved="test_match.ftl"
+    shift
+
+    create_lexer_file "${@}"
+    ${FT_LEX_TEST} --save ${saved} "${@}" > /dev/null
+    compare_rules "${*}" "saved, " "${test_str}" ${FT_LEX_TEST} --load ${saved}
+    local status=${?}
+    rm -f ${saved}
+    return ${status}
+}
+
+# Same as test_rules, the first rule compiled alone and the others added with -a
+function test_appended_rules() {
+    local test_str=${1}
+    local appended="test_match.append"
+    shift
+
+    create_lexer_file "${@}"
+    printf '%s\n' "${@:2}" > ${appended}
+    compare_rules "${*}" "appended, " "${test_str}" ${FT_LEX_TEST} -a ${appended} "${1}"
+    local status=${?}
+    rm -f ${appended}
+    return ${status}
+}
+
+# Same as test_appended_rules, the others added to the automaton saved with the first rule
+function test_extended_rules() {
+    local test_str=${1}
+    local saved="test_match.ftl"
+    local appended="test_match.append"
+    shift
+
+    create_lexer_file "${@}"
+    ${FT_LEX_TEST} --save ${saved} "${1}" > /dev/null
+    printf '%s\n' "${@:2}" > ${appended}
+    compare_rules "${*}" "extended, " "${test_str}" ${FT_LEX_TEST} --load ${saved} -a ${appended}
+    local status=${?}
+    rm -f ${saved} ${appended}
+    return ${status}
+}
+
 make -s > /dev/null 2>&1
 
 function test_class() {
@@ -150,6 +238,34 @@ function test_no_class() {
     test_regex "a.*b" "aXb1 ( aYb aZb a b ab"
     test_regex "l?|ab" "al all lll aXb1 ( aYb aZb a b ab b bb bbb ab ab ab"
 
+    # Nested operators
+    test_regex "(a+)*b" "aab b ab aaaab x"
+    test_regex "((ab|c)+)?d" "abcd d abab ccd xd abd"
+
+    # Bounded repetition {n,m}
+    test_regex "a{2,3}" "aaaaaaaa a aa"
+    test_regex "a{2,}" "aaaaaaaa a aa"
+    test_regex "[0-9]{1,3}" "12345 6 78"
+    test_regex "(ab|c){1,3}x" "abcx cccx ccccx abx"
+    test_regex ".{0,3}b" "aaaab xb b"
+    test_regex "(a?){2,3}b" "aab ab b aaaab"
+
+    # x{0} is the empty string, fused with the literals next to it
+    test_regex "x{0}ab" "xab ab b"
+    test_regex "ab{0}c" "ac abc abbc"
+    test_regex "a{0}b{0,0}c" "abc bc c"
+
+    # Repeated subexpressions (shared by hash-consing)
+    test_regex "([a-f0-9][a-f0-9]|x)-([a-f0-9][a-f0-9]|x)" "a1-x x-ff 0-11 zz-x"
+    test_regex "(ab|cd)x(ab|cd)y(ab|cd)?" "abxcdy cdxaby abxabyab"
+
+    # Negated classes and '.' over every byte
+    test_regex "[^ab]+" "héllo wörld aaa bÈb"
+    test_regex "x..y" "xÈy x y xay xaay"
+
+    # More NFA states than a 640-state set used to hold
+    test_regex "(a|b){0,700}c" "abbac aac c xc"
+
 }
 
 function test_no_op {
@@ -158,11 +274,35 @@ function test_no_op {
     test_regex "aZb|ab|ko" "aXkob aYb aZb a b ab adbabkoskkpokkod"
     test_regex "abcd|ab" "aXkob abcdasYb aZb a b ab adbabkoskkpokkod"
     test_regex "ab|abcd" "aXkabcdaboab abcdasYb aZbabcd a b ab adbabkoskkpokkod"
+
+    # Common prefixes and single characters alternatives
+    test_regex "abc|abd" "abcabdabxabe"
+    test_regex "foo|foobar|fo|bar|baz" "foobarbazfofoo"
+    test_regex "(a|[bc]|d)+" "abcdeadc"
+}
+
+function test_multi_rules {
+    test_rules "if iff x 42 if9" "if" "[a-z]+" "[0-9]+"
+    test_rules "while whilex do done" "[a-z]+" "while" "do"
+    test_rules "abab aab b" "(ab)+" "a+b?" "b"
+    test_rules "1a...1xbc 1.bc" "[.aa-c]{0}1.bc" "c?" "."
+
+    # --save and -a need the full DFA, the -b and -l scans build none
+    if [[ "${FT_LEX_FLAGS}" =~ -[a-zA-Z]*[bl] ]]; then
+        return 0
+    fi
+    test_saved_rules "if iff x 42 if9" "if" "[a-z]+" "[0-9]+"
+    test_saved_rules "while whilex do done" "[a-z]+" "while" "do"
+    test_appended_rules "if iff x 42 if9" "if" "[a-z]+" "[0-9]+"
+    test_appended_rules "abab aab b" "(ab)+" "a+b?" "b"
+    test_extended_rules "if iff x 42 if9" "if" "[a-z]+" "[0-9]+"
+    test_extended_rules "while whilex do done" "[a-z]+" "while" "do"
 }
 
 test_no_op
 test_no_class
 test_class
+test_multi_rules
 
 
 
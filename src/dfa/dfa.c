@@ -7,58 +7,329 @@ DFA *__get_dfa(void) {
     return (&dfa);
 }
 
+/* Initial number of slots of the DFA state index, must be a power of two */
+#define DFA_INDEX_INITIAL_CAPACITY 256
+
+/**
+ * @brief Fingerprint of an NFA set, the XOR of the keys of its members
+ */
+u64 dfa_set_fingerprint(Bitmap *nfa_set) {
+    u64 hash = 0;
+
+    for (u32 i = bitmap_next_set(nfa_set, 0); i != BITMAP_NONE; i = bitmap_next_set(nfa_set, i + 1)) {
+        hash ^= dfa_set_key(i);
+    }
+    return (hash);
+}
+
+static void dfa_index_place(u32 id) {
+    u32 mask = g_dfa.index_capacity - 1;
+    u32 pos = g_dfa.states[id].hash & mask;
+
+    while (g_dfa.index[pos]) pos = (pos + 1) & mask;
+    g_dfa.index[pos] = id + 1;
+}
+
+/**
+ * @brief Put state id in the index, growing it past half full
+ */
+static void dfa_index_insert(u32 id) {
+    if ((id + 1) * 2 > g_dfa.index_capacity) {
+        u32 capacity = g_dfa.index_capacity ? g_dfa.index_capacity * 2 : DFA_INDEX_INITIAL_CAPACITY;
+
+        free(g_dfa.index);
+        g_dfa.index = calloc(capacity, sizeof(u32));
+        if (!g_dfa.index) {
+            ERR("Memory allocation failed for DFA state index\n");
+            exit(1);
+        }
+        g_dfa.memory += (size_t)(capacity - g_dfa.index_capacity) * sizeof(u32);
+        g_dfa.index_capacity = capacity;
+        for (u32 i = 0; i < id; i++) dfa_index_place(i);
+    }
+    dfa_index_place(id);
+}
+
+/**
+ * @brief Index every state again, after they were renumbered or loaded
+ *
+ * The index grows first when the states fill more than half of it.
+ */
+void dfa_index_rebuild(void) {
+    u32 capacity = g_dfa.index_capacity ? g_dfa.index_capacity : DFA_INDEX_INITIAL_CAPACITY;
+
+    while ((size_t)g_dfa.state_count * 2 > capacity) capacity *= 2;
+    if (capacity != g_dfa.index_capacity) {
+        free(g_dfa.index);
+        g_dfa.index = malloc(capacity * sizeof(u32));
+        if (!g_dfa.index) {
+            ERR("Memory allocation failed for DFA state index\n");
+            exit(1);
+        }
+        g_dfa.memory += (size_t)(capacity - g_dfa.index_capacity) * sizeof(u32);
+        g_dfa.index_capacity = capacity;
+    }
+    memset(g_dfa.index, 0, g_dfa.index_capacity * sizeof(u32));
+    for (u32 id = 0; id < g_dfa.state_count; id++) dfa_index_place(id);
+}
+
 /**
  * @brief Find DFA state with matching NFA state set
+ * @param nfa_set NFA state set
+ * @param hash Fingerprint of nfa_set (dfa_set_fingerprint)
  * @return DFA state ID, or -1 if not found
+ *
+ * Linear probing on the fingerprint, the sets are only compared word by
+ * word when the fingerprints agree.
  */
-int find_dfa_state(Bitmap *nfa_set) {
-    for (u32 i = 0; i < g_dfa.state_count; i++) {
-        if (bitmap_equal(&g_dfa.states[i].nfa_states, nfa_set)) {
-            return i;
+int find_dfa_state(Bitmap *nfa_set, u64 hash) {
+    if (!g_dfa.index) return -1;
+
+    u32 mask = g_dfa.index_capacity - 1;
+
+    for (u32 pos = hash & mask; g_dfa.index[pos]; pos = (pos + 1) & mask) {
+        DFAState *state = &g_dfa.states[g_dfa.index[pos] - 1];
+        Bitmap set = dfa_state_set(state->id);
+        if (state->hash == hash && bitmap_equal(&set, nfa_set)) {
+            return state->id;
         }
     }
     return -1;
 }
 
 /**
- * @brief Create new DFA state from NFA state set
- * @return New DFA state ID
+ * @brief Renumber byte classes from 0 in byte order, dropping the empty ones
+ * @return Number of classes
  */
-u32 create_dfa_state(Bitmap *nfa_set) {
-    if (g_dfa.state_count >= MAX_DFA_STATES) {
-        ERR("DFA state limit reached!\n");
+static u32 dfa_class_compact(u32 *cls) {
+    u32 renum[ALPHABET_SIZE * 2];
+    u32 count = 0;
+
+    for (u32 k = 0; k < ALPHABET_SIZE * 2; k++) renum[k] = DFA_DEAD;
+    for (u32 c = 0; c < ALPHABET_SIZE; c++) {
+        if (renum[cls[c]] == DFA_DEAD) renum[cls[c]] = count++;
+        cls[c] = renum[cls[c]];
+    }
+    return (count);
+}
+
+/**
+ * @brief Partition the bytes by the NFA labels holding them
+ * @param byte_class Receives the class of every byte
+ * @param class_rep Receives a byte of every class
+ * @return Number of classes
+ *
+ * Two bytes in the same class are accepted by exactly the same labels,
+ * so every DFA state has the same successor on both: a row only needs a
+ * column per class. Each distinct label splits the classes it cuts.
+ */
+u32 dfa_byte_classes(u8 *byte_class, u8 *class_rep) {
+    u32 edge_count = g_nfa.sym_offsets[g_nfa.state_count];
+    u8  *seen = calloc(NFA_LABEL_SET_BASE + g_nfa.set_count, sizeof(u8));
+    u32 cls[ALPHABET_SIZE] = {0};
+    u32 count = 1;
+
+    if (!seen) {
+        ERR("Memory allocation failed for byte classes\n");
         exit(1);
     }
-    
+
+    for (u32 j = 0; j < edge_count && count < ALPHABET_SIZE; j++) {
+        u32 label = g_nfa.sym_trans[j].label;
+        if (seen[label]) continue;
+        seen[label] = TRUE;
+
+        /* Bytes of class k inside the label move to split[k] */
+        u32 split[ALPHABET_SIZE * 2];
+        u32 next = count;
+        for (u32 k = 0; k < count; k++) split[k] = DFA_DEAD;
+        for (u32 c = 1; c < ALPHABET_SIZE; c++) {
+            if (!nfa_label_match(label, c)) continue;
+            if (split[cls[c]] == DFA_DEAD) split[cls[c]] = next++;
+            cls[c] = split[cls[c]];
+        }
+        count = dfa_class_compact(cls);
+    }
+    free(seen);
+
+    count = dfa_class_compact(cls);
+    memset(class_rep, 0, ALPHABET_SIZE);
+    for (u32 c = ALPHABET_SIZE; c-- > 0;) {
+        /* Lowest byte of the class, byte 0 only when it is alone (it ends the input) */
+        if (c > 0) class_rep[cls[c]] = c;
+        byte_class[c] = cls[c];
+    }
+    return (count);
+}
+
+/**
+ * @brief Grow the DFA arrays to hold capacity states
+ * @return FALSE when it would go past the memory budget
+ */
+static s8 dfa_grow(u32 capacity) {
+    size_t budget = g_dfa.budget ? g_dfa.budget : DFA_DEFAULT_BUDGET_MB << 20;
+    size_t state_bytes = dfa_state_bytes();
+    size_t index_bytes = (size_t)g_dfa.index_capacity * sizeof(u32);
+
+    if ((size_t)capacity * state_bytes + index_bytes > budget) return (FALSE);
+
+    g_dfa.states = realloc(g_dfa.states, (size_t)capacity * sizeof(DFAState));
+    g_dfa.trans = realloc(g_dfa.trans, (size_t)capacity * g_dfa.class_count * sizeof(u32));
+    g_dfa.set_pool = realloc(g_dfa.set_pool, (size_t)capacity * g_dfa.set_words * sizeof(u64));
+    u32 *row = g_dfa.row ? realloc(g_dfa.row, (size_t)capacity * sizeof(u32)) : NULL;
+    if (!g_dfa.states || !g_dfa.trans || !g_dfa.set_pool || (g_dfa.row && !row)) {
+        ERR("Memory allocation failed for DFA states\n");
+        exit(1);
+    }
+    g_dfa.row = row;
+    g_dfa.capacity = capacity;
+    g_dfa.memory = (size_t)capacity * state_bytes + index_bytes;
+    return (TRUE);
+}
+
+/**
+ * @brief Create new DFA state from NFA state set
+ * @param nfa_set NFA state set
+ * @param hash Fingerprint of nfa_set (dfa_set_fingerprint)
+ * @return New DFA state ID, DFA_DEAD when the memory budget is exhausted
+ *
+ * dfa_byte_classes() must have run: the rows are sized from class_count.
+ * The arrays are reallocated as they grow, pointers into them do not
+ * survive a call.
+ */
+u32 create_dfa_state(Bitmap *nfa_set, u64 hash) {
+    if (g_dfa.state_count == 0) g_dfa.set_words = nfa_set->size;
+    if (g_dfa.state_count >= g_dfa.capacity) {
+        u32 capacity = g_dfa.capacity ? g_dfa.capacity * 2 : DFA_INITIAL_CAPACITY;
+        if (!dfa_grow(capacity)) {
+            ERR("DFA memory budget reached: %u states, %zu bytes\n", g_dfa.state_count, g_dfa.memory);
+            return (DFA_DEAD);
+        }
+    }
+
     u32 id = g_dfa.state_count++;
     DFAState *state = &g_dfa.states[id];
+    Bitmap set = dfa_state_set(id);
     
     state->id = id;
-    state->is_final = 0;
-    bitmap_init(&state->nfa_states, BITMAP_STATE_ARRAY_SIZE);
-    bitmap_copy(&state->nfa_states, nfa_set);
+    state->is_final = NFA_NO_RULE;
+    bitmap_copy(&set, nfa_set);
+    state->hash = hash;
+    dfa_index_insert(id);
+    if (g_dfa.row) g_dfa.row[id] = DFA_NO_ROW;
     
-    /* Initialize all transitions to invalid (-1) */
-    for (u32 i = 0; i < ALPHABET_SIZE; i++) {
-        state->transitions[i] = (u32)-1;
+    /* Initialize all transitions to invalid */
+    u32 *row = dfa_row(id);
+    for (u32 k = 0; k < g_dfa.class_count; k++) {
+        row[k] = DFA_DEAD;
     }
     
-    /* Check if any NFA state in this set is final */
-    for (u32 i = 0; i < g_nfa.state_count; i++) {
-        if (bitmap_is_set(nfa_set, i) && g_nfa.states[i].is_final) {
-            state->is_final = 1;
-            break;
-        }
+    /* Accept the earliest rule among the final NFA states of the set */
+    for (u32 i = bitmap_next_set(nfa_set, 0); i != BITMAP_NONE; i = bitmap_next_set(nfa_set, i + 1)) {
+        state->is_final = nfa_rule_first(state->is_final, g_nfa.states[i].is_final);
     }
     
     return id;
 }
 
-void dfa_free(void) {
-    for (u32 i = 0; i < g_dfa.state_count; i++) {
-        free(g_dfa.states[i].nfa_states.bits);
+/**
+ * @brief Expand the DFA states from first, and the states they create
+ * @param first First state whose row is not computed yet
+ * @param threads Number of threads, dfa_expand_parallel from 2
+ * @return FALSE if the DFA went past its memory budget
+ *
+ * States are processed in creation order, the state ids double as the
+ * work queue. With several threads the moves are spread over workers,
+ * the DFA is the same.
+ */
+s8 dfa_expand(u32 first, u32 threads) {
+    Bitmap next_set;
+    bitmap_init(&next_set, g_nfa.closure_words);
+
+    SparseSet from, next;
+    sparse_set_init(&from, g_nfa.state_count);
+    sparse_set_init(&next, g_nfa.state_count);
+
+    s8 complete = TRUE;
+    u32 current_id = first;
+
+    if (threads > 1) {
+        /* The workers expand every state, nothing is left for the loop */
+        complete = dfa_expand_parallel(first, threads);
+        current_id = g_dfa.state_count;
     }
-    g_dfa.state_count = 0;
+
+    /* Process each state once, in creation order */
+    for (; complete && current_id < g_dfa.state_count; current_id++) {
+        Bitmap current_set = dfa_state_set(current_id);
+        
+        DBG("Processing DFA state %d\n", current_id);
+
+        /* List the members once, the moves below only walk the list */
+        sparse_set_clear(&from);
+        for (u32 i = bitmap_next_set(&current_set, 0); i != BITMAP_NONE;
+             i = bitmap_next_set(&current_set, i + 1)) {
+            sparse_set_add(&from, i);
+        }
+        
+        /* For each byte class, through one of its bytes */
+        for (u32 k = 0; complete && k < g_dfa.class_count; k++) {
+            u8 c = g_dfa.class_rep[k];
+            if (c == 0) continue;
+            nfa_move_sparse(&from, c, &next);
+            
+            /* Skip if no states reachable */
+            if (next.count == 0) continue;
+            
+            /* Find or create DFA state for this set, fingerprinted while it is filled */
+            u64 hash = 0;
+            for (u32 m = 0; m < next.count; m++) {
+                bitmap_set(&next_set, next.dense[m]);
+                hash ^= dfa_set_key(next.dense[m]);
+            }
+            int next_id = find_dfa_state(&next_set, hash);
+            if (next_id == -1) {
+                next_id = create_dfa_state(&next_set, hash);
+                complete = (next_id != (int)DFA_DEAD);
+                DBG("  Created new DFA state %d on char '%c' (0x%02x)\n", next_id, 
+                    (c >= 32 && c < 127) ? c : '?', c);
+            }
+            /* Clear the set through its members instead of every word */
+            for (u32 m = 0; m < next.count; m++) next_set.bits[next.dense[m] / U64_BITS_NB] = 0;
+            
+            /* The row is read again, creating a state may move the rows */
+            dfa_row(current_id)[k] = next_id;
+        }
+    }
+    
+    free(next_set.bits);
+    sparse_set_free(&from);
+    sparse_set_free(&next);
+    return (complete);
+}
+
+/**
+ * @brief Free the arrays of a DFA, g_dfa or one kept by dfa_minimize
+ */
+void dfa_release(DFA *dfa) {
+    free(dfa->states);
+    free(dfa->trans);
+    free(dfa->set_pool);
+    free(dfa->index);
+    free(dfa->row);
+    dfa->states = NULL;
+    dfa->trans = NULL;
+    dfa->set_pool = NULL;
+    dfa->index = NULL;
+    dfa->index_capacity = 0;
+    dfa->row = NULL;
+    dfa->state_count = 0;
+    dfa->capacity = 0;
+    dfa->memory = 0;
+}
+
+void dfa_free(void) {
+    dfa_release(&g_dfa);
 }
 
 void print_dfa(void) {
@@ -67,25 +338,27 @@ void print_dfa(void) {
     
     for (u32 i = 0; i < g_dfa.state_count; i++) {
         DFAState *s = &g_dfa.states[i];
-        printf("State d%d%s (NFA states: {", s->id, s->is_final ? " [FINAL]" : "");
+        Bitmap set = dfa_state_set(i);
+        u32 *row = dfa_row(i);
+        printf("State d%d", s->id);
+        if (s->is_final) printf(" [FINAL rule %u]", s->is_final);
+        printf(" (NFA states: {");
         
         /* Print NFA states */
         int first = 1;
-        for (u32 j = 0; j < g_nfa.state_count; j++) {
-            if (bitmap_is_set(&s->nfa_states, j)) {
-                if (!first) printf(", ");
-                printf("%d", j);
-                first = 0;
-            }
+        for (u32 j = bitmap_next_set(&set, 0); j != BITMAP_NONE; j = bitmap_next_set(&set, j + 1)) {
+            if (!first) printf(", ");
+            printf("%d", j);
+            first = 0;
         }
         printf("})\n");
         
         /* Print transitions */
         for (u32 c = 1; c < ALPHABET_SIZE; c++) {
-            if (s->transitions[c] != (u32)-1) {
+            if (row[g_dfa.byte_class[c]] != DFA_DEAD) {
                 printf("  --'%c'--> d%d\n", 
                        (c >= 32 && c < 127) ? c : '?', 
-                       s->transitions[c]);
+                       row[g_dfa.byte_class[c]]);
             }
         }
     }
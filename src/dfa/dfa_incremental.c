@@ -0,0 +1,165 @@
+#include "../../include/nfa.h"
+#include "../../include/dfa.h"
+#include "../../include/log.h"
+
+static void *append_alloc(size_t size) {
+    void *ptr = malloc(GET_MAX(size, 1));
+
+    if (!ptr) {
+        ERR("Memory allocation failed for DFA append\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+/**
+ * @brief Lay the rows and the sets out for the new classes and set size
+ * @param old_class Class of every byte before the append
+ * @param old_classes Number of classes before the append
+ * @param set_words u64 words of an NFA set from now on
+ * @return FALSE when it would go past the memory budget
+ *
+ * New labels only split classes: the bytes of new class k were in one
+ * old class, whose next state the row keeps. The words added to the sets
+ * stay zero, no previous set holds a new NFA state.
+ */
+static s8 dfa_relayout(const u8 *old_class, u32 old_classes, u32 set_words) {
+    size_t  budget = g_dfa.budget ? g_dfa.budget : DFA_DEFAULT_BUDGET_MB << 20;
+    size_t  index_bytes = (size_t)g_dfa.index_capacity * sizeof(u32);
+    u32     old_words = g_dfa.set_words;
+
+    g_dfa.set_words = set_words;
+    if ((size_t)g_dfa.capacity * dfa_state_bytes() + index_bytes > budget) return (FALSE);
+    g_dfa.memory = (size_t)g_dfa.capacity * dfa_state_bytes() + index_bytes;
+
+    if (g_dfa.class_count != old_classes || memcmp(old_class, g_dfa.byte_class, ALPHABET_SIZE) != 0) {
+        u32 *trans = append_alloc((size_t)g_dfa.capacity * g_dfa.class_count * sizeof(u32));
+        for (u32 s = 0; s < g_dfa.state_count; s++) {
+            u32 *old_row = &g_dfa.trans[(size_t)s * old_classes];
+            for (u32 k = 0; k < g_dfa.class_count; k++) {
+                trans[(size_t)s * g_dfa.class_count + k] = old_row[old_class[g_dfa.class_rep[k]]];
+            }
+        }
+        free(g_dfa.trans);
+        g_dfa.trans = trans;
+    }
+    if (set_words != old_words) {
+        u64 *pool = calloc((size_t)GET_MAX(g_dfa.capacity, 1) * set_words, sizeof(u64));
+        if (!pool) {
+            ERR("Memory allocation failed for DFA append\n");
+            exit(1);
+        }
+        for (u32 s = 0; s < g_dfa.state_count; s++) {
+            memcpy(&pool[(size_t)s * set_words], &g_dfa.set_pool[(size_t)s * old_words], old_words * sizeof(u64));
+        }
+        free(g_dfa.set_pool);
+        g_dfa.set_pool = pool;
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Drop the states the start no longer reaches
+ * @return Number of states dropped
+ *
+ * The reached states past the new count fill the holes below it, the
+ * others keep their id: only as many states move as were dropped, then
+ * the rows are renumbered.
+ */
+static u32 dfa_drop_unreachable(void) {
+    u32 n = g_dfa.state_count;
+    u32 *id = append_alloc(n * sizeof(u32));        /* New id, DFA_DEAD if unreached */
+    u32 *queue = append_alloc(n * sizeof(u32));
+    u32 head = 0;
+    u32 tail = 0;
+
+    for (u32 s = 0; s < n; s++) id[s] = DFA_DEAD;
+    id[g_dfa.start_id] = g_dfa.start_id;
+    queue[tail++] = g_dfa.start_id;
+    while (head < tail) {
+        u32 *row = dfa_row(queue[head++]);
+        for (u32 k = 0; k < g_dfa.class_count; k++) {
+            if (row[k] != DFA_DEAD && id[row[k]] == DFA_DEAD) {
+                id[row[k]] = row[k];
+                queue[tail++] = row[k];
+            }
+        }
+    }
+
+    u32 count = tail;
+    u32 hole = 0;
+    for (u32 s = count; s < n; s++) {
+        if (id[s] == DFA_DEAD) continue;
+        while (id[hole] != DFA_DEAD) hole++;
+        id[s] = hole;
+        g_dfa.states[hole] = g_dfa.states[s];
+        g_dfa.states[hole].id = hole;
+        memcpy(dfa_row(hole), dfa_row(s), g_dfa.class_count * sizeof(u32));
+        memcpy(&g_dfa.set_pool[(size_t)hole * g_dfa.set_words], &g_dfa.set_pool[(size_t)s * g_dfa.set_words],
+               g_dfa.set_words * sizeof(u64));
+        if (g_dfa.row) g_dfa.row[hole] = g_dfa.row[s];
+        hole++;
+    }
+    if (count < n) {
+        for (u32 s = 0; s < count; s++) {
+            u32 *row = dfa_row(s);
+            for (u32 k = 0; k < g_dfa.class_count; k++) {
+                if (row[k] != DFA_DEAD) row[k] = id[row[k]];
+            }
+        }
+        g_dfa.start_id = id[g_dfa.start_id];
+        g_dfa.state_count = count;
+        dfa_index_rebuild();
+    }
+    free(id);
+    free(queue);
+    return (n - count);
+}
+
+/**
+ * @brief Determinize the rules nfa_append added to the NFA of g_dfa
+ * @param threads Number of threads, dfa_expand_parallel from 2
+ * @param stats Receives the state and class counts
+ * @return FALSE if the DFA went past its memory budget
+ *
+ * g_dfa must be the subset construction of the NFA before nfa_append,
+ * not minimized. A previous NFA state reaches no new one, so a DFA state
+ * made of previous NFA states has the same row in the new automaton: it
+ * is kept, only its columns follow the new byte classes. The new start
+ * holds the new start of the NFA, it and the states it leads to are
+ * expanded; a reached previous state is found in the index and stops the
+ * expansion. Previous states the new start does not reach are dropped.
+ * With a row map (a loaded automaton), kept states keep their table row
+ * and new ones have DFA_NO_ROW, for dfa_tables_extend.
+ */
+s8 dfa_append(u32 threads, DFAAppendStats *stats) {
+    u8  old_class[ALPHABET_SIZE];
+    u32 old_classes = g_dfa.class_count;
+    u32 old_count = g_dfa.state_count;
+
+    memcpy(old_class, g_dfa.byte_class, ALPHABET_SIZE);
+    g_dfa.class_count = dfa_byte_classes(g_dfa.byte_class, g_dfa.class_rep);
+    *stats = (DFAAppendStats){old_count, 0, 0, 0, old_classes, g_dfa.class_count};
+    if (!dfa_relayout(old_class, old_classes, g_nfa.closure_words)) {
+        ERR("DFA memory budget reached: %u states, %zu bytes\n", g_dfa.state_count, g_dfa.memory);
+        return (FALSE);
+    }
+
+    /* The set holds the new NFA start, it is in no previous state */
+    Bitmap start_set;
+    bitmap_init(&start_set, g_nfa.closure_words);
+    bitmap_set(&start_set, g_nfa.start_id);
+    epsilon_closure(&start_set);
+    g_dfa.start_id = create_dfa_state(&start_set, dfa_set_fingerprint(&start_set));
+    free(start_set.bits);
+
+    s8 complete = (g_dfa.start_id != DFA_DEAD) && dfa_expand(old_count, threads);
+    if (!complete) return (FALSE);
+
+    stats->states_new = g_dfa.state_count - old_count;
+    stats->states_dropped = dfa_drop_unreachable();
+    stats->states_reused = old_count - stats->states_dropped;
+    INFO("DFA append: %u states reused, %u new, %u dropped, %u -> %u byte classes\n",
+         stats->states_reused, stats->states_new, stats->states_dropped, old_classes, g_dfa.class_count);
+    return (TRUE);
+}
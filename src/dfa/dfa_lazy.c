@@ -0,0 +1,312 @@
+#include "../../include/nfa.h"
+#include "../../include/dfa.h"
+#include "../../include/log.h"
+
+/* Transition not computed yet */
+#define LAZY_UNKNOWN ((u32)-2)
+
+/* Fewest states the cache holds, whatever the budget */
+#define LAZY_MIN_STATES 16
+
+/* Bytes scanned per cached state below which a full cache means thrashing */
+#define LAZY_THRASH_BYTES_PER_STATE 4
+
+/**
+ * @brief DFA built while scanning, states cached in a fixed budget
+ *
+ * The NFA set of state s is members[set_off[s] .. set_off[s + 1]],
+ * sorted so equal sets compare with memcmp. A row holds LAZY_UNKNOWN
+ * until the input takes that transition.
+ */
+typedef struct {
+    u32         *trans;         /* capacity rows of class_count next states */
+    u32         *set_off;       /* capacity + 1 offsets into members */
+    u32         *members;
+    u64         *hash;          /* Fingerprint of the set, see dfa_set_key */
+    u32         *final;         /* Rule accepted by the state, see nfa_rule_first */
+    u32         *index;         /* state + 1 by fingerprint, 0 is empty */
+    u32         index_capacity; /* power of two */
+    u32         count;
+    u32         capacity;
+    u32         member_capacity;
+    u32         start;          /* LAZY_UNKNOWN after a flush */
+    u8          byte_class[ALPHABET_SIZE];
+    u32         class_count;
+    u64         bytes_since_flush;
+    SparseSet   next;           /* Scratch set of the moves */
+    LazyDFAStats stats;
+} LazyDFA;
+
+static LazyDFA *__get_lazy(void) {
+    static LazyDFA lazy = {0};
+    return (&lazy);
+}
+
+#define g_lazy (*__get_lazy())
+
+static void *lazy_alloc(size_t size) {
+    void *ptr = malloc(GET_MAX(size, 1));
+
+    if (!ptr) {
+        ERR("Memory allocation failed for lazy DFA\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+/**
+ * @brief Drop every cached state
+ */
+static void lazy_flush(void) {
+    g_lazy.count = 0;
+    g_lazy.set_off[0] = 0;
+    g_lazy.start = LAZY_UNKNOWN;
+    memset(g_lazy.index, 0, g_lazy.index_capacity * sizeof(u32));
+}
+
+/**
+ * @brief Size the cache from the budget and the NFA
+ * @param budget Bytes for the cache, 0 for the default
+ *
+ * Half of the budget holds the members of the sets, the other half the
+ * states (row, offsets, fingerprint, value and two index slots each).
+ */
+void lazy_dfa_init(size_t budget) {
+    lazy_dfa_free();
+    if (!budget) budget = LAZY_DEFAULT_BUDGET_KB << 10;
+
+    u8 class_rep[ALPHABET_SIZE];
+    g_lazy.class_count = dfa_byte_classes(g_lazy.byte_class, class_rep);
+
+    size_t state_bytes = g_lazy.class_count * sizeof(u32) + 2 * sizeof(u32) + sizeof(u64) + 3 * sizeof(u32);
+    g_lazy.capacity = GET_MAX(budget / 2 / state_bytes, LAZY_MIN_STATES);
+    g_lazy.member_capacity = GET_MAX(budget / 2 / sizeof(u32), g_nfa.state_count);
+    g_lazy.index_capacity = 1;
+    while (g_lazy.index_capacity < g_lazy.capacity * 2) g_lazy.index_capacity *= 2;
+
+    g_lazy.trans = lazy_alloc((size_t)g_lazy.capacity * g_lazy.class_count * sizeof(u32));
+    g_lazy.set_off = lazy_alloc(((size_t)g_lazy.capacity + 1) * sizeof(u32));
+    g_lazy.members = lazy_alloc((size_t)g_lazy.member_capacity * sizeof(u32));
+    g_lazy.hash = lazy_alloc((size_t)g_lazy.capacity * sizeof(u64));
+    g_lazy.final = lazy_alloc((size_t)g_lazy.capacity * sizeof(u32));
+    g_lazy.index = lazy_alloc((size_t)g_lazy.index_capacity * sizeof(u32));
+    sparse_set_init(&g_lazy.next, g_nfa.state_count);
+    g_lazy.stats = (LazyDFAStats){0};
+    g_lazy.stats.capacity = g_lazy.capacity;
+    g_lazy.bytes_since_flush = 0;
+    lazy_flush();
+}
+
+void lazy_dfa_free(void) {
+    free(g_lazy.trans);
+    free(g_lazy.set_off);
+    free(g_lazy.members);
+    free(g_lazy.hash);
+    free(g_lazy.final);
+    free(g_lazy.index);
+    sparse_set_free(&g_lazy.next);
+    g_lazy = (LazyDFA){0};
+}
+
+/**
+ * @brief Counters of the lazy DFA since lazy_dfa_init()
+ */
+LazyDFAStats *lazy_dfa_stats(void) {
+    return (&g_lazy.stats);
+}
+
+static int u32_cmp(const void *a, const void *b) {
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+
+    return ((x > y) - (x < y));
+}
+
+/**
+ * @brief Find or add the state of the set in g_lazy.next
+ * @return The state, LAZY_UNKNOWN when the cache is full
+ */
+static u32 lazy_state(void) {
+    SparseSet   *set = &g_lazy.next;
+    u64         hash = 0;
+    u32         mask = g_lazy.index_capacity - 1;
+    u32         pos;
+
+    qsort(set->dense, set->count, sizeof(u32), u32_cmp);
+    for (u32 i = 0; i < set->count; i++) hash ^= dfa_set_key(set->dense[i]);
+
+    for (pos = hash & mask; g_lazy.index[pos]; pos = (pos + 1) & mask) {
+        u32 s = g_lazy.index[pos] - 1;
+        u32 len = g_lazy.set_off[s + 1] - g_lazy.set_off[s];
+        if (g_lazy.hash[s] == hash && len == set->count
+            && memcmp(&g_lazy.members[g_lazy.set_off[s]], set->dense, len * sizeof(u32)) == 0) {
+            return (s);
+        }
+    }
+
+    u32 off = g_lazy.set_off[g_lazy.count];
+    if (g_lazy.count == g_lazy.capacity || off + set->count > g_lazy.member_capacity) {
+        return (LAZY_UNKNOWN);
+    }
+
+    u32 s = g_lazy.count++;
+    memcpy(&g_lazy.members[off], set->dense, set->count * sizeof(u32));
+    g_lazy.set_off[s + 1] = off + set->count;
+    g_lazy.hash[s] = hash;
+    g_lazy.final[s] = NFA_NO_RULE;
+    for (u32 i = 0; i < set->count; i++) {
+        g_lazy.final[s] = nfa_rule_first(g_lazy.final[s], g_nfa.states[set->dense[i]].is_final);
+    }
+    for (u32 k = 0; k < g_lazy.class_count; k++) {
+        g_lazy.trans[(size_t)s * g_lazy.class_count + k] = LAZY_UNKNOWN;
+    }
+    g_lazy.index[pos] = s + 1;
+    g_lazy.stats.states++;
+    return (s);
+}
+
+/**
+ * @brief Add the state of g_lazy.next, flushing the cache when it is full
+ * @return The state, DFA_DEAD when the cache thrashes
+ *
+ * The cache is full of states or of set members. Filling it in fewer than
+ * LAZY_THRASH_BYTES_PER_STATE bytes per cached state means it does not pay
+ * for itself on this input: the scan falls back to the NFA simulation.
+ */
+static u32 lazy_state_or_flush(void) {
+    u32 s = lazy_state();
+
+    if (s != LAZY_UNKNOWN) return (s);
+    if (g_lazy.bytes_since_flush < (u64)LAZY_THRASH_BYTES_PER_STATE * g_lazy.count) {
+        g_lazy.stats.fallback = TRUE;
+        return (DFA_DEAD);
+    }
+    g_lazy.stats.flushes++;
+    g_lazy.bytes_since_flush = 0;
+    lazy_flush();
+    return (lazy_state());
+}
+
+/**
+ * @brief Start state, created again after a flush
+ */
+static u32 lazy_start(void) {
+    if (g_lazy.start == LAZY_UNKNOWN) {
+        sparse_set_clear(&g_lazy.next);
+        nfa_closure_add_sparse(&g_lazy.next, g_nfa.start_id);
+        g_lazy.start = lazy_state_or_flush();
+    }
+    return (g_lazy.start);
+}
+
+/**
+ * @brief Compute the transition of state s on byte c
+ * @return The next state, DFA_DEAD if none or if the cache thrashes
+ */
+static u32 lazy_miss(u32 s, u8 c) {
+    SparseSet *next = &g_lazy.next;
+
+    g_lazy.stats.misses++;
+    sparse_set_clear(next);
+    for (u32 m = g_lazy.set_off[s]; m < g_lazy.set_off[s + 1]; m++) {
+        u32 i = g_lazy.members[m];
+        for (u32 j = g_nfa.sym_offsets[i]; j < g_nfa.sym_offsets[i + 1]; j++) {
+            if (nfa_label_match(g_nfa.sym_trans[j].label, c)) {
+                nfa_closure_add_sparse(next, g_nfa.sym_trans[j].to_id);
+            }
+        }
+    }
+    if (next->count == 0) {
+        g_lazy.trans[(size_t)s * g_lazy.class_count + g_lazy.byte_class[c]] = DFA_DEAD;
+        return (DFA_DEAD);
+    }
+
+    u32 flushes = g_lazy.stats.flushes;
+    u32 t = lazy_state_or_flush();
+
+    /* After a flush s is gone, only t is kept */
+    if (t != DFA_DEAD && flushes == g_lazy.stats.flushes) {
+        g_lazy.trans[(size_t)s * g_lazy.class_count + g_lazy.byte_class[c]] = t;
+    }
+    return (t);
+}
+
+/**
+ * @brief Longest match starting at input with the lazy DFA
+ * @return Longest match and its rule, rule NFA_NO_RULE if no match
+ */
+static LexMatch match_lazy(char *input) {
+    if (g_lazy.stats.fallback) return (match_nfa(input));
+
+    u32         state = lazy_start();
+    char        *ptr = input;
+    char        *hit_from = input;      /* Bytes from here were cache hits */
+    LexMatch    match = {NFA_NO_RULE, 0};
+
+    if (state == DFA_DEAD) return (match_nfa(input));
+    match.rule = g_lazy.final[state];
+    while (*ptr) {
+        u32 t = g_lazy.trans[(size_t)state * g_lazy.class_count + g_lazy.byte_class[(u8)*ptr]];
+
+        if (t == LAZY_UNKNOWN) {
+            /* Counters are settled before the thrash check of the miss */
+            g_lazy.stats.hits += ptr - hit_from;
+            g_lazy.bytes_since_flush += ptr - hit_from;
+            hit_from = ptr;
+            t = lazy_miss(state, (u8)*ptr);
+            if (g_lazy.stats.fallback) return (match_nfa(input));
+            if (t == DFA_DEAD) break;
+            g_lazy.bytes_since_flush++;
+            hit_from = ptr + 1;
+        }
+        if (t == DFA_DEAD) break;
+        state = t;
+        ptr++;
+        if (g_lazy.final[state] != NFA_NO_RULE) match = (LexMatch){g_lazy.final[state], ptr - input};
+    }
+    g_lazy.stats.hits += ptr - hit_from;
+    g_lazy.bytes_since_flush += ptr - hit_from;
+    return (match);
+}
+
+/**
+ * @brief Find all matches anywhere in the input with the lazy DFA
+ * @param rules Regex of every rule, rules[r - 1] for rule r
+ * @param input Input string to search for matches
+ *
+ * Same scanning rules as match_nfa_anywhere, lazy_dfa_init() must have run.
+ */
+void match_lazy_anywhere(char **rules, char *input) {
+    char *p = input;
+
+    while (*p) {
+        LexMatch match = match_lazy(p);
+        if (match.len > 0) {
+            printf("LAZY✅Match Rule: %s ", rules[match.rule - 1]);
+            fwrite(p, 1, match.len, stdout);
+            printf("\n");
+            p += match.len;
+        } else {
+            p++;
+        }
+    }
+}
+
+/**
+ * @brief Count the matches match_lazy_anywhere would print, without printing
+ */
+u32 match_lazy_count(char *input) {
+    char *p = input;
+    u32 count = 0;
+
+    while (*p) {
+        LexMatch match = match_lazy(p);
+        if (match.len > 0) {
+            count++;
+            p += match.len;
+        } else {
+            p++;
+        }
+    }
+    return (count);
+}
@@ -0,0 +1,291 @@
+#include "../../include/nfa.h"
+#include "../../include/dfa.h"
+#include "../../include/log.h"
+
+/**
+ * @brief Partition of the states in blocks, Hopcroft refinement
+ *
+ * The members of block b are elems[first[b] .. end[b]], the marked ones
+ * of the current round are moved to the front, up to mid[b].
+ */
+typedef struct {
+    u32     *elems;
+    u32     *pos;           /* Index of a state in elems */
+    u32     *block;         /* Block of a state */
+    u32     *first;
+    u32     *end;
+    u32     *mid;
+    u32     count;          /* Number of blocks */
+} Partition;
+
+/**
+ * @brief Pending splitters (block, class)
+ */
+typedef struct {
+    u32     *items;         /* block * class_count + class */
+    u32     count;
+    u8      *pending;       /* pending[block * class_count + class] */
+} Worklist;
+
+static void *minimize_alloc(size_t size) {
+    void *ptr = malloc(GET_MAX(size, 1));
+
+    if (!ptr) {
+        ERR("Memory allocation failed for DFA minimization\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+static void worklist_push(Worklist *w, u32 item) {
+    if (w->pending[item]) return;
+    w->pending[item] = TRUE;
+    w->items[w->count++] = item;
+}
+
+static int u64_cmp(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+
+    return ((x > y) - (x < y));
+}
+
+/**
+ * @brief Initial blocks: states with the same is_final value
+ *
+ * is_final is kept as a value, accepting states of different rules are
+ * never merged. The sink state n (the dead transitions) is non accepting.
+ */
+static void partition_init(Partition *p, u32 n) {
+    u64 *keyed = minimize_alloc((n + 1) * sizeof(u64));
+
+    /* (is_final << 32 | state), sorted to group the states by value */
+    for (u32 s = 0; s < n; s++) keyed[s] = ((u64)g_dfa.states[s].is_final << 32) | s;
+    keyed[n] = n;
+    qsort(keyed, n + 1, sizeof(u64), u64_cmp);
+
+    p->count = 0;
+    for (u32 i = 0; i <= n; i++) {
+        u32 s = (u32)keyed[i];
+        if (i == 0 || (keyed[i] >> 32) != (keyed[i - 1] >> 32)) {
+            if (p->count > 0) p->end[p->count - 1] = i;
+            p->first[p->count] = i;
+            p->mid[p->count] = i;
+            p->count++;
+        }
+        p->elems[i] = s;
+        p->pos[s] = i;
+        p->block[s] = p->count - 1;
+    }
+    p->end[p->count - 1] = n + 1;
+    free(keyed);
+}
+
+/**
+ * @brief Mark state s in its block
+ * @return TRUE if s is the first marked state of its block
+ */
+static s8 partition_mark(Partition *p, u32 s) {
+    u32 b = p->block[s];
+    u32 i = p->pos[s];
+    u32 m = p->mid[b];
+
+    if (i < m) return (FALSE);
+    p->elems[i] = p->elems[m];
+    p->pos[p->elems[i]] = i;
+    p->elems[m] = s;
+    p->pos[s] = m;
+    p->mid[b]++;
+    return (m == p->first[b]);
+}
+
+/**
+ * @brief Minimize g_dfa in place with Hopcroft's algorithm
+ * @param stats Receives the state counts and table sizes
+ * @param subset Receives the DFA before minimization, row mapping each
+ *               state to its new id; NULL to free it
+ *
+ * The DFA is completed by a sink state standing for DFA_DEAD. Predecessor
+ * lists per (state, class) let a splitter (A, k) mark the states entering
+ * A on class k, every marked block is split and the smaller half queued
+ * for the classes where the block was not already pending. O(k n log n).
+ * States equivalent to the sink become dead transitions, the start state
+ * keeps id 0 and states keep their creation order.
+ */
+void dfa_minimize(DFAMinimizeStats *stats, DFA *subset) {
+    u32 n = g_dfa.state_count;
+    u32 k_count = g_dfa.class_count;
+    u32 total = n + 1;
+
+    stats->states_before = n;
+    stats->bytes_before = (size_t)n * dfa_state_bytes();
+
+    /* Predecessors: sources of the transitions into t on k, keyed t * k_count + k */
+    u32 *inv_off = calloc((size_t)total * k_count + 1, sizeof(u32));
+    u32 *inv = minimize_alloc((size_t)n * k_count * sizeof(u32));
+    if (!inv_off) {
+        ERR("Memory allocation failed for DFA minimization\n");
+        exit(1);
+    }
+    for (u32 s = 0; s < n; s++) {
+        u32 *row = dfa_row(s);
+        for (u32 k = 0; k < k_count; k++) {
+            u32 t = (row[k] == DFA_DEAD) ? n : row[k];
+            inv_off[(size_t)t * k_count + k + 1]++;
+        }
+    }
+    for (size_t i = 0; i < (size_t)total * k_count; i++) inv_off[i + 1] += inv_off[i];
+    u32 *fill = minimize_alloc((size_t)total * k_count * sizeof(u32));
+    memcpy(fill, inv_off, (size_t)total * k_count * sizeof(u32));
+    for (u32 s = 0; s < n; s++) {
+        u32 *row = dfa_row(s);
+        for (u32 k = 0; k < k_count; k++) {
+            u32 t = (row[k] == DFA_DEAD) ? n : row[k];
+            inv[fill[(size_t)t * k_count + k]++] = s;
+        }
+    }
+    free(fill);
+
+    Partition p;
+    p.elems = minimize_alloc(total * sizeof(u32));
+    p.pos = minimize_alloc(total * sizeof(u32));
+    p.block = minimize_alloc(total * sizeof(u32));
+    p.first = minimize_alloc(total * sizeof(u32));
+    p.end = minimize_alloc(total * sizeof(u32));
+    p.mid = minimize_alloc(total * sizeof(u32));
+    partition_init(&p, n);
+
+    Worklist w;
+    w.items = minimize_alloc((size_t)total * k_count * sizeof(u32));
+    w.pending = calloc((size_t)total * k_count, sizeof(u8));
+    w.count = 0;
+    if (!w.pending) {
+        ERR("Memory allocation failed for DFA minimization\n");
+        exit(1);
+    }
+    for (u32 b = 0; b < p.count; b++) {
+        for (u32 k = 0; k < k_count; k++) worklist_push(&w, b * k_count + k);
+    }
+
+    u32 *splitter = minimize_alloc(total * sizeof(u32));
+    u32 *touched = minimize_alloc(total * sizeof(u32));
+
+    while (w.count > 0) {
+        u32 item = w.items[--w.count];
+        u32 a = item / k_count;
+        u32 k = item % k_count;
+        u32 size = p.end[a] - p.first[a];
+        u32 touched_count = 0;
+
+        w.pending[item] = FALSE;
+        /* Copy A first, marking may reorder its members */
+        memcpy(splitter, &p.elems[p.first[a]], size * sizeof(u32));
+        for (u32 i = 0; i < size; i++) {
+            size_t key = (size_t)splitter[i] * k_count + k;
+            for (u32 j = inv_off[key]; j < inv_off[key + 1]; j++) {
+                if (partition_mark(&p, inv[j])) touched[touched_count++] = p.block[inv[j]];
+            }
+        }
+
+        for (u32 i = 0; i < touched_count; i++) {
+            u32 b = touched[i];
+            if (p.mid[b] == p.end[b]) {
+                /* Every member marked, no split */
+                p.mid[b] = p.first[b];
+                continue;
+            }
+
+            /* The marked members become the new block nb */
+            u32 nb = p.count++;
+            p.first[nb] = p.first[b];
+            p.end[nb] = p.mid[b];
+            p.mid[nb] = p.first[nb];
+            p.first[b] = p.mid[b];
+            for (u32 e = p.first[nb]; e < p.end[nb]; e++) p.block[p.elems[e]] = nb;
+
+            u32 smaller = (p.end[nb] - p.first[nb] < p.end[b] - p.first[b]) ? nb : b;
+            for (u32 j = 0; j < k_count; j++) {
+                worklist_push(&w, (w.pending[b * k_count + j] ? nb : smaller) * k_count + j);
+            }
+        }
+    }
+    free(splitter);
+    free(touched);
+    free(w.items);
+    free(w.pending);
+    free(inv_off);
+    free(inv);
+
+    /* New ids: blocks in order of their first state, the sink block is dead */
+    u32 sink = p.block[n];
+    u32 *new_id = minimize_alloc(p.count * sizeof(u32));
+    u32 *rep = minimize_alloc(p.count * sizeof(u32));
+    u32 count = 0;
+
+    for (u32 b = 0; b < p.count; b++) new_id[b] = DFA_DEAD;
+    new_id[p.block[g_dfa.start_id]] = count;
+    rep[count++] = g_dfa.start_id;
+    for (u32 s = 0; s < n; s++) {
+        u32 b = p.block[s];
+        if (new_id[b] != DFA_DEAD || b == sink) continue;
+        new_id[b] = count;
+        rep[count++] = s;
+    }
+
+    DFAState    *states = minimize_alloc((size_t)count * sizeof(DFAState));
+    u32         *trans = minimize_alloc((size_t)count * k_count * sizeof(u32));
+    u64         *set_pool = minimize_alloc((size_t)count * g_dfa.set_words * sizeof(u64));
+
+    for (u32 id = 0; id < count; id++) {
+        u32 old = rep[id];
+        u32 *row = dfa_row(old);
+
+        states[id] = g_dfa.states[old];
+        states[id].id = id;
+        memcpy(&set_pool[(size_t)id * g_dfa.set_words], dfa_state_set(old).bits, g_dfa.set_words * sizeof(u64));
+        for (u32 k = 0; k < k_count; k++) {
+            u32 t = row[k];
+            u32 b = (t == DFA_DEAD) ? sink : p.block[t];
+            trans[(size_t)id * k_count + k] = (b == sink) ? DFA_DEAD : new_id[b];
+        }
+    }
+    if (subset) {
+        /* What --save keeps for dfa_append, the states equivalent to the sink have no row */
+        u32 *row = minimize_alloc((size_t)n * sizeof(u32));
+        for (u32 s = 0; s < n; s++) row[s] = (p.block[s] == sink) ? DFA_DEAD : new_id[p.block[s]];
+        *subset = g_dfa;
+        subset->row = row;
+        subset->index = NULL;
+        subset->index_capacity = 0;
+    }
+    free(new_id);
+    free(rep);
+    free(p.elems);
+    free(p.pos);
+    free(p.block);
+    free(p.first);
+    free(p.end);
+    free(p.mid);
+
+    /* The fingerprint index is only needed while determinizing */
+    if (!subset) {
+        free(g_dfa.states);
+        free(g_dfa.trans);
+        free(g_dfa.set_pool);
+    }
+    free(g_dfa.index);
+    free(g_dfa.row);
+    g_dfa.states = states;
+    g_dfa.trans = trans;
+    g_dfa.set_pool = set_pool;
+    g_dfa.index = NULL;
+    g_dfa.index_capacity = 0;
+    g_dfa.row = NULL;
+    g_dfa.state_count = count;
+    g_dfa.capacity = count;
+    g_dfa.start_id = 0;
+    g_dfa.memory = (size_t)count * dfa_state_bytes();
+
+    stats->states_after = count;
+    stats->bytes_after = g_dfa.memory;
+}
@@ -0,0 +1,259 @@
+#include "../../include/nfa.h"
+#include "../../include/dfa.h"
+#include "../../include/log.h"
+#include <pthread.h>
+
+/* Most states expanded per round, bounds the pending sets kept in memory */
+#define DFA_PARALLEL_BATCH 8192
+
+/* Rounds with fewer states are expanded by the calling thread alone */
+#define DFA_PARALLEL_MIN_BATCH 64
+
+/* States a worker claims at once */
+#define DFA_PARALLEL_CHUNK 32
+
+/**
+ * @brief Successor set not in the DFA yet, created by the merge
+ */
+typedef struct {
+    u32     state;          /* Source DFA state */
+    u32     class;          /* Byte class of the transition */
+    u64     hash;
+    u32     offset;         /* Members in the pool of the worker */
+    u32     count;
+} PendingSet;
+
+/**
+ * @brief Scratch data of one worker, kept across the rounds
+ */
+typedef struct {
+    SparseSet   from;
+    SparseSet   next;
+    Bitmap      lookup;     /* next as a bitmap, for find_dfa_state */
+    PendingSet  *pending;
+    u32         pending_count;
+    u32         pending_capacity;
+    u32         *pool;      /* Members of the pending sets */
+    u32         pool_count;
+    u32         pool_capacity;
+} DFAWorker;
+
+/**
+ * @brief A chunk of the round: its states and the pending sets they gave
+ */
+typedef struct {
+    u32     worker;
+    u32     first_pending;
+    u32     end_pending;
+} DFAChunk;
+
+/**
+ * @brief One round: the states [first, end) are expanded
+ */
+typedef struct {
+    DFAWorker   *workers;
+    DFAChunk    *chunks;
+    u32         chunk_count;
+    u32         next_chunk;     /* Claimed with an atomic increment */
+    u32         first;
+    u32         end;
+} DFARound;
+
+typedef struct {
+    DFARound    *round;
+    u32         worker;
+} DFAWorkerArg;
+
+static void *parallel_realloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, GET_MAX(size, 1));
+    if (!ptr) {
+        ERR("Memory allocation failed for parallel DFA construction\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+/**
+ * @brief Keep the set of w->next for the merge
+ */
+static void worker_defer(DFAWorker *w, u32 state, u32 class, u64 hash) {
+    if (w->pending_count == w->pending_capacity) {
+        w->pending_capacity = w->pending_capacity ? w->pending_capacity * 2 : 256;
+        w->pending = parallel_realloc(w->pending, w->pending_capacity * sizeof(PendingSet));
+    }
+    while (w->pool_count + w->next.count > w->pool_capacity) {
+        w->pool_capacity = w->pool_capacity ? w->pool_capacity * 2 : 4096;
+        w->pool = parallel_realloc(w->pool, (size_t)w->pool_capacity * sizeof(u32));
+    }
+    memcpy(&w->pool[w->pool_count], w->next.dense, w->next.count * sizeof(u32));
+    w->pending[w->pending_count++] = (PendingSet){state, class, hash, w->pool_count, w->next.count};
+    w->pool_count += w->next.count;
+}
+
+/**
+ * @brief Expand one DFA state: fill its row, defer the sets not found
+ *
+ * The DFA is only read here, the merge is the only writer. Rows of
+ * different states are disjoint, so each worker writes its own.
+ */
+static void worker_expand(DFAWorker *w, u32 id) {
+    Bitmap  set = dfa_state_set(id);
+    u32     *row = dfa_row(id);
+
+    sparse_set_clear(&w->from);
+    for (u32 i = bitmap_next_set(&set, 0); i != BITMAP_NONE; i = bitmap_next_set(&set, i + 1)) {
+        sparse_set_add(&w->from, i);
+    }
+    for (u32 k = 0; k < g_dfa.class_count; k++) {
+        u8 c = g_dfa.class_rep[k];
+        if (c == 0) continue;
+        nfa_move_sparse(&w->from, c, &w->next);
+        if (w->next.count == 0) continue;
+
+        u64 hash = 0;
+        for (u32 m = 0; m < w->next.count; m++) {
+            bitmap_set(&w->lookup, w->next.dense[m]);
+            hash ^= dfa_set_key(w->next.dense[m]);
+        }
+        int found = find_dfa_state(&w->lookup, hash);
+        for (u32 m = 0; m < w->next.count; m++) w->lookup.bits[w->next.dense[m] / U64_BITS_NB] = 0;
+
+        if (found != -1) {
+            row[k] = found;
+        } else {
+            worker_defer(w, id, k, hash);
+        }
+    }
+}
+
+/**
+ * @brief Claim chunks of the round until none is left
+ */
+static void *worker_run(void *data) {
+    DFAWorkerArg    *arg = data;
+    DFARound        *round = arg->round;
+    DFAWorker       *w = &round->workers[arg->worker];
+    u32             chunk;
+
+    while ((chunk = __atomic_fetch_add(&round->next_chunk, 1, __ATOMIC_RELAXED)) < round->chunk_count) {
+        u32 first = round->first + chunk * DFA_PARALLEL_CHUNK;
+        u32 end = GET_MIN(first + DFA_PARALLEL_CHUNK, round->end);
+
+        round->chunks[chunk].worker = arg->worker;
+        round->chunks[chunk].first_pending = w->pending_count;
+        for (u32 id = first; id < end; id++) worker_expand(w, id);
+        round->chunks[chunk].end_pending = w->pending_count;
+    }
+    return (NULL);
+}
+
+/**
+ * @brief Create the deferred sets in chunk order
+ * @return FALSE if the DFA went past its memory budget
+ *
+ * Chunks hold consecutive states and a worker defers in (state, class)
+ * order, so the states are created in the order of the sequential
+ * construction and get the same ids: the result does not depend on the
+ * scheduling. A set deferred twice in the round is found the second time.
+ */
+static s8 round_merge(DFARound *round, Bitmap *lookup) {
+    for (u32 i = 0; i < round->chunk_count; i++) {
+        DFAChunk    *chunk = &round->chunks[i];
+        DFAWorker   *w = &round->workers[chunk->worker];
+
+        for (u32 p = chunk->first_pending; p < chunk->end_pending; p++) {
+            PendingSet  *pending = &w->pending[p];
+            u32         *members = &w->pool[pending->offset];
+
+            for (u32 m = 0; m < pending->count; m++) bitmap_set(lookup, members[m]);
+            int id = find_dfa_state(lookup, pending->hash);
+            if (id == -1) id = create_dfa_state(lookup, pending->hash);
+            for (u32 m = 0; m < pending->count; m++) lookup->bits[members[m] / U64_BITS_NB] = 0;
+
+            if (id == (int)DFA_DEAD) return (FALSE);
+            /* The row is read again, creating a state may move the rows */
+            dfa_row(pending->state)[pending->class] = id;
+        }
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Subset construction of g_dfa with worker threads
+ * @param first First state whose row is not computed yet
+ * @param threads Number of threads
+ * @return FALSE if the DFA went past its memory budget
+ *
+ * g_dfa must hold the states from first, as dfa_expand gets them. States
+ * waiting to be expanded are processed in rounds: the workers claim
+ * chunks of states, compute their moves and look the successors up in
+ * the DFA, which is read only meanwhile. Successors not found are kept
+ * aside and created by a sequential merge at the end of the round, the
+ * new states form the next round. The merge keeps the state ids of the
+ * sequential construction, the DFA is the same with any thread count.
+ */
+s8 dfa_expand_parallel(u32 first, u32 threads) {
+    DFAWorker       *workers = calloc(threads, sizeof(DFAWorker));
+    DFAWorkerArg    *args = malloc(threads * sizeof(DFAWorkerArg));
+    pthread_t       *tids = malloc(threads * sizeof(pthread_t));
+    DFARound        round = {0};
+    Bitmap          lookup;
+    s8              complete = TRUE;
+
+    if (!workers || !args || !tids) {
+        ERR("Memory allocation failed for parallel DFA construction\n");
+        exit(1);
+    }
+    for (u32 t = 0; t < threads; t++) {
+        sparse_set_init(&workers[t].from, g_nfa.state_count);
+        sparse_set_init(&workers[t].next, g_nfa.state_count);
+        bitmap_init(&workers[t].lookup, g_nfa.closure_words);
+        args[t] = (DFAWorkerArg){&round, t};
+    }
+    bitmap_init(&lookup, g_nfa.closure_words);
+    round.workers = workers;
+    round.chunks = malloc((DFA_PARALLEL_BATCH / DFA_PARALLEL_CHUNK) * sizeof(DFAChunk));
+    if (!round.chunks) {
+        ERR("Memory allocation failed for parallel DFA construction\n");
+        exit(1);
+    }
+
+    for (; complete && first < g_dfa.state_count; first = round.end) {
+        round.first = first;
+        round.end = GET_MIN(g_dfa.state_count, first + DFA_PARALLEL_BATCH);
+        round.chunk_count = (round.end - first + DFA_PARALLEL_CHUNK - 1) / DFA_PARALLEL_CHUNK;
+        round.next_chunk = 0;
+        for (u32 t = 0; t < threads; t++) {
+            workers[t].pending_count = 0;
+            workers[t].pool_count = 0;
+        }
+
+        u32 spawned = 0;
+        if (round.end - first >= DFA_PARALLEL_MIN_BATCH) {
+            for (; spawned + 1 < threads; spawned++) {
+                if (pthread_create(&tids[spawned], NULL, worker_run, &args[spawned + 1]) != 0) {
+                    DBG("pthread_create failed, %u worker threads\n", spawned);
+                    break;
+                }
+            }
+        }
+        worker_run(&args[0]);
+        for (u32 t = 0; t < spawned; t++) pthread_join(tids[t], NULL);
+
+        complete = round_merge(&round, &lookup);
+    }
+
+    for (u32 t = 0; t < threads; t++) {
+        sparse_set_free(&workers[t].from);
+        sparse_set_free(&workers[t].next);
+        free(workers[t].lookup.bits);
+        free(workers[t].pending);
+        free(workers[t].pool);
+    }
+    free(lookup.bits);
+    free(round.chunks);
+    free(workers);
+    free(args);
+    free(tids);
+    return (complete);
+}
@@ -0,0 +1,1059 @@
+#include "../../include/nfa.h"
+#include "../../include/dfa.h"
+#include "../../include/log.h"
+#include <sys/mman.h>
+
+/* Most recent templates a row is compared with, as the protos of flex */
+#define TABLES_MAX_PROTOS 32
+
+/* Fewest non dead entries of a row that starts a new template */
+#define TABLES_TEMPLATE_MIN_LIVE 4
+
+/* A template is close to a row when they differ on at most 1 / ratio of its entries */
+#define TABLES_CLOSE_RATIO 4
+
+/* Bases tried from the first free slot before a row goes to the end of the comb */
+#define TABLES_MAX_PROBES 256
+
+/* Initial number of comb slots */
+#define TABLES_COMB_CAPACITY 1024
+
+DFATables *__get_tables(void) {
+    static DFATables tables = {0};
+    return (&tables);
+}
+
+/**
+ * @brief Row of a state or a template to place in the comb
+ *
+ * Entries are (index, next state) pairs, index in ascending order: an
+ * equivalence class for a state, a meta class for a template.
+ */
+typedef struct {
+    u32     id;
+    u32     offset;         /* First entry in the entry pool */
+    u32     count;
+} CombRow;
+
+static void *tables_alloc(size_t size) {
+    void *ptr = malloc(GET_MAX(size, 1));
+
+    if (!ptr) {
+        ERR("Memory allocation failed for DFA tables\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+static void *tables_realloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, GET_MAX(size, 1));
+    if (!ptr) {
+        ERR("Memory allocation failed for DFA tables\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+/**
+ * @brief Compute equivalence classes for compression
+ * @param merged Receives the equivalence class of every DFA class
+ * @param first Receives a DFA class of every equivalence class
+ * @return Number of equivalence classes
+ *
+ * Works in the class space of the DFA: the bytes of a DFA class already
+ * share every transition, only whole columns are compared. Two classes
+ * the NFA labels told apart can still have the same column (ex: both
+ * only lead to the dead state), they are merged here.
+ */
+static u32 compute_equiv_classes(DFA *dfa, u32 *merged, u32 *first) {
+    u32 next_class = 0;
+
+    for (u32 k = 0; k < dfa->class_count; k++) {
+        merged[k] = DFA_DEAD;
+
+        /* Find an equivalence class whose column is the same as k */
+        for (u32 e = 0; e < next_class && merged[k] == DFA_DEAD; e++) {
+            s8 same = TRUE;
+            for (u32 s = 0; s < dfa->state_count; s++) {
+                u32 *row = &dfa->trans[(size_t)s * dfa->class_count];
+                if (row[k] != row[first[e]]) {
+                    same = FALSE;
+                    break;
+                }
+            }
+            if (same) merged[k] = e;
+        }
+        if (merged[k] == DFA_DEAD) {
+            first[next_class] = k;
+            merged[k] = next_class++;
+        }
+    }
+    return (next_class);
+}
+
+/**
+ * @brief Entries where two rows of ec_count next states differ
+ */
+static u32 row_diff(u32 *a, u32 *b, u32 ec_count) {
+    u32 diff = 0;
+
+    for (u32 e = 0; e < ec_count; e++) diff += (a[e] != b[e]);
+    return (diff);
+}
+
+/**
+ * @brief Pick the default of every state among recent templates
+ * @param proto_of Receives the template state of every template, by template
+ * @return Number of templates
+ *
+ * As flex does with its protos: a row is compared with the most recently
+ * used templates, the closest one becomes its default when it is close
+ * (TABLES_CLOSE_RATIO). A row close to none starts a new template when it
+ * has enough entries to share, its own state then stores nothing. Smaller
+ * rows still take the closest template when they store fewer entries
+ * than alone, otherwise they have no default.
+ */
+static u32 choose_defaults(u32 *proto_of) {
+    u32 n = g_tables.state_count;
+    u32 ec_count = g_tables.ec_count;
+    u32 mru[TABLES_MAX_PROTOS];     /* Template numbers, most recent first */
+    u32 mru_count = 0;
+    u32 template_count = 0;
+
+    for (u32 s = 0; s < n; s++) {
+        u32 *row = &g_tables.dense[(size_t)s * ec_count];
+        u32 live = 0;
+        u32 best = 0;
+        u32 best_diff = DFA_DEAD;
+
+        for (u32 e = 0; e < ec_count; e++) live += (row[e] != DFA_DEAD);
+        for (u32 i = 0; i < mru_count; i++) {
+            u32 diff = row_diff(row, &g_tables.dense[(size_t)proto_of[mru[i]] * ec_count], ec_count);
+            if (diff < best_diff) {
+                best_diff = diff;
+                best = i;
+            }
+        }
+
+        s8 close = (mru_count > 0 && (u64)best_diff * TABLES_CLOSE_RATIO <= live);
+        if (close || (live < TABLES_TEMPLATE_MIN_LIVE && best_diff < live)) {
+            u32 t = mru[best];
+            memmove(&mru[1], &mru[0], best * sizeof(u32));
+            mru[0] = t;
+            g_tables.yy_def[s] = n + t;
+        } else if (live >= TABLES_TEMPLATE_MIN_LIVE) {
+            u32 t = template_count++;
+            proto_of[t] = s;
+            mru_count = GET_MIN(mru_count + 1, TABLES_MAX_PROTOS);
+            memmove(&mru[1], &mru[0], (mru_count - 1) * sizeof(u32));
+            mru[0] = t;
+            g_tables.yy_def[s] = n + t;
+        } else {
+            g_tables.yy_def[s] = DFA_DEAD;
+        }
+    }
+    return (template_count);
+}
+
+/**
+ * @brief Group the equivalence classes by their column in the templates
+ * @param proto_of Template state of every template
+ * @return Number of meta classes
+ *
+ * Templates are only reached through a default, an equivalence class
+ * there only selects a column of the templates: classes with the same
+ * column in every template share a meta class.
+ */
+static u32 compute_meta_classes(u32 *proto_of) {
+    u32 ec_count = g_tables.ec_count;
+    u64 col_hash[ALPHABET_SIZE] = {0};
+    u32 meta_rep[ALPHABET_SIZE];    /* An equivalence class of every meta class */
+    u32 meta_count = 0;
+
+    for (u32 t = 0; t < g_tables.template_count; t++) {
+        u32 *row = &g_tables.dense[(size_t)proto_of[t] * ec_count];
+        for (u32 e = 0; e < ec_count; e++) col_hash[e] = (col_hash[e] ^ row[e]) * 0x100000001b3ULL;
+    }
+
+    for (u32 e = 0; e < ec_count; e++) {
+        g_tables.yy_meta[e] = (u8)meta_count;
+        for (u32 m = 0; m < meta_count; m++) {
+            u32 r = meta_rep[m];
+            if (col_hash[r] != col_hash[e]) continue;
+
+            u32 t = 0;
+            while (t < g_tables.template_count) {
+                u32 *row = &g_tables.dense[(size_t)proto_of[t] * ec_count];
+                if (row[r] != row[e]) break;
+                t++;
+            }
+            if (t == g_tables.template_count) {
+                g_tables.yy_meta[e] = (u8)m;
+                break;
+            }
+        }
+        if (g_tables.yy_meta[e] == meta_count) meta_rep[meta_count++] = e;
+    }
+    return (meta_count);
+}
+
+/**
+ * @brief Grow the comb to hold at least size slots, new slots are free
+ */
+static void comb_reserve(u32 *capacity, u32 size) {
+    u32 old = *capacity;
+
+    if (size <= old) return;
+    if (*capacity == 0) *capacity = TABLES_COMB_CAPACITY;
+    while (*capacity < size) *capacity *= 2;
+    g_tables.yy_nxt = realloc(g_tables.yy_nxt, (size_t)*capacity * sizeof(u32));
+    g_tables.yy_chk = realloc(g_tables.yy_chk, (size_t)*capacity * sizeof(u32));
+    if (!g_tables.yy_nxt || !g_tables.yy_chk) {
+        ERR("Memory allocation failed for DFA tables\n");
+        exit(1);
+    }
+    for (u32 i = old; i < *capacity; i++) {
+        g_tables.yy_nxt[i] = DFA_DEAD;
+        g_tables.yy_chk[i] = TABLES_FREE;
+    }
+}
+
+static int comb_row_cmp(const void *a, const void *b) {
+    const CombRow *x = a;
+    const CombRow *y = b;
+
+    if (x->count != y->count) return ((x->count < y->count) - (x->count > y->count));
+    return ((x->id > y->id) - (x->id < y->id));
+}
+
+/**
+ * @brief Free space of the comb while rows are placed
+ */
+typedef struct {
+    u32     capacity;       /* Slots allocated */
+    u32     low;            /* Every slot below is taken */
+    u32     top;            /* Every slot from here is free */
+} CombSpace;
+
+/**
+ * @brief Place a row at the lowest base where its entries land on free slots
+ * @param e Entries of the row, index and next state interleaved
+ * @return Base of the row
+ *
+ * The search gives up after TABLES_MAX_PROBES bases and goes on from the
+ * last taken slot, holes no row fits would make it quadratic. A row with
+ * no entry takes base 0: a slot is only read when yy_chk names the row,
+ * it always goes to its default.
+ */
+static u32 comb_place(CombSpace *space, u32 id, u32 *e, u32 count) {
+    u32 base = 0;
+
+    if (count == 0) return (0);
+    while (space->low < space->capacity && g_tables.yy_chk[space->low] != TABLES_FREE) space->low++;
+    base = (space->low > e[0]) ? space->low - e[0] : 0;
+    for (u32 probe = 0;; base++, probe++) {
+        if (probe == TABLES_MAX_PROBES && space->top > base + g_tables.ec_count) base = space->top - g_tables.ec_count;
+        comb_reserve(&space->capacity, base + e[(count - 1) * 2] + 1);
+        u32 i = 0;
+        while (i < count && g_tables.yy_chk[base + e[i * 2]] == TABLES_FREE) i++;
+        if (i == count) break;
+    }
+    for (u32 i = 0; i < count; i++) {
+        g_tables.yy_chk[base + e[i * 2]] = id;
+        g_tables.yy_nxt[base + e[i * 2]] = e[i * 2 + 1];
+    }
+    g_tables.comb_used += count;
+    space->top = GET_MAX(space->top, base + e[(count - 1) * 2] + 1);
+    return (base);
+}
+
+/**
+ * @brief Pack the rows in the comb, row displacement
+ * @param rows Rows of the states and the templates
+ * @param entries Entry pool of the rows, index and next state interleaved
+ *
+ * The fullest rows are placed first, each one by comb_place. The comb is
+ * padded so base + class stays inside for every row.
+ */
+static void comb_pack(CombRow *rows, u32 row_count, u32 *entries) {
+    CombSpace   space = {0};
+    u32         end = 0;
+
+    g_tables.yy_nxt = NULL;
+    g_tables.yy_chk = NULL;
+    g_tables.comb_used = 0;
+    comb_reserve(&space.capacity, TABLES_COMB_CAPACITY);
+
+    qsort(rows, row_count, sizeof(CombRow), comb_row_cmp);
+    for (u32 r = 0; r < row_count; r++) {
+        u32 base = comb_place(&space, rows[r].id, &entries[(size_t)rows[r].offset * 2], rows[r].count);
+        g_tables.yy_base[rows[r].id] = base;
+        end = GET_MAX(end, base + g_tables.ec_count);
+    }
+    comb_reserve(&space.capacity, end);
+    g_tables.comb_size = end;
+}
+
+/**
+ * @brief Comb of the dense rows: defaults, meta classes, row displacement
+ *
+ * Defaults are chosen among templates, meta classes computed over the
+ * templates, and every row keeps only the entries its default does not
+ * give. The dense rows are freed once packed.
+ */
+static void build_comb(void) {
+    u32 n = g_tables.state_count;
+    u32 ec_count = g_tables.ec_count;
+
+    /* Every state may start a template, n of them at most */
+    u32 *proto_of = tables_alloc((size_t)n * sizeof(u32));
+    g_tables.yy_def = tables_alloc((size_t)n * 2 * sizeof(u32));
+    g_tables.template_count = choose_defaults(proto_of);
+    g_tables.meta_count = compute_meta_classes(proto_of);
+
+    u32 total = n + g_tables.template_count;
+    u32 *entries = tables_alloc(((size_t)n + g_tables.template_count) * ec_count * 2 * sizeof(u32));
+    CombRow *rows = tables_alloc((size_t)total * sizeof(CombRow));
+    u32 entry_count = 0;
+
+    g_tables.yy_base = tables_alloc((size_t)total * sizeof(u32));
+    for (u32 s = 0; s < n; s++) {
+        u32 *row = &g_tables.dense[(size_t)s * ec_count];
+        u32 def = g_tables.yy_def[s];
+        u32 *base_row = (def == DFA_DEAD) ? NULL : &g_tables.dense[(size_t)proto_of[def - n] * ec_count];
+
+        rows[s] = (CombRow){s, entry_count, 0};
+        for (u32 e = 0; e < ec_count; e++) {
+            if (row[e] == (base_row ? base_row[e] : DFA_DEAD)) continue;
+            entries[(size_t)entry_count * 2] = e;
+            entries[(size_t)entry_count * 2 + 1] = row[e];
+            entry_count++;
+            rows[s].count++;
+        }
+    }
+    for (u32 t = 0; t < g_tables.template_count; t++) {
+        u32 *row = &g_tables.dense[(size_t)proto_of[t] * ec_count];
+        u32 m = 0;
+
+        g_tables.yy_def[n + t] = DFA_DEAD;
+        rows[n + t] = (CombRow){n + t, entry_count, 0};
+        for (u32 e = 0; e < ec_count; e++) {
+            /* First equivalence class of each meta class, in meta order */
+            if (g_tables.yy_meta[e] != m) continue;
+            m++;
+            if (row[e] == DFA_DEAD) continue;
+            entries[(size_t)entry_count * 2] = g_tables.yy_meta[e];
+            entries[(size_t)entry_count * 2 + 1] = row[e];
+            entry_count++;
+            rows[n + t].count++;
+        }
+    }
+    comb_pack(rows, total, entries);
+    free(rows);
+    free(entries);
+    free(proto_of);
+    free(g_tables.dense);
+    g_tables.dense = NULL;
+}
+
+/**
+ * @brief Arena words of the row of a state, encoding chosen from its runs
+ * @param runs Receives the runs of equal next states over the classes
+ * @return TRUE for a range list
+ *
+ * A row becomes a range list when its classes form at most
+ * TABLES_MAX_RANGES runs and the list is smaller than the row: the
+ * states with few live transitions. Rows with many distinct targets stay
+ * dense, so do the states looping on themselves: identifier, number or
+ * blank loops are few but take most of the scanned bytes, they keep the
+ * single load of a dense row.
+ */
+static s8 row_encoding(u32 s, u32 *row, u32 *runs) {
+    u32 ec_count = g_tables.ec_count;
+    s8  loop = (row[0] == s);
+
+    *runs = 1;
+    for (u32 e = 1; e < ec_count; e++) {
+        *runs += (row[e] != row[e - 1]);
+        loop |= (row[e] == s);
+    }
+    return (!loop && *runs <= TABLES_MAX_RANGES && 2 + *runs < ec_count);
+}
+
+/**
+ * @brief Encode the dense rows of the states from first in the arena
+ * @param first First state to encode, the dense rows start with its row
+ *
+ * Offsets first, then the rows: next states are stored as the yy_row of
+ * the target, a transition leads straight to the next row. The rows go
+ * after the ones already in the arena. The dense rows are freed once
+ * encoded.
+ */
+static void build_ranges(u32 first) {
+    u32 n = g_tables.state_count;
+    u32 ec_count = g_tables.ec_count;
+    u32 off = g_tables.arena_size;
+    u32 runs;
+
+    g_tables.yy_row = tables_realloc(g_tables.yy_row, (size_t)n * sizeof(u32));
+    for (u32 s = first; s < n; s++) {
+        if (row_encoding(s, &g_tables.dense[(size_t)(s - first) * ec_count], &runs)) {
+            g_tables.yy_row[s] = (off << 1) | TABLES_ROW_RANGES;
+            off += 3 + runs;
+            g_tables.range_rows++;
+        } else {
+            g_tables.yy_row[s] = off << 1;
+            off += 1 + ec_count;
+        }
+    }
+    g_tables.arena_size = off;
+    g_tables.arena = tables_realloc(g_tables.arena, (size_t)off * sizeof(u32));
+
+    for (u32 s = first; s < n; s++) {
+        u32 *row = &g_tables.dense[(size_t)(s - first) * ec_count];
+        u32 *p = &g_tables.arena[g_tables.yy_row[s] >> 1];
+
+        p[0] = g_tables.yy_accept[s];
+        if (g_tables.yy_row[s] & TABLES_ROW_RANGES) {
+            u8  *last = (u8 *)&p[1];
+            u32 r = 0;
+
+            memset(last, 0xff, 2 * sizeof(u32));
+            for (u32 e = 0; e < ec_count; e++) {
+                if (e + 1 < ec_count && row[e + 1] == row[e]) continue;
+                last[r] = (u8)e;
+                p[3 + r++] = (row[e] == DFA_DEAD) ? DFA_DEAD : g_tables.yy_row[row[e]];
+            }
+        } else {
+            for (u32 e = 0; e < ec_count; e++) {
+                p[1 + e] = (row[e] == DFA_DEAD) ? DFA_DEAD : g_tables.yy_row[row[e]];
+            }
+        }
+    }
+    free(g_tables.dense);
+    g_tables.dense = NULL;
+}
+
+/**
+ * @brief Build the scanner tables of the DFA
+ * @param dfa DFA to encode
+ * @param mode Layout of the tables, as the -C option of flex
+ *
+ * TABLES_FULL copies the class rows into rows of one entry per byte.
+ * Otherwise equivalence classes come first, each one copies the column
+ * of one of its DFA classes into the dense rows, which TABLES_COMB then
+ * packs in the comb and TABLES_RANGES encodes row by row.
+ */
+void dfa_tables_build(DFA *dfa, TablesMode mode) {
+    u32 merged[ALPHABET_SIZE];
+    u32 first[ALPHABET_SIZE];
+    u32 n = dfa->state_count;
+
+    dfa_tables_free();
+    g_tables.mode = mode;
+    g_tables.state_count = n;
+    g_tables.start = dfa->start_id;
+    g_tables.yy_accept = tables_alloc((size_t)n * sizeof(u32));
+    for (u32 s = 0; s < n; s++) {
+        g_tables.yy_accept[s] = dfa->states[s].is_final;     /* Rule accepted, 0 if none */
+    }
+
+    if (mode == TABLES_FULL) {
+        g_tables.full = tables_alloc((size_t)n * ALPHABET_SIZE * sizeof(u32));
+        for (u32 s = 0; s < n; s++) {
+            u32 *row = &dfa->trans[(size_t)s * dfa->class_count];
+            for (u32 c = 0; c < ALPHABET_SIZE; c++) {
+                g_tables.full[(size_t)s * ALPHABET_SIZE + c] = row[dfa->byte_class[c]];
+            }
+        }
+        return;
+    }
+
+    u32 ec_count = compute_equiv_classes(dfa, merged, first);
+    for (int c = 0; c < ALPHABET_SIZE; c++) g_tables.yy_ec[c] = (u8)merged[dfa->byte_class[c]];
+    g_tables.ec_count = ec_count;
+    g_tables.dense = tables_alloc((size_t)n * ec_count * sizeof(u32));
+    for (u32 s = 0; s < n; s++) {
+        u32 *row = &dfa->trans[(size_t)s * dfa->class_count];
+        for (u32 e = 0; e < ec_count; e++) g_tables.dense[(size_t)s * ec_count + e] = row[first[e]];
+    }
+    if (mode == TABLES_COMB) build_comb();
+    if (mode == TABLES_RANGES) build_ranges(0);
+}
+
+/**
+ * @brief Row of the target of a DFA transition, DFA_DEAD if none
+ */
+FT_INLINE u32 tables_target(DFA *dfa, u32 t) {
+    return ((t == DFA_DEAD) ? DFA_DEAD : dfa->row[t]);
+}
+
+/**
+ * @brief Split the equivalence classes the classes of an appended DFA cut
+ * @param rows Next rows of the new states, one per DFA class
+ * @param count Number of new states
+ * @param parent Receives the previous class of every class added
+ * @param first Receives a DFA class of every equivalence class
+ *
+ * The new labels only split DFA classes, a DFA class lies in one
+ * previous equivalence class. There, DFA classes with the same column in
+ * the new rows share a class: the previous rows agree on them. The first
+ * one keeps the previous number, the others are numbered from ec_count
+ * and take the meta class of their parent.
+ */
+static void split_classes(DFA *dfa, u32 *rows, u32 count, u8 *parent, u32 *first) {
+    u32 k_count = dfa->class_count;
+    u32 old_count = g_tables.ec_count;
+    u32 class_ec[ALPHABET_SIZE];
+    u8  used[ALPHABET_SIZE] = {0};
+
+    for (u32 k = 0; k < k_count; k++) {
+        u32 old = g_tables.yy_ec[dfa->class_rep[k]];
+
+        class_ec[k] = DFA_DEAD;
+        for (u32 e = 0; e < g_tables.ec_count && class_ec[k] == DFA_DEAD; e++) {
+            if ((e < old_count) ? (e != old || !used[e]) : parent[e] != old) continue;
+            u32 i = 0;
+            while (i < count && rows[(size_t)i * k_count + k] == rows[(size_t)i * k_count + first[e]]) i++;
+            if (i == count) class_ec[k] = e;
+        }
+        if (class_ec[k] != DFA_DEAD) continue;
+        if (!used[old]) {
+            used[old] = TRUE;
+            class_ec[k] = old;
+        } else {
+            class_ec[k] = g_tables.ec_count++;
+            parent[class_ec[k]] = (u8)old;
+            g_tables.yy_meta[class_ec[k]] = g_tables.yy_meta[old];
+        }
+        first[class_ec[k]] = k;
+    }
+    for (u32 c = 0; c < ALPHABET_SIZE; c++) g_tables.yy_ec[c] = (u8)class_ec[dfa->byte_class[c]];
+}
+
+/**
+ * @brief Add the new rows to the dense rows
+ * @param n Number of previous rows
+ * @param old_ec Equivalence classes before split_classes
+ * @param added Dense rows of the new states, freed
+ * @return Previous rows laid out again
+ */
+static u32 extend_dense(u32 n, u32 old_ec, const u8 *parent, u32 *added) {
+    u32 ec_count = g_tables.ec_count;
+    u32 total = g_tables.state_count;
+    u32 rewritten = 0;
+
+    if (ec_count == old_ec) {
+        g_tables.dense = tables_realloc(g_tables.dense, (size_t)total * ec_count * sizeof(u32));
+    } else {
+        /* Split classes copy the column of their parent */
+        u32 *dense = tables_alloc((size_t)total * ec_count * sizeof(u32));
+        for (u32 s = 0; s < n; s++) {
+            u32 *row = &g_tables.dense[(size_t)s * old_ec];
+            for (u32 e = 0; e < ec_count; e++) dense[(size_t)s * ec_count + e] = row[(e < old_ec) ? e : parent[e]];
+        }
+        free(g_tables.dense);
+        g_tables.dense = dense;
+        rewritten = n;
+    }
+    memcpy(&g_tables.dense[(size_t)n * ec_count], added, (size_t)(total - n) * ec_count * sizeof(u32));
+    free(added);
+    return (rewritten);
+}
+
+/**
+ * @brief Add the new rows to the comb
+ * @param n Number of previous rows
+ * @param old_ec Equivalence classes before split_classes
+ * @param added Dense rows of the new states, freed
+ * @return Previous rows placed again
+ *
+ * The templates move past the new states, their numbers in yy_def and
+ * yy_chk shift. No template is created, the meta classes would change: a
+ * new row takes the closest of the most recent templates as its default
+ * when it then stores fewer entries. A previous row holding a class that
+ * was split needs the new columns next to it, it is lifted off the comb
+ * and placed again. The other rows read the new columns in their
+ * template, through the meta class of the parent.
+ */
+static u32 extend_comb(u32 n, u32 old_ec, const u8 *parent, u32 *added) {
+    u32         total = g_tables.state_count;
+    u32         count = total - n;
+    u32         templates = g_tables.template_count;
+    u32         ec_count = g_tables.ec_count;
+    u32         proto_count = GET_MIN(templates, TABLES_MAX_PROTOS);
+    u32         mru[TABLES_MAX_PROTOS];     /* Recent templates, most recent first */
+    CombSpace   space = {g_tables.comb_size, 0, 0};
+
+    g_tables.yy_base = tables_realloc(g_tables.yy_base, ((size_t)total + templates) * sizeof(u32));
+    g_tables.yy_def = tables_realloc(g_tables.yy_def, ((size_t)total + templates) * sizeof(u32));
+    memmove(&g_tables.yy_base[total], &g_tables.yy_base[n], templates * sizeof(u32));
+    memmove(&g_tables.yy_def[total], &g_tables.yy_def[n], templates * sizeof(u32));
+    for (u32 s = 0; s < n; s++) {
+        if (g_tables.yy_def[s] != DFA_DEAD) g_tables.yy_def[s] += count;
+    }
+    for (u32 i = 0; i < g_tables.comb_size; i++) {
+        if (g_tables.yy_chk[i] == TABLES_FREE) continue;
+        if (g_tables.yy_chk[i] >= n) g_tables.yy_chk[i] += count;
+        space.top = i + 1;
+    }
+
+    /* Dense rows of the recent templates, in equivalence classes */
+    u32 *protos = tables_alloc((size_t)proto_count * ec_count * sizeof(u32));
+    for (u32 i = 0; i < proto_count; i++) {
+        u32 id = total + templates - 1 - i;
+        mru[i] = i;
+        for (u32 e = 0; e < ec_count; e++) {
+            u32 slot = g_tables.yy_base[id] + g_tables.yy_meta[e];
+            protos[(size_t)i * ec_count + e] = (g_tables.yy_chk[slot] == id) ? g_tables.yy_nxt[slot] : DFA_DEAD;
+        }
+    }
+
+    /* Previous rows owning the column of a split class */
+    u8 *moved = calloc(GET_MAX(n, 1), sizeof(u8));
+    u32 moved_count = 0;
+    if (!moved) {
+        ERR("Memory allocation failed for DFA tables\n");
+        exit(1);
+    }
+    for (u32 s = 0; s < n; s++) {
+        for (u32 e = old_ec; e < ec_count && !moved[s]; e++) {
+            moved[s] = (g_tables.yy_chk[g_tables.yy_base[s] + parent[e]] == s);
+        }
+        moved_count += moved[s];
+    }
+
+    CombRow *rows = tables_alloc(((size_t)count + moved_count) * sizeof(CombRow));
+    u32 *entries = tables_alloc(((size_t)count + moved_count) * ec_count * 2 * sizeof(u32));
+    u32 row_count = 0;
+    u32 entry_count = 0;
+
+    for (u32 i = 0; i < count; i++) {
+        u32 *row = &added[(size_t)i * ec_count];
+        u32 *base_row = NULL;
+        u32 live = 0;
+        u32 best = 0;
+        u32 best_diff = DFA_DEAD;
+
+        for (u32 e = 0; e < ec_count; e++) live += (row[e] != DFA_DEAD);
+        for (u32 j = 0; j < proto_count; j++) {
+            u32 diff = row_diff(row, &protos[(size_t)mru[j] * ec_count], ec_count);
+            if (diff < best_diff) {
+                best_diff = diff;
+                best = j;
+            }
+        }
+        g_tables.yy_def[n + i] = DFA_DEAD;
+        if (proto_count > 0 && best_diff < live) {
+            u32 t = mru[best];
+            memmove(&mru[1], &mru[0], best * sizeof(u32));
+            mru[0] = t;
+            base_row = &protos[(size_t)t * ec_count];
+            g_tables.yy_def[n + i] = total + templates - 1 - t;
+        }
+
+        rows[row_count] = (CombRow){n + i, entry_count, 0};
+        for (u32 e = 0; e < ec_count; e++) {
+            if (row[e] == (base_row ? base_row[e] : DFA_DEAD)) continue;
+            entries[(size_t)entry_count * 2] = e;
+            entries[(size_t)entry_count * 2 + 1] = row[e];
+            entry_count++;
+            rows[row_count].count++;
+        }
+        row_count++;
+    }
+    for (u32 s = 0; s < n; s++) {
+        if (!moved[s]) continue;
+        u32 base = g_tables.yy_base[s];
+
+        rows[row_count] = (CombRow){s, entry_count, 0};
+        for (u32 e = 0; e < ec_count; e++) {
+            u32 slot = base + ((e < old_ec) ? e : parent[e]);
+            if (g_tables.yy_chk[slot] != s) continue;
+            entries[(size_t)entry_count * 2] = e;
+            entries[(size_t)entry_count * 2 + 1] = g_tables.yy_nxt[slot];
+            entry_count++;
+            rows[row_count].count++;
+        }
+        for (u32 e = 0; e < old_ec; e++) {
+            if (g_tables.yy_chk[base + e] != s) continue;
+            g_tables.yy_chk[base + e] = TABLES_FREE;
+            g_tables.yy_nxt[base + e] = DFA_DEAD;
+            g_tables.comb_used--;
+        }
+        row_count++;
+    }
+
+    qsort(rows, row_count, sizeof(CombRow), comb_row_cmp);
+    for (u32 r = 0; r < row_count; r++) {
+        g_tables.yy_base[rows[r].id] = comb_place(&space, rows[r].id, &entries[(size_t)rows[r].offset * 2], rows[r].count);
+    }
+
+    /* Every row reads its new columns inside the comb */
+    u32 end = g_tables.comb_size;
+    for (u32 r = 0; r < total + templates; r++) end = GET_MAX(end, g_tables.yy_base[r] + ec_count);
+    comb_reserve(&space.capacity, end);
+    g_tables.comb_size = end;
+
+    free(rows);
+    free(entries);
+    free(moved);
+    free(protos);
+    free(added);
+    return (moved_count);
+}
+
+/**
+ * @brief Add the new rows to the arena
+ * @param n Number of previous rows
+ * @param old_ec Equivalence classes before split_classes
+ * @param added Dense rows of the new states, freed
+ * @return Previous rows encoded again
+ *
+ * The new rows are encoded after the previous ones. When classes were
+ * split every row changes, the arena is decoded and encoded again.
+ */
+static u32 extend_ranges(u32 n, u32 old_ec, const u8 *parent, u32 *added) {
+    u32 ec_count = g_tables.ec_count;
+    u32 total = g_tables.state_count;
+
+    if (ec_count == old_ec) {
+        g_tables.dense = added;
+        build_ranges(n);
+        return (0);
+    }
+
+    /* Next states are yy_row values, back to state ids through their offset */
+    u32 *state_at = tables_alloc((size_t)g_tables.arena_size * sizeof(u32));
+    u32 *dense = tables_alloc((size_t)total * ec_count * sizeof(u32));
+    u32 row[ALPHABET_SIZE];
+
+    for (u32 s = 0; s < n; s++) state_at[g_tables.yy_row[s] >> 1] = s;
+    for (u32 s = 0; s < n; s++) {
+        u32 *p = &g_tables.arena[g_tables.yy_row[s] >> 1];
+
+        if (g_tables.yy_row[s] & TABLES_ROW_RANGES) {
+            u8  *last = (u8 *)&p[1];
+            u32 r = 0;
+
+            for (u32 e = 0; e < old_ec; e++) {
+                if (e > last[r]) r++;
+                row[e] = p[3 + r];
+            }
+        } else {
+            memcpy(row, &p[1], old_ec * sizeof(u32));
+        }
+        for (u32 e = 0; e < ec_count; e++) {
+            u32 next = row[(e < old_ec) ? e : parent[e]];
+            dense[(size_t)s * ec_count + e] = (next == DFA_DEAD) ? DFA_DEAD : state_at[next >> 1];
+        }
+    }
+    memcpy(&dense[(size_t)n * ec_count], added, (size_t)(total - n) * ec_count * sizeof(u32));
+    free(added);
+    free(state_at);
+    free(g_tables.arena);
+    g_tables.arena = NULL;
+    g_tables.arena_size = 0;
+    g_tables.range_rows = 0;
+    g_tables.dense = dense;
+    build_ranges(0);
+    return (n);
+}
+
+/**
+ * @brief Add the rows of the states dfa_append created to the tables
+ * @param dfa DFA the tables were built from, then appended to
+ * @param stats Receives the row and class counts
+ *
+ * dfa->row gives the row of every previous state, DFA_NO_ROW for the new
+ * ones: they take the rows from state_count, in state order. Previous
+ * rows keep their next states, a row of the minimized tables stands for
+ * every state it merged. Only the new rows are built, and the previous
+ * rows holding a class the new labels split. The new states are not
+ * minimized, one equivalent to a previous row keeps a row of its own.
+ */
+void dfa_tables_extend(DFA *dfa, DFAExtendStats *stats) {
+    u32 n = g_tables.state_count;
+    u32 k_count = dfa->class_count;
+    u32 old_ec = g_tables.ec_count;
+    u32 count = 0;
+
+    for (u32 s = 0; s < dfa->state_count; s++) count += (dfa->row[s] == DFA_NO_ROW);
+    u32 *states = tables_alloc((size_t)count * sizeof(u32));
+    count = 0;
+    for (u32 s = 0; s < dfa->state_count; s++) {
+        if (dfa->row[s] != DFA_NO_ROW) continue;
+        dfa->row[s] = n + count;
+        states[count++] = s;
+    }
+
+    /* Next rows of the new states, by DFA class */
+    u32 *rows = tables_alloc((size_t)count * k_count * sizeof(u32));
+    g_tables.yy_accept = tables_realloc(g_tables.yy_accept, ((size_t)n + count) * sizeof(u32));
+    for (u32 i = 0; i < count; i++) {
+        u32 *row = &dfa->trans[(size_t)states[i] * k_count];
+        for (u32 k = 0; k < k_count; k++) rows[(size_t)i * k_count + k] = tables_target(dfa, row[k]);
+        g_tables.yy_accept[n + i] = dfa->states[states[i]].is_final;
+    }
+    g_tables.state_count = n + count;
+    g_tables.start = tables_target(dfa, dfa->start_id);
+    *stats = (DFAExtendStats){n, count, 0, old_ec, old_ec};
+
+    if (g_tables.mode == TABLES_FULL) {
+        g_tables.full = tables_realloc(g_tables.full, ((size_t)n + count) * ALPHABET_SIZE * sizeof(u32));
+        for (u32 i = 0; i < count; i++) {
+            for (u32 c = 0; c < ALPHABET_SIZE; c++) {
+                g_tables.full[((size_t)n + i) * ALPHABET_SIZE + c] = rows[(size_t)i * k_count + dfa->byte_class[c]];
+            }
+        }
+        free(rows);
+        free(states);
+        return;
+    }
+
+    u8  parent[ALPHABET_SIZE] = {0};
+    u32 first[ALPHABET_SIZE] = {0};
+    split_classes(dfa, rows, count, parent, first);
+
+    u32 ec_count = g_tables.ec_count;
+    u32 *added = tables_alloc((size_t)count * ec_count * sizeof(u32));
+    for (u32 i = 0; i < count; i++) {
+        for (u32 e = 0; e < ec_count; e++) added[(size_t)i * ec_count + e] = rows[(size_t)i * k_count + first[e]];
+    }
+    free(rows);
+    free(states);
+
+    stats->classes_after = ec_count;
+    if (g_tables.mode == TABLES_EC) stats->rows_rewritten = extend_dense(n, old_ec, parent, added);
+    else if (g_tables.mode == TABLES_COMB) stats->rows_rewritten = extend_comb(n, old_ec, parent, added);
+    else stats->rows_rewritten = extend_ranges(n, old_ec, parent, added);
+}
+
+void dfa_tables_free(void) {
+    if (g_tables.map) {
+        /* Loaded tables point into the mapping */
+        munmap(g_tables.map, g_tables.map_size);
+        g_tables = (DFATables){0};
+        return;
+    }
+    free(g_tables.yy_accept);
+    free(g_tables.yy_base);
+    free(g_tables.yy_def);
+    free(g_tables.yy_nxt);
+    free(g_tables.yy_chk);
+    free(g_tables.dense);
+    free(g_tables.full);
+    free(g_tables.yy_row);
+    free(g_tables.arena);
+    g_tables = (DFATables){0};
+}
+
+/**
+ * @brief Name of a mode after -C, as flex spells it
+ */
+const char *dfa_tables_mode_name(TablesMode mode) {
+    static const char *names[TABLES_MODE_COUNT] = {"f", "e", "em", "r"};
+
+    return (names[mode]);
+}
+
+/**
+ * @brief Mode named by the argument of -C
+ * @return TRUE if the name is one of dfa_tables_mode_name
+ */
+s8 dfa_tables_mode_parse(const char *name, TablesMode *mode) {
+    for (u32 m = 0; m < TABLES_MODE_COUNT; m++) {
+        if (strcmp(name, dfa_tables_mode_name(m)) == 0) {
+            *mode = m;
+            return (TRUE);
+        }
+    }
+    return (FALSE);
+}
+
+/**
+ * @brief Bytes of the tables of the current mode, yy_accept included
+ *
+ * Full: one next state per byte. Dense: one per equivalence class, and
+ * yy_ec. Comb: base and def of every row, nxt and chk of every slot,
+ * yy_ec and yy_meta. Ranges: the arena, which holds the rules, yy_row
+ * and yy_ec.
+ */
+size_t dfa_tables_bytes(void) {
+    size_t n = g_tables.state_count;
+    size_t rows = n + g_tables.template_count;
+
+    switch (g_tables.mode) {
+        case TABLES_FULL:
+            return (n * (ALPHABET_SIZE + 1) * sizeof(u32));
+        case TABLES_EC:
+            return (n * (g_tables.ec_count + 1) * sizeof(u32) + ALPHABET_SIZE);
+        case TABLES_RANGES:
+            return ((n + g_tables.arena_size) * sizeof(u32) + ALPHABET_SIZE);
+        default:
+            return ((n + 2 * rows + 2 * (size_t)g_tables.comb_size) * sizeof(u32) + 2 * ALPHABET_SIZE);
+    }
+}
+
+/**
+ * @brief Longest match at input with the full tables
+ * @return Longest match and its rule (yy_accept), rule NFA_NO_RULE if none
+ *
+ * Longest match first, then the rule of the last accepting state: the
+ * DFA already resolved the earliest rule of every state. The byte is the
+ * column, one load per transition.
+ */
+static LexMatch match_full(char *input) {
+    u32         state = g_tables.start;
+    char        *ptr = input;
+    LexMatch    match = {g_tables.yy_accept[state], 0};
+
+    while (*ptr) {
+        u32 next = g_tables.full[(size_t)state * ALPHABET_SIZE + (u8)*ptr];
+        if (next == DFA_DEAD) break;
+        state = next;
+        ptr++;
+        if (g_tables.yy_accept[state]) match = (LexMatch){g_tables.yy_accept[state], ptr - input};
+    }
+    return (match);
+}
+
+/**
+ * @brief Longest match at input with the dense tables, column yy_ec[byte]
+ */
+static LexMatch match_dense(char *input) {
+    u32         state = g_tables.start;
+    char        *ptr = input;
+    LexMatch    match = {g_tables.yy_accept[state], 0};
+
+    while (*ptr) {
+        u32 next = g_tables.dense[(size_t)state * g_tables.ec_count + g_tables.yy_ec[(u8)*ptr]];
+        if (next == DFA_DEAD) break;
+        state = next;
+        ptr++;
+        if (g_tables.yy_accept[state]) match = (LexMatch){g_tables.yy_accept[state], ptr - input};
+    }
+    return (match);
+}
+
+/**
+ * @brief Longest match at input with the comb tables, see dfa_tables_next
+ */
+static LexMatch match_comb(char *input) {
+    u32         state = g_tables.start;
+    char        *ptr = input;
+    LexMatch    match = {g_tables.yy_accept[state], 0};
+
+    while (*ptr) {
+        u32 next = dfa_tables_next(state, g_tables.yy_ec[(u8)*ptr]);
+        if (next == DFA_DEAD) break;
+        state = next;
+        ptr++;
+        if (g_tables.yy_accept[state]) match = (LexMatch){g_tables.yy_accept[state], ptr - input};
+    }
+    return (match);
+}
+
+/**
+ * @brief Next row on class c from an arena row
+ * @param row yy_row of the state
+ * @return yy_row of the next state, DFA_DEAD if none
+ *
+ * A range list is searched without branches: the run of c is the count
+ * of bounds below c. The TABLES_MAX_RANGES bounds are compared at once as
+ * the bytes of a u64, padding bytes are 255 and never below.
+ */
+FT_INLINE u32 tables_row_next(u32 row, u32 c) {
+    u32 *p = &g_tables.arena[row >> 1];
+
+    if (row & TABLES_ROW_RANGES) {
+        u64 high = 0x8080808080808080ULL;
+        u64 ones = 0x0101010101010101ULL;
+        u64 cs = c * ones;
+        u64 last;
+
+        memcpy(&last, &p[1], sizeof(u64));
+        /* Per byte: top bit of diff set when the low 7 bits of last >= those of c */
+        u64 diff = (last | high) - (cs & ~high);
+        u64 below = ((~last & cs) | (~(last ^ cs) & ~diff)) & high;
+        return (p[3 + (((below >> 7) * ones) >> 56)]);
+    }
+    return (p[1 + c]);
+}
+
+/**
+ * @brief Longest match at input with the arena rows, dispatching per state
+ *
+ * The scan walks rows, not state ids: the rule of a state is the first
+ * word of its row.
+ */
+static LexMatch match_ranges(char *input) {
+    u32         row = g_tables.yy_row[g_tables.start];
+    char        *ptr = input;
+    LexMatch    match = {g_tables.arena[row >> 1], 0};
+
+    while (*ptr) {
+        u32 next = tables_row_next(row, g_tables.yy_ec[(u8)*ptr]);
+        if (next == DFA_DEAD) break;
+        row = next;
+        ptr++;
+        if (g_tables.arena[row >> 1]) match = (LexMatch){g_tables.arena[row >> 1], ptr - input};
+    }
+    return (match);
+}
+
+typedef LexMatch (*TablesMatcher)(char *input);
+
+/**
+ * @brief Matcher of the current mode, chosen once per scan
+ */
+static TablesMatcher tables_matcher(void) {
+    switch (g_tables.mode) {
+        case TABLES_FULL:
+            return (match_full);
+        case TABLES_EC:
+            return (match_dense);
+        case TABLES_RANGES:
+            return (match_ranges);
+        default:
+            return (match_comb);
+    }
+}
+
+/**
+ * @brief Scan the whole input once, printing every match with its rule
+ * @param rules Regex of every rule, rules[r - 1] for rule r
+ */
+void match_tables_anywhere(char **rules, char *input) {
+    TablesMatcher   match_tables = tables_matcher();
+    char            *p = input;
+
+    while (*p) {
+        LexMatch match = match_tables(p);
+        if (match.len == 0) { p++; continue; }
+        printf("TABLE✅Match Rule: %s ", rules[match.rule - 1]);
+        fwrite(p, 1, match.len, stdout);
+        printf("\n");
+        p += match.len;
+    }
+}
+
+/**
+ * @brief Count the matches match_tables_anywhere would print, without printing
+ */
+u32 match_tables_count(char *input) {
+    TablesMatcher   match_tables = tables_matcher();
+    char            *p = input;
+    u32             count = 0;
+
+    while (*p) {
+        LexMatch match = match_tables(p);
+        if (match.len > 0) {
+            count++;
+            p += match.len;
+        } else {
+            p++;
+        }
+    }
+    return (count);
+}
@@ -0,0 +1,752 @@
+#include "../../include/nfa.h"
+#include "../../include/dfa.h"
+#include "../../include/log.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* First bytes of a saved automaton */
+#define TABLES_MAGIC "FTLEXDFA"
+
+/* Bumped on any change of the layout below */
+#define TABLES_FORMAT_VERSION 2
+
+/* Written as a u32, reads back the same only with the same byte order */
+#define TABLES_BYTE_ORDER 0x01020304U
+
+/* Sections start on this boundary from the start of the file */
+#define TABLES_ALIGN 8
+
+/**
+ * @brief Arrays of a saved automaton, in file order
+ */
+typedef enum {
+    SECTION_EC,
+    SECTION_META,
+    SECTION_ACCEPT,
+    SECTION_BASE,
+    SECTION_DEF,
+    SECTION_NXT,
+    SECTION_CHK,
+    SECTION_DENSE,
+    SECTION_FULL,
+    SECTION_ROW,
+    SECTION_ARENA,
+    SECTION_RULE_OFF,       /* rule_count + 1 offsets into SECTION_RULE_TEXT */
+    SECTION_RULE_TEXT,      /* Regex of every rule, NUL terminated */
+    SECTION_NFA_STATES,     /* The NFA the DFA was built from, for dfa_append */
+    SECTION_NFA_EPS_OFF,
+    SECTION_NFA_EPS_TO,
+    SECTION_NFA_SYM_OFF,
+    SECTION_NFA_SYM,
+    SECTION_NFA_CLOSURE_OFF,
+    SECTION_NFA_CLOSURE,
+    SECTION_NFA_SETS,
+    SECTION_DFA_CLASS,      /* The subset construction before minimization */
+    SECTION_DFA_CLASS_REP,
+    SECTION_DFA_STATES,
+    SECTION_DFA_TRANS,
+    SECTION_DFA_SET_OFF,    /* dfa_state_count + 1 offsets into SECTION_DFA_SET */
+    SECTION_DFA_SET,        /* NFA states of every DFA state, listed */
+    SECTION_DFA_ROW,        /* Row of the tables of every DFA state */
+    SECTION_COUNT,
+} TablesSection;
+
+/**
+ * @brief Place of a section in the file, size 0 when the mode has none
+ */
+typedef struct {
+    u64     offset;
+    u64     size;
+} SectionRef;
+
+/**
+ * @brief Header of a saved automaton, at offset 0
+ *
+ * Only offsets from the start of the file, no pointer: the file is
+ * scanned where it is mapped. The NFA and DFA sections are only read to
+ * add rules (dfa_tables_load_automaton).
+ */
+typedef struct {
+    char        magic[8];
+    u32         version;
+    u32         byte_order;
+    u32         mode;
+    u32         state_count;
+    u32         template_count;
+    u32         ec_count;
+    u32         meta_count;
+    u32         start;
+    u32         comb_size;
+    u32         comb_used;
+    u32         arena_size;
+    u32         range_rows;
+    u32         rule_count;
+    u32         nfa_state_count;
+    u32         nfa_start;
+    u32         eps_count;
+    u32         sym_count;
+    u32         closure_size;
+    u32         byte_set_count;
+    u32         dfa_state_count;
+    u32         dfa_start;
+    u32         class_count;
+    u32         set_size;       /* Members of every NFA set of the DFA */
+    u32         pad;
+    u64         file_size;
+    SectionRef  sections[SECTION_COUNT];
+} TablesHeader;
+
+/**
+ * @brief Expected bytes of every section, from the counts of the header
+ */
+static void section_sizes(TablesHeader *h, u64 *size) {
+    u64 n = h->state_count;
+    u64 rows = n + h->template_count;
+    u8  comb = (h->mode == TABLES_COMB);
+
+    memset(size, 0, SECTION_COUNT * sizeof(u64));
+    size[SECTION_EC] = ALPHABET_SIZE;
+    size[SECTION_META] = ALPHABET_SIZE;
+    size[SECTION_ACCEPT] = n * sizeof(u32);
+    size[SECTION_BASE] = comb ? rows * sizeof(u32) : 0;
+    size[SECTION_DEF] = comb ? rows * sizeof(u32) : 0;
+    size[SECTION_NXT] = comb ? (u64)h->comb_size * sizeof(u32) : 0;
+    size[SECTION_CHK] = comb ? (u64)h->comb_size * sizeof(u32) : 0;
+    size[SECTION_DENSE] = (h->mode == TABLES_EC) ? n * h->ec_count * sizeof(u32) : 0;
+    size[SECTION_FULL] = (h->mode == TABLES_FULL) ? n * ALPHABET_SIZE * sizeof(u32) : 0;
+    size[SECTION_ROW] = (h->mode == TABLES_RANGES) ? n * sizeof(u32) : 0;
+    size[SECTION_ARENA] = (h->mode == TABLES_RANGES) ? (u64)h->arena_size * sizeof(u32) : 0;
+    size[SECTION_RULE_OFF] = ((u64)h->rule_count + 1) * sizeof(u32);
+
+    u64 nfa_n = h->nfa_state_count;
+    u64 dfa_n = h->dfa_state_count;
+    size[SECTION_NFA_STATES] = nfa_n * sizeof(NFAState);
+    size[SECTION_NFA_EPS_OFF] = (nfa_n + 1) * sizeof(u32);
+    size[SECTION_NFA_EPS_TO] = (u64)h->eps_count * sizeof(u32);
+    size[SECTION_NFA_SYM_OFF] = (nfa_n + 1) * sizeof(u32);
+    size[SECTION_NFA_SYM] = (u64)h->sym_count * sizeof(Transition);
+    size[SECTION_NFA_CLOSURE_OFF] = (nfa_n + 1) * sizeof(u32);
+    size[SECTION_NFA_CLOSURE] = (u64)h->closure_size * sizeof(u32);
+    size[SECTION_NFA_SETS] = (u64)h->byte_set_count * sizeof(ByteSet);
+    size[SECTION_DFA_CLASS] = ALPHABET_SIZE;
+    size[SECTION_DFA_CLASS_REP] = ALPHABET_SIZE;
+    size[SECTION_DFA_STATES] = dfa_n * sizeof(DFAState);
+    size[SECTION_DFA_TRANS] = dfa_n * h->class_count * sizeof(u32);
+    size[SECTION_DFA_SET_OFF] = (dfa_n + 1) * sizeof(u32);
+    size[SECTION_DFA_SET] = (u64)h->set_size * sizeof(u32);
+    size[SECTION_DFA_ROW] = dfa_n * sizeof(u32);
+}
+
+/**
+ * @brief Save the current tables, the rules and the automaton to a file
+ * @param path File to write
+ * @param rules Regex of every rule, rules[r - 1] for rule r
+ * @param rule_count Number of rules
+ * @param subset DFA the tables were built from, before minimization, and g_nfa its NFA
+ * @return TRUE on success, FALSE on write error
+ *
+ * The header, then every section at the next TABLES_ALIGN boundary, in
+ * the byte order of this machine. The NFA and the subset construction
+ * let -a add rules to the file; with no row map the rows are the states.
+ */
+s8 dfa_tables_save(const char *path, char **rules, u32 rule_count, DFA *subset) {
+    TablesHeader    h = {0};
+    u64             size[SECTION_COUNT];
+    const void      *data[SECTION_COUNT] = {0};
+    static const u8 zeros[TABLES_ALIGN] = {0};
+
+    memcpy(h.magic, TABLES_MAGIC, sizeof(h.magic));
+    h.version = TABLES_FORMAT_VERSION;
+    h.byte_order = TABLES_BYTE_ORDER;
+    h.mode = g_tables.mode;
+    h.state_count = g_tables.state_count;
+    h.template_count = g_tables.template_count;
+    h.ec_count = g_tables.ec_count;
+    h.meta_count = g_tables.meta_count;
+    h.start = g_tables.start;
+    h.comb_size = g_tables.comb_size;
+    h.comb_used = g_tables.comb_used;
+    h.arena_size = g_tables.arena_size;
+    h.range_rows = g_tables.range_rows;
+    h.rule_count = rule_count;
+    h.nfa_state_count = g_nfa.state_count;
+    h.nfa_start = g_nfa.start_id;
+    h.eps_count = g_nfa.eps_offsets[g_nfa.state_count];
+    h.sym_count = g_nfa.sym_offsets[g_nfa.state_count];
+    h.closure_size = g_nfa.closure_offsets[g_nfa.state_count];
+    h.byte_set_count = g_nfa.set_count;
+    h.dfa_state_count = subset->state_count;
+    h.dfa_start = subset->start_id;
+    h.class_count = subset->class_count;
+
+    /* The NFA sets as lists, the bitmaps are mostly empty words */
+    u32 *set_off = malloc(((size_t)subset->state_count + 1) * sizeof(u32));
+    u32 set_capacity = GET_MAX(subset->state_count * 4, 64);
+    u32 *set_list = malloc(set_capacity * sizeof(u32));
+    if (!set_off || !set_list) {
+        ERR("Memory allocation failed for saving the DFA tables\n");
+        exit(1);
+    }
+    set_off[0] = 0;
+    for (u32 s = 0; s < subset->state_count; s++) {
+        Bitmap set = {&subset->set_pool[(size_t)s * subset->set_words], subset->set_words};
+        set_off[s + 1] = set_off[s];
+        for (u32 i = bitmap_next_set(&set, 0); i != BITMAP_NONE; i = bitmap_next_set(&set, i + 1)) {
+            if (set_off[s + 1] == set_capacity) {
+                set_capacity *= 2;
+                set_list = realloc(set_list, set_capacity * sizeof(u32));
+                if (!set_list) {
+                    ERR("Memory allocation failed for saving the DFA tables\n");
+                    exit(1);
+                }
+            }
+            set_list[set_off[s + 1]++] = i;
+        }
+    }
+    h.set_size = set_off[subset->state_count];
+    section_sizes(&h, size);
+
+    /* Rule texts laid out one after the other, offsets into the blob */
+    u32 *rule_off = malloc(((size_t)rule_count + 1) * sizeof(u32));
+    if (!rule_off) {
+        ERR("Memory allocation failed for saving the DFA tables\n");
+        exit(1);
+    }
+    rule_off[0] = 0;
+    for (u32 r = 0; r < rule_count; r++) rule_off[r + 1] = rule_off[r] + strlen(rules[r]) + 1;
+    size[SECTION_RULE_TEXT] = rule_off[rule_count];
+
+    data[SECTION_EC] = g_tables.yy_ec;
+    data[SECTION_META] = g_tables.yy_meta;
+    data[SECTION_ACCEPT] = g_tables.yy_accept;
+    data[SECTION_BASE] = g_tables.yy_base;
+    data[SECTION_DEF] = g_tables.yy_def;
+    data[SECTION_NXT] = g_tables.yy_nxt;
+    data[SECTION_CHK] = g_tables.yy_chk;
+    data[SECTION_DENSE] = g_tables.dense;
+    data[SECTION_FULL] = g_tables.full;
+    data[SECTION_ROW] = g_tables.yy_row;
+    data[SECTION_ARENA] = g_tables.arena;
+    data[SECTION_RULE_OFF] = rule_off;
+    data[SECTION_NFA_STATES] = g_nfa.states;
+    data[SECTION_NFA_EPS_OFF] = g_nfa.eps_offsets;
+    data[SECTION_NFA_EPS_TO] = g_nfa.eps_to;
+    data[SECTION_NFA_SYM_OFF] = g_nfa.sym_offsets;
+    data[SECTION_NFA_SYM] = g_nfa.sym_trans;
+    data[SECTION_NFA_CLOSURE_OFF] = g_nfa.closure_offsets;
+    data[SECTION_NFA_CLOSURE] = g_nfa.closure_list;
+    data[SECTION_NFA_SETS] = g_nfa.sets;
+    data[SECTION_DFA_CLASS] = subset->byte_class;
+    data[SECTION_DFA_CLASS_REP] = subset->class_rep;
+    data[SECTION_DFA_STATES] = subset->states;
+    data[SECTION_DFA_TRANS] = subset->trans;
+    data[SECTION_DFA_SET_OFF] = set_off;
+    data[SECTION_DFA_SET] = set_list;
+    data[SECTION_DFA_ROW] = subset->row;
+
+    /* Tables built from the DFA itself, -M: row s is state s */
+    u32 *identity = NULL;
+    if (!subset->row) {
+        identity = malloc(GET_MAX((size_t)subset->state_count, 1) * sizeof(u32));
+        if (!identity) {
+            ERR("Memory allocation failed for saving the DFA tables\n");
+            exit(1);
+        }
+        for (u32 s = 0; s < subset->state_count; s++) identity[s] = s;
+        data[SECTION_DFA_ROW] = identity;
+    }
+
+    u64 offset = sizeof(TablesHeader);
+    for (u32 i = 0; i < SECTION_COUNT; i++) {
+        offset = (offset + TABLES_ALIGN - 1) & ~(u64)(TABLES_ALIGN - 1);
+        h.sections[i] = (SectionRef){offset, size[i]};
+        offset += size[i];
+    }
+    h.file_size = offset;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ERR("Cannot open %s\n", path);
+        free(rule_off);
+        free(identity);
+        free(set_off);
+        free(set_list);
+        return (FALSE);
+    }
+    s8 ok = (fwrite(&h, sizeof(h), 1, f) == 1);
+    offset = sizeof(TablesHeader);
+    for (u32 i = 0; ok && i < SECTION_COUNT; i++) {
+        ok = (fwrite(zeros, 1, h.sections[i].offset - offset, f) == h.sections[i].offset - offset);
+        if (i == SECTION_RULE_TEXT) {
+            for (u32 r = 0; ok && r < rule_count; r++) ok = (fwrite(rules[r], 1, strlen(rules[r]) + 1, f) > 0);
+        } else if (ok && size[i] > 0) {
+            ok = (fwrite(data[i], 1, size[i], f) == size[i]);
+        }
+        offset = h.sections[i].offset + size[i];
+    }
+    ok = (fclose(f) == 0) && ok;
+    free(rule_off);
+    free(identity);
+    free(set_off);
+    free(set_list);
+    if (!ok) ERR("Cannot write %s\n", path);
+    return (ok);
+}
+
+/**
+ * @brief Check the header of a mapped file against its size
+ * @return TRUE if every section of the mode is inside the file
+ *
+ * Only the layout, tables_valid() then checks what the sections hold.
+ */
+static s8 header_valid(TablesHeader *h, u64 file_size) {
+    u64 size[SECTION_COUNT];
+
+    if (file_size < sizeof(TablesHeader) || memcmp(h->magic, TABLES_MAGIC, sizeof(h->magic)) != 0) return (FALSE);
+    if (h->version != TABLES_FORMAT_VERSION || h->byte_order != TABLES_BYTE_ORDER) return (FALSE);
+    if (h->mode >= TABLES_MODE_COUNT || h->file_size != file_size) return (FALSE);
+    if (h->state_count == 0 || h->start >= h->state_count || h->rule_count == 0) return (FALSE);
+    /* Bounds the products of section_sizes */
+    if (h->ec_count > ALPHABET_SIZE || h->class_count > ALPHABET_SIZE) return (FALSE);
+
+    section_sizes(h, size);
+    for (u32 i = 0; i < SECTION_COUNT; i++) {
+        SectionRef *s = &h->sections[i];
+        if (i != SECTION_RULE_TEXT && s->size != size[i]) return (FALSE);
+        if (s->offset % TABLES_ALIGN || s->offset > file_size || s->size > file_size - s->offset) return (FALSE);
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Section i of a mapped file, as the words it holds
+ */
+static const u32 *section_words(TablesHeader *h, u32 i) {
+    return ((const u32 *)((const u8 *)h + h->sections[i].offset));
+}
+
+/**
+ * @brief Check a run of next states
+ * @return TRUE if each one is a state or DFA_DEAD
+ */
+static s8 targets_valid(const u32 *next, u64 count, u32 state_count) {
+    for (u64 i = 0; i < count; i++) {
+        if (next[i] != DFA_DEAD && next[i] >= state_count) return (FALSE);
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Check the rows of the comb
+ *
+ * Every row must read its classes inside the comb. A state defaults to a
+ * template and a template to no row, as dfa_tables_build lays them out:
+ * no default chain loops.
+ */
+static s8 comb_valid(TablesHeader *h) {
+    const u8    *meta = (const u8 *)h + h->sections[SECTION_META].offset;
+    const u32   *base = section_words(h, SECTION_BASE);
+    const u32   *def = section_words(h, SECTION_DEF);
+    u32         n = h->state_count;
+    u64         rows = (u64)n + h->template_count;
+
+    if (h->meta_count > h->ec_count) return (FALSE);
+    for (u32 e = 0; e < h->ec_count; e++) {
+        if (meta[e] >= h->meta_count) return (FALSE);
+    }
+    for (u64 r = 0; r < rows; r++) {
+        if ((u64)base[r] + h->ec_count > h->comb_size) return (FALSE);
+        if (def[r] != DFA_DEAD && (r >= n || def[r] < n || def[r] >= rows)) return (FALSE);
+    }
+    return (targets_valid(section_words(h, SECTION_NXT), h->comb_size, n));
+}
+
+/**
+ * @brief Runs of a range list row
+ * @param p Row in the arena, its bounds words inside the arena
+ * @return Number of runs, 0 if the bounds are not valid
+ *
+ * Bounds increase up to the last class, then 255: the run of any class
+ * is one of the row.
+ */
+static u32 range_runs(const u32 *p, u32 ec_count) {
+    u8  last[TABLES_MAX_RANGES];
+    u32 runs = 0;
+
+    memcpy(last, &p[1], sizeof(last));
+    while (runs < TABLES_MAX_RANGES && last[runs] < ec_count - 1 && (runs == 0 || last[runs] > last[runs - 1])) runs++;
+    if (runs == TABLES_MAX_RANGES || last[runs] != ec_count - 1) return (0);
+    for (u32 i = runs + 1; i < TABLES_MAX_RANGES; i++) {
+        if (last[i] != 0xff) return (0);
+    }
+    return (runs + 1);
+}
+
+/**
+ * @brief Check the arena rows
+ *
+ * Every row must end inside the arena. Next states are yy_row values:
+ * each must be the offset and the encoding of a row of a state.
+ */
+static s8 ranges_valid(TablesHeader *h) {
+    const u32   *yy_row = section_words(h, SECTION_ROW);
+    const u32   *arena = section_words(h, SECTION_ARENA);
+    u32         ec_count = h->ec_count;
+    u8          *row_at = calloc(GET_MAX(h->arena_size, 1), 1);     /* 1 + encoding of the row at each offset */
+    s8          ok = TRUE;
+
+    if (!row_at) {
+        ERR("Memory allocation failed for loading the DFA tables\n");
+        exit(1);
+    }
+    for (u32 s = 0; ok && s < h->state_count; s++) {
+        u64 off = yy_row[s] >> 1;
+        if (yy_row[s] & TABLES_ROW_RANGES) {
+            ok = (off + 3 <= h->arena_size);
+            u32 runs = ok ? range_runs(&arena[off], ec_count) : 0;
+            ok = (runs > 0 && off + 3 + runs <= h->arena_size);
+        } else {
+            ok = (off + 1 + ec_count <= h->arena_size);
+        }
+        if (ok) row_at[off] = 1 + (yy_row[s] & TABLES_ROW_RANGES);
+    }
+    for (u32 s = 0; ok && s < h->state_count; s++) {
+        const u32   *p = &arena[yy_row[s] >> 1];
+        s8          ranges = (yy_row[s] & TABLES_ROW_RANGES);
+        u32         count = ranges ? range_runs(p, ec_count) : ec_count;
+        const u32   *next = ranges ? &p[3] : &p[1];
+
+        ok = (p[0] <= h->rule_count);
+        for (u32 i = 0; ok && i < count; i++) {
+            ok = (next[i] == DFA_DEAD
+                  || ((next[i] >> 1) < h->arena_size && row_at[next[i] >> 1] == 1 + (next[i] & TABLES_ROW_RANGES)));
+        }
+    }
+    free(row_at);
+    return (ok);
+}
+
+/**
+ * @brief Check what the sections of a valid header hold
+ * @return TRUE if a scan stays inside the tables
+ *
+ * One pass over every array, before the tables point into the mapping:
+ * classes below their count, rules up to rule_count, next states and
+ * defaults naming rows of the tables. A corrupt file is rejected as a
+ * bad header would be.
+ */
+static s8 tables_valid(TablesHeader *h) {
+    const u8    *ec = (const u8 *)h + h->sections[SECTION_EC].offset;
+    const u32   *accept = section_words(h, SECTION_ACCEPT);
+    u32         n = h->state_count;
+
+    if (h->mode != TABLES_FULL) {
+        if (h->ec_count == 0 || h->ec_count > ALPHABET_SIZE) return (FALSE);
+        for (u32 c = 0; c < ALPHABET_SIZE; c++) {
+            if (ec[c] >= h->ec_count) return (FALSE);
+        }
+    }
+    for (u32 s = 0; s < n; s++) {
+        if (accept[s] > h->rule_count) return (FALSE);
+    }
+    switch (h->mode) {
+        case TABLES_FULL:
+            return (targets_valid(section_words(h, SECTION_FULL), (u64)n * ALPHABET_SIZE, n));
+        case TABLES_EC:
+            return (targets_valid(section_words(h, SECTION_DENSE), (u64)n * h->ec_count, n));
+        case TABLES_COMB:
+            return (comb_valid(h));
+        default:
+            return (ranges_valid(h));
+    }
+}
+
+/**
+ * @brief Check the offsets of a CSR array
+ * @return TRUE if they go from 0 to size without decreasing
+ */
+static s8 offsets_valid(const u32 *off, u32 count, u32 size) {
+    if (off[0] != 0 || off[count] != size) return (FALSE);
+    for (u32 i = 0; i < count; i++) {
+        if (off[i] > off[i + 1]) return (FALSE);
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Check the NFA and the subset construction of a valid header
+ * @return TRUE if dfa_append stays inside them
+ *
+ * Only what a bad value would read past: state ids, labels, CSR offsets,
+ * set members past the NFA and rows past the tables. A set that is not the
+ * closure of its members only makes dfa_append miss a state and build it
+ * again.
+ */
+static s8 automaton_valid(TablesHeader *h) {
+    const NFAState      *nfa_states = (const NFAState *)section_words(h, SECTION_NFA_STATES);
+    const Transition    *sym = (const Transition *)section_words(h, SECTION_NFA_SYM);
+    const DFAState      *dfa_states = (const DFAState *)section_words(h, SECTION_DFA_STATES);
+    const u8            *byte_class = (const u8 *)section_words(h, SECTION_DFA_CLASS);
+    const u32           *row = section_words(h, SECTION_DFA_ROW);
+    u32                 nfa_n = h->nfa_state_count;
+    u32                 dfa_n = h->dfa_state_count;
+
+    if (nfa_n == 0 || h->nfa_start >= nfa_n || dfa_n == 0 || h->dfa_start >= dfa_n || h->class_count == 0) return (FALSE);
+    for (u32 i = 0; i < nfa_n; i++) {
+        if (nfa_states[i].id != i || nfa_states[i].is_final > h->rule_count) return (FALSE);
+    }
+    if (!offsets_valid(section_words(h, SECTION_NFA_EPS_OFF), nfa_n, h->eps_count)
+        || !offsets_valid(section_words(h, SECTION_NFA_SYM_OFF), nfa_n, h->sym_count)
+        || !offsets_valid(section_words(h, SECTION_NFA_CLOSURE_OFF), nfa_n, h->closure_size)
+        || !targets_valid(section_words(h, SECTION_NFA_EPS_TO), h->eps_count, nfa_n)
+        || !targets_valid(section_words(h, SECTION_NFA_CLOSURE), h->closure_size, nfa_n)) return (FALSE);
+    for (u32 j = 0; j < h->sym_count; j++) {
+        if (sym[j].label == NFA_EPSILON || (u32)sym[j].to_id >= nfa_n) return (FALSE);
+        if (sym[j].label >= NFA_LABEL_SET_BASE && sym[j].label - NFA_LABEL_SET_BASE >= h->byte_set_count) return (FALSE);
+    }
+
+    for (u32 c = 0; c < ALPHABET_SIZE; c++) {
+        if (byte_class[c] >= h->class_count) return (FALSE);
+    }
+    for (u32 s = 0; s < dfa_n; s++) {
+        if (dfa_states[s].id != s || dfa_states[s].is_final > h->rule_count) return (FALSE);
+        if (row[s] != DFA_DEAD && row[s] >= h->state_count) return (FALSE);
+    }
+    return (offsets_valid(section_words(h, SECTION_DFA_SET_OFF), dfa_n, h->set_size)
+            && targets_valid(section_words(h, SECTION_DFA_SET), h->set_size, nfa_n)
+            && targets_valid(section_words(h, SECTION_DFA_TRANS), (u64)dfa_n * h->class_count, dfa_n));
+}
+
+/**
+ * @brief Check the rule texts of a valid header
+ * @return TRUE if every rule ends inside its section
+ */
+static s8 rules_valid(TablesHeader *h) {
+    const u32   *rule_off = section_words(h, SECTION_RULE_OFF);
+    const char  *text = (const char *)h + h->sections[SECTION_RULE_TEXT].offset;
+    u64         text_size = h->sections[SECTION_RULE_TEXT].size;
+
+    for (u32 r = 0; r < h->rule_count; r++) {
+        if (rule_off[r + 1] <= rule_off[r] || rule_off[r + 1] > text_size || text[rule_off[r + 1] - 1] != '\0') return (FALSE);
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Map a saved automaton, its header and tables checked
+ * @param size Receives the size of the mapping
+ * @return Header at the start of the mapping, NULL if missing or not valid
+ */
+static TablesHeader *tables_map(const char *path, size_t *size) {
+    struct stat st;
+    int         fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        ERR("Cannot open %s\n", path);
+        return (NULL);
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TablesHeader)) {
+        ERR("%s is not a saved automaton\n", path);
+        close(fd);
+        return (NULL);
+    }
+    u8 *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERR("Cannot map %s\n", path);
+        return (NULL);
+    }
+
+    TablesHeader *h = (TablesHeader *)map;
+    if (!header_valid(h, st.st_size) || !tables_valid(h) || !rules_valid(h)) {
+        ERR("%s is not a saved automaton of this version\n", path);
+        munmap(map, st.st_size);
+        return (NULL);
+    }
+    *size = st.st_size;
+    return (h);
+}
+
+/**
+ * @brief Table arrays stored in each section, NULL for the other sections
+ */
+static void tables_arrays(u32 **arrays[SECTION_COUNT]) {
+    memset(arrays, 0, SECTION_COUNT * sizeof(u32 **));
+    arrays[SECTION_ACCEPT] = &g_tables.yy_accept;
+    arrays[SECTION_BASE] = &g_tables.yy_base;
+    arrays[SECTION_DEF] = &g_tables.yy_def;
+    arrays[SECTION_NXT] = &g_tables.yy_nxt;
+    arrays[SECTION_CHK] = &g_tables.yy_chk;
+    arrays[SECTION_DENSE] = &g_tables.dense;
+    arrays[SECTION_FULL] = &g_tables.full;
+    arrays[SECTION_ROW] = &g_tables.yy_row;
+    arrays[SECTION_ARENA] = &g_tables.arena;
+}
+
+/**
+ * @brief Point the tables at the sections of a mapped file
+ */
+static void tables_point(TablesHeader *h) {
+    u8 *map = (u8 *)h;
+
+    dfa_tables_free();
+    g_tables.mode = h->mode;
+    g_tables.state_count = h->state_count;
+    g_tables.template_count = h->template_count;
+    g_tables.ec_count = h->ec_count;
+    g_tables.meta_count = h->meta_count;
+    g_tables.start = h->start;
+    g_tables.comb_size = h->comb_size;
+    g_tables.comb_used = h->comb_used;
+    g_tables.arena_size = h->arena_size;
+    g_tables.range_rows = h->range_rows;
+    memcpy(g_tables.yy_ec, map + h->sections[SECTION_EC].offset, ALPHABET_SIZE);
+    memcpy(g_tables.yy_meta, map + h->sections[SECTION_META].offset, ALPHABET_SIZE);
+
+    /* Sections the mode does not use have size 0 and stay NULL */
+    u32 **arrays[SECTION_COUNT];
+    tables_arrays(arrays);
+    for (u32 i = 0; i < SECTION_COUNT; i++) {
+        if (arrays[i] && h->sections[i].size > 0) *arrays[i] = (u32 *)(map + h->sections[i].offset);
+    }
+}
+
+/**
+ * @brief Map a saved automaton and point the tables at it
+ * @param path File written by dfa_tables_save
+ * @param rules Receives the regex of every rule, pointing into the mapping
+ * @param rule_count Receives the number of rules
+ * @return TRUE on success, FALSE if the file is missing or not valid
+ *
+ * The file is mapped read only and shared: nothing is copied but the
+ * class maps, the pages are shared by every process scanning with the
+ * same file. dfa_tables_free() unmaps it, *rules is freed by the caller.
+ */
+s8 dfa_tables_load(const char *path, char ***rules, u32 *rule_count) {
+    size_t          size;
+    TablesHeader    *h = tables_map(path, &size);
+
+    if (!h) return (FALSE);
+
+    const u32 *rule_off = section_words(h, SECTION_RULE_OFF);
+    char *text = (char *)h + h->sections[SECTION_RULE_TEXT].offset;
+    *rules = malloc((size_t)h->rule_count * sizeof(char *));
+    if (!*rules) {
+        ERR("Memory allocation failed for loading the DFA tables\n");
+        exit(1);
+    }
+    for (u32 r = 0; r < h->rule_count; r++) (*rules)[r] = &text[rule_off[r]];
+    *rule_count = h->rule_count;
+
+    tables_point(h);
+    g_tables.map = (u8 *)h;
+    g_tables.map_size = size;
+    return (TRUE);
+}
+
+/**
+ * @brief Copy of section i of a mapped file
+ */
+static void *section_copy(TablesHeader *h, u32 i) {
+    void *copy = malloc(GET_MAX(h->sections[i].size, 1));
+
+    if (!copy) {
+        ERR("Memory allocation failed for loading the DFA tables\n");
+        exit(1);
+    }
+    memcpy(copy, (u8 *)h + h->sections[i].offset, h->sections[i].size);
+    return (copy);
+}
+
+/**
+ * @brief Load a saved automaton to add rules to it
+ * @param path File written by dfa_tables_save
+ * @param rules Receives the regex of every rule, freed with *rules
+ * @param rule_count Receives the number of rules
+ * @return TRUE on success, FALSE if the file is missing or not valid
+ *
+ * Unlike dfa_tables_load every array is copied, to be grown: the tables
+ * to g_tables, the NFA to g_nfa frozen with its closures, as nfa_thaw
+ * expects, and the subset construction to g_dfa with its row map, as
+ * dfa_append then dfa_tables_extend expect. The NFA and DFA sections are
+ * checked first.
+ */
+s8 dfa_tables_load_automaton(const char *path, char ***rules, u32 *rule_count) {
+    size_t          size;
+    TablesHeader    *h = tables_map(path, &size);
+
+    if (!h) return (FALSE);
+    if (!automaton_valid(h)) {
+        ERR("%s is not a saved automaton of this version\n", path);
+        munmap(h, size);
+        return (FALSE);
+    }
+
+    /* Pointers and texts in one block */
+    const u32 *rule_off = section_words(h, SECTION_RULE_OFF);
+    u64 text_size = h->sections[SECTION_RULE_TEXT].size;
+    *rules = malloc((size_t)h->rule_count * sizeof(char *) + text_size);
+    if (!*rules) {
+        ERR("Memory allocation failed for loading the DFA tables\n");
+        exit(1);
+    }
+    char *text = (char *)&(*rules)[h->rule_count];
+    memcpy(text, (u8 *)h + h->sections[SECTION_RULE_TEXT].offset, text_size);
+    for (u32 r = 0; r < h->rule_count; r++) (*rules)[r] = &text[rule_off[r]];
+    *rule_count = h->rule_count;
+
+    u32 **arrays[SECTION_COUNT];
+    tables_point(h);
+    tables_arrays(arrays);
+    for (u32 i = 0; i < SECTION_COUNT; i++) {
+        if (arrays[i] && *arrays[i]) *arrays[i] = section_copy(h, i);
+    }
+
+    nfa_free();
+    g_nfa.state_count = h->nfa_state_count;
+    g_nfa.capacity = h->nfa_state_count;
+    g_nfa.start_id = h->nfa_start;
+    g_nfa.edge_count = h->eps_count + h->sym_count;
+    g_nfa.states = section_copy(h, SECTION_NFA_STATES);
+    g_nfa.eps_offsets = section_copy(h, SECTION_NFA_EPS_OFF);
+    g_nfa.eps_to = section_copy(h, SECTION_NFA_EPS_TO);
+    g_nfa.sym_offsets = section_copy(h, SECTION_NFA_SYM_OFF);
+    g_nfa.sym_trans = section_copy(h, SECTION_NFA_SYM);
+    g_nfa.closure_words = GET_MAX((h->nfa_state_count + U64_BITS_NB - 1) / U64_BITS_NB, 1);
+    g_nfa.closure_offsets = section_copy(h, SECTION_NFA_CLOSURE_OFF);
+    g_nfa.closure_list = section_copy(h, SECTION_NFA_CLOSURE);
+    g_nfa.closure_count = h->nfa_state_count;
+    g_nfa.sets = section_copy(h, SECTION_NFA_SETS);
+    g_nfa.set_count = h->byte_set_count;
+    g_nfa.set_capacity = h->byte_set_count;
+
+    dfa_free();
+    g_dfa.state_count = h->dfa_state_count;
+    g_dfa.capacity = h->dfa_state_count;
+    g_dfa.start_id = h->dfa_start;
+    g_dfa.class_count = h->class_count;
+    g_dfa.set_words = g_nfa.closure_words;
+    memcpy(g_dfa.byte_class, (u8 *)h + h->sections[SECTION_DFA_CLASS].offset, ALPHABET_SIZE);
+    memcpy(g_dfa.class_rep, (u8 *)h + h->sections[SECTION_DFA_CLASS_REP].offset, ALPHABET_SIZE);
+    g_dfa.states = section_copy(h, SECTION_DFA_STATES);
+    g_dfa.trans = section_copy(h, SECTION_DFA_TRANS);
+    g_dfa.set_pool = calloc((size_t)g_dfa.capacity * g_dfa.set_words, sizeof(u64));
+    if (!g_dfa.set_pool) {
+        ERR("Memory allocation failed for loading the DFA tables\n");
+        exit(1);
+    }
+    const u32 *set_off = section_words(h, SECTION_DFA_SET_OFF);
+    const u32 *set_list = section_words(h, SECTION_DFA_SET);
+    for (u32 s = 0; s < g_dfa.state_count; s++) {
+        Bitmap set = dfa_state_set(s);
+        for (u32 j = set_off[s]; j < set_off[s + 1]; j++) bitmap_set(&set, set_list[j]);
+    }
+    g_dfa.row = section_copy(h, SECTION_DFA_ROW);
+    g_dfa.memory = (size_t)g_dfa.capacity * dfa_state_bytes();
+    dfa_index_rebuild();
+
+    munmap(h, size);
+    return (TRUE);
+}
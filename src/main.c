@@ -2,298 +2,776 @@
 #include "../include/bitmap.h"
 #include "../include/nfa.h"
 #include "../include/dfa.h"
+#include "../include/timer.h"
+#include <unistd.h>
+#include <getopt.h>
 
 
 /* ========================================================================== */
 /*                         SUBSET CONSTRUCTION                                */
 /* ========================================================================== */
 
-/**
- * @brief Compute the set of NFA states reachable on character c
- * @param from NFA state set
- * @param c Character to transition on
- * @param result Output: resulting NFA state set
- */
-static void move_on_char(Bitmap *from, unsigned char c, Bitmap *result) {
-    bitmap_clear(result);
-    
-    for (u32 i = 0; i < g_nfa.state_count; i++) {
-        if (!bitmap_is_set(from, i)) continue;
-        
-        NFAState *s = &g_nfa.states[i];
-        for (u32 j = 0; j < s->trans_count; j++) {
-            /* Match on character or wildcard */
-            if (s->trans[j].c == c || s->trans[j].c == NFA_DOT_CHAR) {
-                bitmap_set(result, s->trans[j].to_id);
-            }
-        }
-    }
-    
-    epsilon_closure(result);
-}
-
 /**
  * @brief Convert NFA to DFA using subset construction algorithm
+ * @return FALSE if the DFA went past its memory budget
  * 
- * This is the classic powerset construction algorithm.
+ * This is the classic powerset construction algorithm. The bytes are
+ * grouped in classes first (dfa_byte_classes), one move per class
+ * representative fills a whole row. Every state is then expanded by
+ * dfa_expand, in creation order.
  */
-void nfa_to_dfa(void) {
+s8 nfa_to_dfa(u32 threads) {
     INFO("Converting NFA to DFA...\n");
     
-    g_dfa.state_count = 0;
+    dfa_free();
+    g_dfa.class_count = dfa_byte_classes(g_dfa.byte_class, g_dfa.class_rep);
     
     /* Initialize with start state */
     Bitmap start_set;
-    bitmap_init(&start_set, BITMAP_STATE_ARRAY_SIZE);
+    bitmap_init(&start_set, g_nfa.closure_words);
     bitmap_set(&start_set, g_nfa.start_id);
     epsilon_closure(&start_set);
     
-    g_dfa.start_id = create_dfa_state(&start_set);
+    g_dfa.start_id = create_dfa_state(&start_set, dfa_set_fingerprint(&start_set));
     INFO("DFA start state: %d\n", g_dfa.start_id);
     
-    /* Work queue: states that need to be processed */
-    u32 work_queue[MAX_DFA_STATES];
-    u32 queue_size = 0;
-    work_queue[queue_size++] = g_dfa.start_id;
-    
-    Bitmap next_set;
-    bitmap_init(&next_set, BITMAP_STATE_ARRAY_SIZE);
-    
-    /* Process each state in the queue */
-    while (queue_size > 0) {
-        u32 current_id = work_queue[--queue_size];
-        DFAState *current = &g_dfa.states[current_id];
-        
-        DBG("Processing DFA state %d\n", current_id);
-        
-        /* For each possible character */
-        for (u32 c = 1; c < ALPHABET_SIZE; c++) {
-            move_on_char(&current->nfa_states, c, &next_set);
-            
-            /* Skip if no states reachable */
-            int has_states = 0;
-            for (u32 i = 0; i < BITMAP_STATE_ARRAY_SIZE; i++) {
-                if (next_set.bits[i]) {
-                    has_states = 1;
-                    break;
-                }
-            }
-            if (!has_states) continue;
-            
-            /* Find or create DFA state for this set */
-            int next_id = find_dfa_state(&next_set);
-            if (next_id == -1) {
-                next_id = create_dfa_state(&next_set);
-                work_queue[queue_size++] = next_id;
-                DBG("  Created new DFA state %d on char '%c' (0x%02x)\n", next_id, 
-                    (c >= 32 && c < 127) ? c : '?', c);
-            }
-            
-            current->transitions[c] = next_id;
-        }
-    }
-    
+    s8 complete = (g_dfa.start_id != DFA_DEAD) && dfa_expand(0, threads);
     free(start_set.bits);
-    free(next_set.bits);
     
-    INFO("DFA construction complete: %d states (from %d NFA states)\n", 
-         g_dfa.state_count, g_nfa.state_count);
+    INFO("DFA construction %s: %d states, %u byte classes (from %d NFA states)\n", 
+         complete ? "complete" : "aborted", g_dfa.state_count, g_dfa.class_count, g_nfa.state_count);
+    return (complete);
 }
 
 
-/* ========================================================================== */
-/*                   Compressed DFA Tables (like Flex does)                   */
-/* ========================================================================== */
+/**
+ * @brief Measure the scan throughput of a matcher on the input
+ * @param count_matches Matcher counting the matches of the whole input
+ * @param input Input string
+ * @param matches Receives the match count
+ * @return Throughput in MB/s
+ *
+ * The input is scanned again until 20 ms are spent, short inputs still
+ * give a stable figure.
+ */
+static double scan_throughput(u32 (*count_matches)(char *), char *input, u32 *matches) {
+    u64 len = strlen(input);
+    u64 start = get_time_ns();
+    u64 elapsed = 0;
+    u64 rounds = 0;
+
+    if (len == 0) return (0.0);
+    do {
+        *matches = count_matches(input);
+        rounds++;
+        elapsed = get_time_ns() - start;
+    } while (elapsed < 20000000ULL);
+    return ((double)(len * rounds) / ((double)elapsed / 1e9) / 1e6);
+}
 
 /**
- * @brief Character equivalence classes
- * 
- * Flex groups characters that always have the same transitions together.
- * Example: For regex "ab", all chars except 'a' and 'b' are equivalent.
+ * @brief Command line options of the tester
  */
 typedef struct {
-    unsigned char ec[256];  /* ec[c] = equivalence class of character c */
-    int num_classes;        /* Total number of equivalence classes */
-} EquivClasses;
+    char    **rules;    /* Regex of every rule, earliest first (highest priority) */
+    u32     rule_count;
+    char    *input;     /* String to scan */
+    char    *file;      /* -f: read the rules from this file instead of argv */
+    char    *file_data; /* Contents of the -f file, the rules point into it */
+    s8      stats;      /* -s: print the compilation report */
+    s8      glushkov;   /* -g: Glushkov construction instead of Thompson */
+    s8      raw_nfa;    /* -R: skip the NFA reduction pass */
+    s8      bitpar;     /* -b: scan with the bit-parallel engine, no DFA */
+    u32     budget_mb;  /* -m: DFA memory budget in MB, 0 for the default */
+    s8      raw_dfa;    /* -M: skip the DFA minimization */
+    s8      lazy;       /* -l: scan with the lazy DFA, no full DFA */
+    u32     threads;    /* -j: threads of the subset construction, 0 for one */
+    TablesMode tables;  /* -C: layout of the scanner tables */
+    char    *save;      /* --save: write the tables to this file, no scan */
+    char    *load;      /* --load: scan with the tables of this file, no rule but the -a ones */
+    char    *append;    /* -a: rules added to the DFA of the others or of --load, see dfa_append */
+    char    *append_data; /* Contents of the -a file, the -a rules point into it */
+    u32     base_count; /* Rules compiled before the -a ones, rule_count without -a */
+} LexOptions;
+
+/**
+ * @brief Read the rules of a file, one regex per line, after opt->rules
+ * @param opt Receives the rules
+ * @param path File to read
+ * @param data Receives the contents of the file, the rules point into it
+ * @return TRUE on success, FALSE on error or when there is no rule
+ *
+ * Empty lines are skipped. Lets patterns go past the kernel limit on a
+ * single argv string (128 KB).
+ */
+static s8 read_rules_file(LexOptions *opt, const char *path, char **data) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        ERR("Cannot open %s\n", path);
+        return (FALSE);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
+    u32 count = opt->rule_count;
+    char *buff = malloc(size + 1);
+    char **rules = realloc(opt->rules, (count + size / 2 + 1) * sizeof(char *));
+    if (rules) opt->rules = rules;
+    if (!buff || !rules) {
+        ERR("Memory allocation failed\n");
+        free(buff);
+        fclose(f);
+        return (FALSE);
+    }
+    size_t read_size = fread(buff, 1, size, f);
+    buff[read_size] = '\0';
+    fclose(f);
+    *data = buff;
 
-unsigned char yy_ec[256] = {};
-int *yy_accept = NULL;
-int *yy_nxt = NULL;
-int ec_num_classes = 0;
+    /* A rule takes at least one byte and its newline, size / 2 + 1 rules at most */
+    for (char *line = buff; line; ) {
+        char *newline = strchr(line, '\n');
+        if (newline) *newline = '\0';
+        if (*line) opt->rules[opt->rule_count++] = line;
+        line = newline ? newline + 1 : NULL;
+    }
+    return (opt->rule_count > count);
+}
+
+static void options_free(LexOptions *opt) {
+    free(opt->rules);
+    free(opt->file_data);
+    free(opt->append_data);
+}
 
 /**
- * @brief Compute equivalence classes for compression
+ * @brief Add the rules of the -a file after the others
+ * @return TRUE on success, FALSE on error or when it has no rule
  */
-static EquivClasses compute_equiv_classes(DFA *dfa) {
-    EquivClasses ec;
-    
-    /* Initially, each char is its own class */
-    for (int i = 0; i < 256; i++) {
-        ec.ec[i] = i;
+static s8 append_rules(LexOptions *opt) {
+    opt->base_count = opt->rule_count;
+    if (!opt->append) return (TRUE);
+    return (read_rules_file(opt, opt->append, &opt->append_data));
+}
+
+/**
+ * @brief Parse the command line
+ * @return TRUE on success, FALSE on usage error
+ *
+ * Every operand but the last one is a rule, the last one is the input.
+ * With --save every operand is a rule, with --load the only operand is
+ * the input, none if the -a rules are saved again. The -a rules come
+ * after the others, at a lower priority.
+ */
+static s8 parse_options(int argc, char **argv, LexOptions *opt) {
+    static const struct option long_options[] = {
+        {"save", required_argument, NULL, 'S'},
+        {"load", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0},
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "v:sgRbMlm:j:C:f:a:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'v':
+                if (!parse_log_verbosity(NULL, optarg)) return (FALSE);
+                break;
+            case 's':
+                opt->stats = TRUE;
+                break;
+            case 'g':
+                opt->glushkov = TRUE;
+                break;
+            case 'R':
+                opt->raw_nfa = TRUE;
+                break;
+            case 'b':
+                opt->bitpar = TRUE;
+                break;
+            case 'M':
+                opt->raw_dfa = TRUE;
+                break;
+            case 'l':
+                opt->lazy = TRUE;
+                break;
+            case 'm':
+                opt->budget_mb = (u32)atoi(optarg);
+                if (opt->budget_mb == 0) return (FALSE);
+                break;
+            case 'j':
+                opt->threads = (u32)atoi(optarg);
+                if (opt->threads == 0) return (FALSE);
+                break;
+            case 'C':
+                if (!dfa_tables_mode_parse(optarg, &opt->tables)) return (FALSE);
+                break;
+            case 'f':
+                opt->file = optarg;
+                break;
+            case 'a':
+                opt->append = optarg;
+                break;
+            case 'S':
+                opt->save = optarg;
+                break;
+            case 'L':
+                opt->load = optarg;
+                break;
+            default:
+                return (FALSE);
+        }
     }
-    
-    /* Group characters with identical transition patterns */
-    int next_class = 0;
-    int assigned[256] = {0};
-    
-    for (int c1 = 0; c1 < 256; c1++) {
-        if (assigned[c1]) continue;
-        
-        ec.ec[c1] = next_class;
-        assigned[c1] = 1;
-        
-        /* Find all chars with same transition pattern as c1 */
-        for (int c2 = c1 + 1; c2 < 256; c2++) {
-            if (assigned[c2]) continue;
-            
-            int same = 1;
-            for (u32 s = 0; s < dfa->state_count; s++) {
-                if (dfa->states[s].transitions[c1] != dfa->states[s].transitions[c2]) {
-                    same = 0;
-                    break;
-                }
-            }
-            
-            if (same) {
-                ec.ec[c2] = next_class;
-                assigned[c2] = 1;
-            }
+    /* Saving and appending need the full DFA, the -l and -b scans have none */
+    if ((opt->save || opt->append) && (opt->lazy || opt->bitpar)) return (FALSE);
+    if (opt->load) {
+        if (opt->file || (opt->save && !opt->append) || argc - optind != (opt->save ? 0 : 1)) return (FALSE);
+        opt->input = opt->save ? "" : argv[optind];
+        return (append_rules(opt));
+    }
+
+    /* Nothing is scanned when saving, the input is left empty */
+    u32 inputs = opt->save ? 0 : 1;
+    if (opt->save) opt->input = "";
+    if (opt->file) {
+        if (argc - optind < (int)inputs) return (FALSE);
+        if (inputs) opt->input = argv[optind];
+        return (read_rules_file(opt, opt->file, &opt->file_data) && append_rules(opt));
+    }
+    if (argc - optind < (int)inputs + 1) return (FALSE);
+    opt->rule_count = argc - optind - inputs;
+    opt->rules = malloc(opt->rule_count * sizeof(char *));
+    if (!opt->rules) {
+        ERR("Memory allocation failed\n");
+        return (FALSE);
+    }
+    memcpy(opt->rules, &argv[optind], opt->rule_count * sizeof(char *));
+    if (inputs) opt->input = argv[argc - 1];
+    return (append_rules(opt));
+}
+
+/**
+ * @brief Parse, simplify and hash-cons the rules from first
+ * @param trees Receives the tree of every rule, trees[r] for opt->rules[r]
+ * @return FALSE if a rule does not parse
+ *
+ * Every rule goes through the front end, the hash-consing tables are
+ * shared. With -s the totals are printed.
+ */
+static s8 parse_rules(LexOptions *opt, RegexTreeNode **trees, u32 first) {
+    s8 verbose = *get_log_level() >= L_INFO;
+    u64 parse_time = 0;
+    u64 simplify_time = 0;
+    u64 hashcons_time = 0;
+    u32 nodes_before = 0;
+    u32 nodes_after = 0;
+    HashconsStats hc_total = {0};
+
+    for (u32 r = first; r < opt->rule_count; r++) {
+        String s = {
+            .str = opt->rules[r],
+            .pos = 0,
+            .len = strlen(opt->rules[r])
+        };
+
+        INFO("Parsing regex: '%s'\n", s.str);
+        INFO("=====================================\n");
+
+        u64 parse_start = get_time_ns();
+        RegexTreeNode *tree = parse_regex(&s);
+        parse_time += get_time_ns() - parse_start;
+
+        if (!tree) {
+            ERR("Failed to parse regex!\n");
+            return (FALSE);
         }
-        
-        next_class++;
+
+        INFO("Parsing completed successfully!\n");
+        INFO("Final position: %d/%d\n", s.pos, (int)strlen(s.str));
+        INFO("=====================================\n");
+
+        u32 before = regex_tree_count(tree);
+        u64 simplify_start = get_time_ns();
+        tree = regex_simplify(tree);
+        simplify_time += get_time_ns() - simplify_start;
+        u32 after = regex_tree_count(tree);
+
+        if (verbose) print_regex_tree(tree);
+        INFO("Simplified regex tree: %u -> %u nodes\n", before, after);
+        nodes_before += before;
+        nodes_after += after;
+
+        HashconsStats hc;
+        u64 hashcons_start = get_time_ns();
+        trees[r] = regex_hashcons(tree, &hc);
+        hashcons_time += get_time_ns() - hashcons_start;
+
+        INFO("Hash-consing: %u -> %u unique nodes, %u -> %u unique classes\n",
+             hc.nodes, hc.unique_nodes, hc.classes, hc.unique_classes);
+        hc_total.nodes += hc.nodes;
+        hc_total.classes += hc.classes;
+        hc_total.unique_nodes = hc.unique_nodes;
+        hc_total.unique_classes = hc.unique_classes;
     }
-    
-    ec.num_classes = next_class;
-    return ec;
+
+    if (opt->stats) {
+        printf("Parse: %.3f ms, %u rules, %u arena allocations, %zu bytes\n", NS_TO_MS(parse_time),
+               opt->rule_count - first, g_regex_arena.alloc_count, g_regex_arena.allocated);
+        printf("Simplify: %.3f ms, %u -> %u nodes\n", NS_TO_MS(simplify_time), nodes_before, nodes_after);
+        printf("Hashcons: %.3f ms, %u -> %u nodes, %u -> %u classes\n", NS_TO_MS(hashcons_time),
+               hc_total.nodes, hc_total.unique_nodes, hc_total.classes, hc_total.unique_classes);
+    }
+    return (TRUE);
 }
 
-static char *match_dfa_table(char *input) {
-    int state = g_dfa.start_id;
-    char *ptr = input;
-    char *last_accept = NULL;
-    if (yy_accept[state]) last_accept = ptr;
-    while (*ptr) {
-        int ec_val = yy_ec[(unsigned char)*ptr];  /* equivalence class */
-        int next = yy_nxt[state * ec_num_classes + ec_val];
-        if (next == -1) break;
-        state = next;
-        ptr++;
-        if (yy_accept[state]) last_accept = ptr;
-    }
-    return last_accept;
+/**
+ * @brief Build the NFA fragments of rules first to first + count - 1
+ */
+static void build_fragments(LexOptions *opt, RegexTreeNode **trees, NFAFragment *frags, u32 first, u32 count) {
+    for (u32 r = first; r < first + count; r++) {
+        frags[r] = opt->glushkov ? glushkov_from_tree(trees[r]) : thompson_from_tree(trees[r]);
+    }
 }
 
-static void match_dfa_anywhere_table(char *regex_str, char *input) {
-    char *p = input;
-    while (*p) {
-        char *match = match_dfa_table(p);
-        if (match) {
-            int len = match - p;
-            if (len == 0) { p++; continue; }
-            printf("TABLE✅Match Rule: %s ", regex_str);
-            for (int i = 0; i < len; i++) {
-                putchar(p[i]);
-            }
-            printf("\n");
-            p = match;
-        } else {
-            p++;
-        }
+/**
+ * @brief Compile every rule from scratch, what -a is compared with
+ * @param states Receives the DFA state count, 0 over the budget
+ * @param tables Minimize and build the tables too
+ * @return Time of the NFA, its reduction and the subset construction,
+ *         and of the tables if asked
+ */
+static u64 full_rebuild(LexOptions *opt, RegexTreeNode **trees, NFAFragment *frags, u32 *states, s8 tables) {
+    u64 start = get_time_ns();
+
+    nfa_init(DEFAULT_NFA_CAPACITY);
+    build_fragments(opt, trees, frags, 0, opt->rule_count);
+    nfa_finalize(frags, opt->rule_count);
+    if (!opt->raw_nfa) {
+        NFAReduceStats rs;
+        nfa_reduce(&rs);
     }
+    g_dfa.budget = (size_t)opt->budget_mb << 20;
+    s8 ready = nfa_to_dfa(opt->threads);
+    *states = ready ? g_dfa.state_count : 0;
+    if (ready && tables) {
+        DFAMinimizeStats ms;
+        if (!opt->raw_dfa) dfa_minimize(&ms, NULL);
+        dfa_tables_build(&g_dfa, opt->tables);
+        dfa_tables_free();
+    }
+    u64 time = get_time_ns() - start;
+
+    dfa_free();
+    nfa_free();
+    return (time);
 }
 
 /**
- * @brief Export compressed DFA (Flex-style)
+ * @brief Scan with the tables of a file saved by --save
+ * @return Exit status of the tester
+ *
+ * No rule is compiled: the file is mapped and scanned in place.
  */
-void build_compress_dfa(DFA *dfa) {
-    EquivClasses ec = compute_equiv_classes(dfa);
-    
-    memcpy(yy_ec, ec.ec, 256);
-    yy_accept = malloc(sizeof(int) * dfa->state_count);
-    yy_nxt = malloc(sizeof(int) * dfa->state_count * ec.num_classes);
-
-    for (u32 i = 0; i < dfa->state_count; i++) {
-        yy_accept[i] = dfa->states[i].is_final ? 1 : 0;
-    }
-
-    for (u32 s = 0; s < dfa->state_count; s++) {
-        for (int c = 0; c < ec.num_classes; c++) {
-            /* Find a character in this equiv class */
-            int repr = -1;
-            for (int i = 0; i < 256; i++) {
-                if (ec.ec[i] == c) {
-                    repr = i;
-                    break;
-                }
-            }
-            
-            int next = (repr >= 0) ? (int)dfa->states[s].transitions[repr] : -1;
-            if (next == (int)(u32)-1) next = -1;
-            yy_nxt[s * ec.num_classes + c] = next;
-        }
+static int scan_saved_tables(LexOptions *opt) {
+    char    **rules = NULL;
+    u32     rule_count = 0;
+    u64     load_start = get_time_ns();
+
+    if (!dfa_tables_load(opt->load, &rules, &rule_count)) {
+        options_free(opt);
+        return (1);
     }
+    u64 load_time = get_time_ns() - load_start;
+
+    match_tables_anywhere(rules, opt->input);
+    if (opt->stats) {
+        u32 matches = 0;
+        double speed = scan_throughput(match_tables_count, opt->input, &matches);
+        printf("Load: %.1f us, -C%s, %u rules, %u states, %zu KB mapped\n", (double)load_time / 1e3,
+               dfa_tables_mode_name(g_tables.mode), rule_count, g_tables.state_count, g_tables.map_size >> 10);
+        printf("Scan: DFA -C%s %.2f MB/s (%u matches)\n", dfa_tables_mode_name(g_tables.mode), speed, matches);
+    }
+    free(rules);
+    dfa_tables_free();
+    options_free(opt);
+    return (0);
+}
 
-    ec_num_classes = ec.num_classes;
+/**
+ * @brief Add the -a rules to a file saved by --save, then scan or save it
+ * @return Exit status of the tester
+ *
+ * The saved rules are not compiled again: the file holds the NFA and
+ * the subset construction the tables were built from, dfa_append adds
+ * the -a rules to them as in a single run and dfa_tables_extend gives
+ * the new states their rows. The tables keep the -C layout of the file.
+ * With -s every rule is also compiled from scratch, last since it takes
+ * the global automata.
+ */
+static int extend_saved_tables(LexOptions *opt) {
+    char    **saved = NULL;
+    u32     saved_count = 0;
+    u64     load_start = get_time_ns();
 
-    printf("✅ Generated compressed DFA table\n");
-    printf("   Compression: %d → %d equiv classes (%.1f%% reduction)\n",
-           256, ec.num_classes, 100.0 * (256 - ec.num_classes) / 256);
+    if (!dfa_tables_load_automaton(opt->load, &saved, &saved_count)) {
+        options_free(opt);
+        return (1);
+    }
+    u64 load_time = get_time_ns() - load_start;
+
+    /* The saved rules first, at a higher priority */
+    char **rules = malloc(((size_t)saved_count + opt->rule_count) * sizeof(char *));
+    RegexTreeNode **trees = malloc(((size_t)saved_count + opt->rule_count) * sizeof(RegexTreeNode *));
+    NFAFragment *frags = malloc(((size_t)saved_count + opt->rule_count) * sizeof(NFAFragment));
+    if (!rules || !trees || !frags) {
+        ERR("Memory allocation failed\n");
+        exit(1);
+    }
+    memcpy(rules, saved, saved_count * sizeof(char *));
+    memcpy(&rules[saved_count], opt->rules, opt->rule_count * sizeof(char *));
+    free(opt->rules);
+    opt->rules = rules;
+    opt->base_count = saved_count;
+    opt->rule_count += saved_count;
+    opt->tables = g_tables.mode;
+
+    /* The saved rules are only parsed for the rebuild of -s */
+    if (!parse_rules(opt, trees, opt->stats ? 0 : opt->base_count)) {
+        dfa_tables_free();
+        dfa_free();
+        nfa_free();
+        regex_tree_free();
+        free(trees);
+        free(frags);
+        free(saved);
+        options_free(opt);
+        return (1);
+    }
+
+    DFAAppendStats as = {0};
+    DFAExtendStats es = {0};
+    u32 added = opt->rule_count - opt->base_count;
+    u64 append_start = get_time_ns();
+    g_dfa.budget = (size_t)opt->budget_mb << 20;
+    nfa_thaw();
+    build_fragments(opt, trees, frags, opt->base_count, added);
+    nfa_append(&frags[opt->base_count], added, opt->base_count + 1);
+    s8 ready = dfa_append(opt->threads, &as);
+    u64 append_time = get_time_ns() - append_start;
+    u64 tables_start = get_time_ns();
+    if (ready) dfa_tables_extend(&g_dfa, &es);
+    u64 tables_time = get_time_ns() - tables_start;
+
+    if (opt->stats && ready) {
+        printf("Load: %.3f ms, -C%s, %u rules, %u rows, %u DFA states\n", NS_TO_MS(load_time),
+               dfa_tables_mode_name(opt->tables), saved_count, es.rows_before, as.states_before);
+        printf("Append: %.3f ms, %u rules, %u -> %u states (%u reused, %u new, %u dropped), "
+               "%u -> %u byte classes\n", NS_TO_MS(append_time), added, as.states_before,
+               g_dfa.state_count, as.states_reused, as.states_new, as.states_dropped,
+               as.classes_before, as.classes_after);
+        printf("Extend: %.3f ms, -C%s, %u -> %u rows (%u new, %u rewritten), %u -> %u equivalence classes, %zu KB\n",
+               NS_TO_MS(tables_time), dfa_tables_mode_name(opt->tables), es.rows_before, g_tables.state_count,
+               es.rows_new, es.rows_rewritten, es.classes_before, es.classes_after, dfa_tables_bytes() >> 10);
+        printf("Load + append: %.3f ms (load %.3f ms, append %.3f ms, tables %.3f ms)\n",
+               NS_TO_MS(load_time + append_time + tables_time), NS_TO_MS(load_time),
+               NS_TO_MS(append_time), NS_TO_MS(tables_time));
+    }
+
+    int status = 0;
+    if (ready && opt->save) {
+        s8 saved_ok = dfa_tables_save(opt->save, opt->rules, opt->rule_count, &g_dfa);
+        if (saved_ok) printf("✅ Saved %u rules, -C%s tables to %s\n", opt->rule_count, dfa_tables_mode_name(opt->tables), opt->save);
+        status = saved_ok ? 0 : 1;
+    } else if (ready) {
+        match_tables_anywhere(opt->rules, opt->input);
+        if (opt->stats) {
+            u32 matches = 0;
+            double speed = scan_throughput(match_tables_count, opt->input, &matches);
+            printf("Scan: DFA -C%s %.2f MB/s (%u matches)\n", dfa_tables_mode_name(opt->tables), speed, matches);
+        }
+    } else if (opt->save) {
+        ERR("DFA over the memory budget, %s not written\n", opt->save);
+        status = 1;
+    } else {
+        /* Over budget: the NFA simulation still gives the matches */
+        match_nfa_anywhere(opt->rules, opt->input);
+    }
+    dfa_tables_free();
+    dfa_free();
+    nfa_free();
+
+    if (opt->stats && ready) {
+        u32 rebuild_states = 0;
+        u64 rebuild_time = full_rebuild(opt, trees, frags, &rebuild_states, TRUE);
+        printf("Rebuild: %.3f ms, %u rules from scratch, %u states (%.1fx the load + append)\n",
+               NS_TO_MS(rebuild_time), opt->rule_count, rebuild_states,
+               (double)rebuild_time / GET_MAX(load_time + append_time + tables_time, 1));
+    }
+    regex_tree_free();
+    free(trees);
+    free(frags);
+    free(saved);
+    options_free(opt);
+    return (status);
 }
 
 int tester(int argc, char **argv) {
+    LexOptions opt = {0};
+
+    /* Comb compressed by default, as flex */
+    opt.tables = TABLES_COMB;
+
     set_log_level(L_INFO);
     
-    if (argc < 3) {
-        INFO("Usage: %s <regex> <str_to_parse>\n", argv[0]);
+    if (!parse_options(argc, argv, &opt)) {
+        options_free(&opt);
+        INFO("Usage: %s [-v level] [-s] [-g] [-R] [-b] [-M] [-l] [-m budget_mb] [-j threads] [-C f|e|em|r] [-a rules_file] <regex>... | -f <rules_file> <str_to_parse>\n", argv[0]);
+        INFO("       %s [options] --save <file> <regex>... | -f <rules_file>\n", argv[0]);
+        INFO("       %s [-s] --load <file> [-a rules_file] <str_to_parse>\n", argv[0]);
+        INFO("       %s [options] --load <file> -a <rules_file> --save <file>\n", argv[0]);
+        INFO("  -a: added to the automaton of the --load file, only the new states get table rows;"
+             " without --load the other rules are compiled first in the same run\n");
         return 1;
     }
+    if (opt.load) return (opt.append ? extend_saved_tables(&opt) : scan_saved_tables(&opt));
     
-    char *input = argv[2];
+    char *input = opt.input;
+    s8 verbose = *get_log_level() >= L_INFO;
+    RegexTreeNode **trees = malloc(opt.rule_count * sizeof(RegexTreeNode *));
+    NFAFragment *frags = malloc(opt.rule_count * sizeof(NFAFragment));
 
-    String s = {
-        .str = argv[1],
-        .pos = 0,
-        .len = strlen(argv[1])
-    };
-
-
-    INFO("Parsing regex: '%s'\n", s.str);
-    INFO("=====================================\n");
-    
-    RegexTreeNode *tree = parse_regex(&s);
-    
-    if (!tree) {
-        ERR("Failed to parse regex!\n");
+    if (!trees || !frags) {
+        ERR("Memory allocation failed\n");
+        exit(1);
+    }
+    if (!parse_rules(&opt, trees, 0)) {
+        regex_tree_free();
+        free(trees);
+        free(frags);
+        options_free(&opt);
         return (1);
     }
-    
-    print_regex_tree(tree);
-    INFO("Parsing completed successfully!\n");
-    INFO("Final position: %d/%d\n", s.pos, (int)strlen(s.str));
-    INFO("=====================================\n");
-    
+
+    /* Baseline of -a, done first: the automata below are the ones kept */
+    u32 rebuild_states = 0;
+    u64 rebuild_time = (opt.stats && opt.append) ? full_rebuild(&opt, trees, frags, &rebuild_states, FALSE) : 0;
+
+    /* With -a the -a rules are left out, dfa_append adds them to the DFA */
+    u64 nfa_start = get_time_ns();
     nfa_init(DEFAULT_NFA_CAPACITY);
-    NFAFragment frag = thompson_from_tree(tree);
-    nfa_finalize(&frag);
+    build_fragments(&opt, trees, frags, 0, opt.base_count);
+    nfa_finalize(frags, opt.base_count);
+    u64 nfa_time = get_time_ns() - nfa_start;
+    u64 reduce_time = 0;
+
+    if (opt.stats) {
+        printf("NFA (%s): %.3f ms, %u states, %u transitions, %u epsilon\n",
+               opt.glushkov ? "Glushkov" : "Thompson", NS_TO_MS(nfa_time),
+               g_nfa.state_count, g_nfa.edge_count, g_nfa.eps_offsets[g_nfa.state_count]);
+    }
+
+    if (!opt.raw_nfa) {
+        NFAReduceStats rs;
+        u64 reduce_start = get_time_ns();
+        nfa_reduce(&rs);
+        reduce_time = get_time_ns() - reduce_start;
+
+        INFO("NFA reduction: %u -> %u states\n", rs.states_before, rs.states_after);
+        if (opt.stats) {
+            printf("Reduce: %.3f ms, %u -> %u states (epsilon-free %u, merged %u), %u -> %u transitions\n",
+                   NS_TO_MS(reduce_time), rs.states_before, rs.states_after, rs.states_eps_free,
+                   rs.states_merged, rs.trans_before, rs.trans_after);
+        }
+    }
     
     // print_nfa_tree();
     // INFO("=====================================\n");
-    print_nfa();
+    if (verbose) print_nfa();
     // INFO("=====================================\n");
 
     INFO("Matching input: '%s'\n", input);
 
-    nfa_to_dfa();
-    print_dfa();
-    build_compress_dfa(&g_dfa);
-    match_dfa_anywhere_table(argv[1], input);
+    /* The NFA misses the -a rules yet, -b and -l are refused with -a */
+    if ((opt.stats && !opt.append) || opt.bitpar) {
+        u64 bitpar_start = get_time_ns();
+        s8 bitpar_ready = bitpar_build();
+        u64 bitpar_time = get_time_ns() - bitpar_start;
+
+        if (opt.stats && bitpar_ready) {
+            u32 matches = 0;
+            double speed = scan_throughput(match_bitpar_count, input, &matches);
+            printf("Bit-parallel: %.3f ms, scan %.2f MB/s (%u matches)\n",
+                   NS_TO_MS(bitpar_time), speed, matches);
+        }
+        if (opt.bitpar && bitpar_ready) {
+            /* No determinisation: the point of -b is patterns whose DFA blows up */
+            match_bitpar_anywhere(opt.rules, input);
+            bitpar_free();
+            nfa_free();
+            free(trees);
+            free(frags);
+            regex_tree_free();
+            options_free(&opt);
+            return (0);
+        }
+        bitpar_free();
+    }
+
+    if ((opt.stats && !opt.append) || opt.lazy) {
+        /* Same budget option as the full DFA, here the size of the state cache */
+        lazy_dfa_init((size_t)opt.budget_mb << 20);
+
+        if (opt.stats) {
+            /* Counters of one scan from an empty cache, before the timed rescans */
+            u64 cold_start = get_time_ns();
+            u32 matches = match_lazy_count(input);
+            u64 cold_time = get_time_ns() - cold_start;
+            LazyDFAStats ls = *lazy_dfa_stats();
+            double speed = scan_throughput(match_lazy_count, input, &matches);
+            printf("Lazy: cold scan %.3f ms, scan %.2f MB/s (%u matches), %llu hits, %llu misses, %u flushes, %u/%u states%s\n",
+                   NS_TO_MS(cold_time), speed, matches, (unsigned long long)ls.hits, (unsigned long long)ls.misses,
+                   ls.flushes, ls.states, ls.capacity, ls.fallback ? " (thrashing, NFA fallback)" : "");
+        }
+        if (opt.lazy) {
+            /* States are only built for the bytes the input reaches */
+            match_lazy_anywhere(opt.rules, input);
+            lazy_dfa_free();
+            nfa_free();
+            free(trees);
+            free(frags);
+            regex_tree_free();
+            options_free(&opt);
+            return (0);
+        }
+        lazy_dfa_free();
+    }
+
+    u64 dfa_start = get_time_ns();
+    g_dfa.budget = (size_t)opt.budget_mb << 20;
+    s8 dfa_ready = nfa_to_dfa(opt.threads);
+    u64 dfa_time = get_time_ns() - dfa_start;
+    if (opt.stats) {
+        printf("DFA: %.3f ms, %u states, %u byte classes, %zu KB, %u threads%s\n", NS_TO_MS(dfa_time),
+               g_dfa.state_count, g_dfa.class_count, g_dfa.memory >> 10, GET_MAX(opt.threads, 1),
+               dfa_ready ? "" : " (budget reached)");
+    }
+    if (opt.append) {
+        /* Not minimized yet: dfa_append needs the subset construction */
+        DFAAppendStats as = {0};
+        u32 added = opt.rule_count - opt.base_count;
+        u64 append_start = get_time_ns();
+        nfa_thaw();
+        build_fragments(&opt, trees, frags, opt.base_count, added);
+        nfa_append(&frags[opt.base_count], added, opt.base_count + 1);
+        if (dfa_ready) dfa_ready = dfa_append(opt.threads, &as);
+        u64 append_time = get_time_ns() - append_start;
+
+        if (opt.stats && dfa_ready) {
+            printf("Append: %.3f ms, %u rules, %u -> %u states (%u reused, %u new, %u dropped), "
+                   "%u -> %u byte classes\n", NS_TO_MS(append_time), added, as.states_before,
+                   g_dfa.state_count, as.states_reused, as.states_new, as.states_dropped,
+                   as.classes_before, as.classes_after);
+            /* Every -a run pays the base build too, the rebuild is compared with both */
+            u64 base_time = nfa_time + reduce_time + dfa_time;
+            printf("Base + append: %.3f ms (%u rules compiled %.3f ms, append %.3f ms)\n",
+                   NS_TO_MS(base_time + append_time), opt.base_count, NS_TO_MS(base_time), NS_TO_MS(append_time));
+            printf("Rebuild: %.3f ms, %u rules from scratch, %u states (%.1fx the base + append)\n",
+                   NS_TO_MS(rebuild_time), opt.rule_count, rebuild_states,
+                   (double)rebuild_time / GET_MAX(base_time + append_time, 1));
+        }
+    }
+    free(trees);
+    free(frags);
+    if (!dfa_ready && opt.save) {
+        ERR("DFA over the memory budget, %s not written\n", opt.save);
+        dfa_free();
+        nfa_free();
+        regex_tree_free();
+        options_free(&opt);
+        return (1);
+    }
+    if (!dfa_ready) {
+        /* Over budget: the NFA simulation still gives the matches */
+        match_nfa_anywhere(opt.rules, input);
+        dfa_free();
+        nfa_free();
+        regex_tree_free();
+        options_free(&opt);
+        return (0);
+    }
+    /* --save keeps the subset construction for a later -a */
+    DFA subset = {0};
+    if (!opt.raw_dfa) {
+        DFAMinimizeStats ms;
+        u64 minimize_start = get_time_ns();
+        dfa_minimize(&ms, opt.save ? &subset : NULL);
+        u64 minimize_time = get_time_ns() - minimize_start;
+
+        INFO("DFA minimization: %u -> %u states\n", ms.states_before, ms.states_after);
+        if (opt.stats) {
+            printf("Minimize: %.3f ms, %u -> %u states, %zu -> %zu KB\n", NS_TO_MS(minimize_time),
+                   ms.states_before, ms.states_after, ms.bytes_before >> 10, ms.bytes_after >> 10);
+        }
+    }
+    if (verbose) print_dfa();
+    if (opt.stats && !opt.save) {
+        /* Every mode on this DFA, to choose between memory and throughput */
+        for (u32 m = 0; m < TABLES_MODE_COUNT; m++) {
+            u32 matches = 0;
+            u64 build_start = get_time_ns();
+            dfa_tables_build(&g_dfa, m);
+            u64 build_time = get_time_ns() - build_start;
+            double speed = scan_throughput(match_tables_count, input, &matches);
+            printf("Tables -C%s: %.3f ms, %zu KB, scan %.2f MB/s (%u matches)\n", dfa_tables_mode_name(m),
+                   NS_TO_MS(build_time), dfa_tables_bytes() >> 10, speed, matches);
+        }
+    }
+    u64 tables_start = get_time_ns();
+    dfa_tables_build(&g_dfa, opt.tables);
+    u64 tables_time = get_time_ns() - tables_start;
+    printf("✅ Generated compressed DFA table\n");
+    if (opt.tables != TABLES_FULL) {
+        printf("   Compression: %d → %u equiv classes (%.1f%% reduction), %u meta classes, %u templates\n",
+               256, g_tables.ec_count, 100.0 * (256 - g_tables.ec_count) / 256, g_tables.meta_count,
+               g_tables.template_count);
+    }
+    if (opt.stats) {
+        printf("Tables: %.3f ms, -C%s, %u -> %u equivalence classes, %u meta classes, %u templates, "
+               "%zu KB (%u/%u comb slots used, %u range rows)\n",
+               NS_TO_MS(tables_time), dfa_tables_mode_name(opt.tables), g_dfa.class_count, g_tables.ec_count,
+               g_tables.meta_count, g_tables.template_count, dfa_tables_bytes() >> 10,
+               g_tables.comb_used, g_tables.comb_size, g_tables.range_rows);
+    }
+    if (opt.save) {
+        s8 saved = dfa_tables_save(opt.save, opt.rules, opt.rule_count, opt.raw_dfa ? &g_dfa : &subset);
+        if (saved) printf("✅ Saved %u rules, -C%s tables to %s\n", opt.rule_count, dfa_tables_mode_name(opt.tables), opt.save);
+        dfa_release(&subset);
+        dfa_tables_free();
+        dfa_free();
+        nfa_free();
+        regex_tree_free();
+        options_free(&opt);
+        return (saved ? 0 : 1);
+    }
+    match_tables_anywhere(opt.rules, input);
+
+    if (opt.stats) {
+        u32 nfa_matches = 0;
+        u32 dfa_matches = 0;
+        double nfa_speed = scan_throughput(match_nfa_count, input, &nfa_matches);
+        double dfa_speed = scan_throughput(match_tables_count, input, &dfa_matches);
+        printf("Scan: NFA %.2f MB/s (%u matches), DFA -C%s %.2f MB/s (%u matches)\n",
+               nfa_speed, nfa_matches, dfa_tables_mode_name(opt.tables), dfa_speed, dfa_matches);
+    }
 
     INFO("=====================================\n");
 
+    dfa_tables_free();
     dfa_free();
     nfa_free();
-    RegexTreeNode_free(tree);
+    regex_tree_free();
+    options_free(&opt);
     return (0);
 }
 
@@ -0,0 +1,410 @@
+#include "../../include/nfa.h"
+#include "../../include/log.h"
+
+/**
+ * @brief Growable list of NFA state ids
+ */
+typedef struct {
+    u32     *ids;
+    u32     count;
+    u32     capacity;
+} IdList;
+
+/**
+ * @brief Glushkov fragment of a subexpression
+ *
+ * Every symbol occurrence is a position (an NFA state). Transitions into
+ * a position are all labelled with its symbol, so the follow relation
+ * is stored directly as NFA transitions last(A) -> first(B).
+ */
+typedef struct {
+    s8      nullable;   /* The subexpression matches the empty string */
+    IdList  first;      /* Positions that can start a match */
+    IdList  last;       /* Positions that can end a match */
+} GlushkovFrag;
+
+/**
+ * @brief Recorded fragment of a shared node (refs > 1)
+ */
+typedef struct {
+    NFAMark         lo;         /* Mark before the node was built */
+    NFAMark         hi;         /* Mark after, the range holds its positions and follow edges */
+    GlushkovFrag    frag;
+} GlushkovRecord;
+
+/**
+ * @brief State of one Glushkov construction
+ */
+typedef struct {
+    u32             *labels;            /* labels[p]: symbol of position p */
+    u32             label_capacity;
+    GlushkovRecord  **records;          /* Indexed by node id */
+    u32             record_capacity;
+    u32             reused;             /* Fragments copied from a record */
+} Glushkov;
+
+/**
+ * @brief Pending node of the iterative Glushkov construction
+ */
+typedef struct {
+    RegexTreeNode   *node;
+    s8              children_done;
+    NFAMark         first;
+} GlushkovFrame;
+
+static void id_list_push(IdList *l, u32 id) {
+    if (l->count >= l->capacity) {
+        l->capacity = GET_MAX(l->capacity * 2, 4);
+        l->ids = realloc(l->ids, l->capacity * sizeof(u32));
+        if (!l->ids) {
+            ERR("Memory allocation failed for Glushkov sets\n");
+            exit(1);
+        }
+    }
+    l->ids[l->count++] = id;
+}
+
+static void id_list_append(IdList *dst, IdList *src) {
+    for (u32 i = 0; i < src->count; i++) {
+        id_list_push(dst, src->ids[i]);
+    }
+}
+
+static void frag_release(GlushkovFrag *f) {
+    free(f->first.ids);
+    free(f->last.ids);
+    *f = (GlushkovFrag){0};
+}
+
+static void set_label(Glushkov *g, u32 state, u32 label) {
+    if (state >= g->label_capacity) {
+        u32 capacity = GET_MAX(g->label_capacity * 2, 64);
+        while (capacity <= state) capacity *= 2;
+        g->labels = realloc(g->labels, capacity * sizeof(u32));
+        if (!g->labels) {
+            ERR("Memory allocation failed for Glushkov positions\n");
+            exit(1);
+        }
+        g->label_capacity = capacity;
+    }
+    g->labels[state] = label;
+}
+
+/**
+ * @brief Add the follow transitions from every position of from to every position of to
+ */
+static void link(Glushkov *g, IdList *from, IdList *to) {
+    for (u32 i = 0; i < from->count; i++) {
+        for (u32 j = 0; j < to->count; j++) {
+            add_transition(from->ids[i], g->labels[to->ids[j]], to->ids[j]);
+        }
+    }
+}
+
+static GlushkovFrag glushkov_symbol(Glushkov *g, u32 label) {
+    GlushkovFrag f = {0};
+    u32 p = create_state(0);
+
+    set_label(g, p, label);
+    id_list_push(&f.first, p);
+    id_list_push(&f.last, p);
+    return (f);
+}
+
+/**
+ * @brief Literal run: one position per character, each following the previous one
+ */
+static GlushkovFrag glushkov_string(Glushkov *g, char *str, u32 len) {
+    GlushkovFrag f = {0};
+    u32 prev = 0;
+
+    /* The empty string of x{0} has no position */
+    f.nullable = (len == 0);
+    for (u32 i = 0; i < len; i++) {
+        u32 p = create_state(0);
+        set_label(g, p, (u8)str[i]);
+        if (i == 0) id_list_push(&f.first, p);
+        else add_transition(prev, (u8)str[i], p);
+        prev = p;
+    }
+    if (len > 0) id_list_push(&f.last, prev);
+    return (f);
+}
+
+static GlushkovFrag glushkov_concat(Glushkov *g, GlushkovFrag a, GlushkovFrag b) {
+    GlushkovFrag f = {0};
+
+    link(g, &a.last, &b.first);
+    f.nullable = a.nullable && b.nullable;
+    f.first = a.first;
+    if (a.nullable) id_list_append(&f.first, &b.first);
+    f.last = b.last;
+    if (b.nullable) id_list_append(&f.last, &a.last);
+    free(a.last.ids);
+    free(b.first.ids);
+    return (f);
+}
+
+static GlushkovFrag glushkov_alt(GlushkovFrag a, GlushkovFrag b) {
+    a.nullable = a.nullable || b.nullable;
+    id_list_append(&a.first, &b.first);
+    id_list_append(&a.last, &b.last);
+    frag_release(&b);
+    return (a);
+}
+
+/**
+ * @brief x+ (and x* with nullable set): last(x) follows back into first(x)
+ */
+static GlushkovFrag glushkov_loop(Glushkov *g, GlushkovFrag f, s8 nullable) {
+    link(g, &f.last, &f.first);
+    f.nullable = f.nullable || nullable;
+    return (f);
+}
+
+/**
+ * @brief Copy a built fragment in new positions
+ * @param lo Mark taken before building f
+ * @param hi Mark taken after building f
+ */
+static GlushkovFrag glushkov_clone(Glushkov *g, GlushkovFrag *f, NFAMark lo, NFAMark hi) {
+    GlushkovFrag copy = {0};
+    u32 offset = g_nfa.state_count - lo.state;
+
+    for (u32 s = lo.state; s < hi.state; s++) {
+        set_label(g, create_state(0), g->labels[s]);
+    }
+    for (u32 e = lo.edge; e < hi.edge; e++) {
+        NFAEdge edge = g_nfa.edges[e];
+        add_transition(edge.from + offset, edge.t.label, edge.t.to_id + offset);
+    }
+    copy.nullable = f->nullable;
+    for (u32 i = 0; i < f->first.count; i++) {
+        id_list_push(&copy.first, f->first.ids[i] + offset);
+    }
+    for (u32 i = 0; i < f->last.count; i++) {
+        id_list_push(&copy.last, f->last.ids[i] + offset);
+    }
+    return (copy);
+}
+
+/**
+ * @brief x{min,max} by copying the positions of x
+ * @param f Fragment of x, built since lo
+ *
+ * x{2,4} = x x (x (x)?)? and x{2,} = x x+, every copy has its own positions.
+ */
+static GlushkovFrag glushkov_repeat(Glushkov *g, GlushkovFrag f, NFAMark lo, u32 min, u32 max) {
+    NFAMark hi = nfa_mark();
+    u32 copies = (max == REPEAT_INFINITE) ? min : max;
+
+    GlushkovFrag *parts = malloc(copies * sizeof(GlushkovFrag));
+    if (!parts) {
+        ERR("Memory allocation failed for repetition\n");
+        exit(1);
+    }
+    parts[0] = f;
+    for (u32 i = 1; i < copies; i++) {
+        parts[i] = glushkov_clone(g, &f, lo, hi);
+    }
+
+    if (max == REPEAT_INFINITE) {
+        parts[copies - 1] = glushkov_loop(g, parts[copies - 1], FALSE);
+    } else {
+        /* Optional tail, built from the innermost copy */
+        for (u32 i = copies - 1; i >= GET_MAX(min, 1); i--) {
+            parts[i].nullable = TRUE;
+            parts[i - 1] = glushkov_concat(g, parts[i - 1], parts[i]);
+        }
+        if (min == 0) parts[0].nullable = TRUE;
+        copies = GET_MAX(min, 1);
+    }
+
+    GlushkovFrag result = parts[0];
+    for (u32 i = 1; i < copies; i++) {
+        result = glushkov_concat(g, result, parts[i]);
+    }
+    free(parts);
+    return (result);
+}
+
+static GlushkovRecord *record_get(Glushkov *g, RegexTreeNode *node) {
+    if (node->refs < 2 || node->id >= g->record_capacity) return (NULL);
+    return (g->records[node->id]);
+}
+
+static void record_put(Glushkov *g, RegexTreeNode *node, GlushkovFrag *f, NFAMark lo) {
+    if (node->id >= g->record_capacity) {
+        u32 capacity = GET_MAX(g->record_capacity * 2, 64);
+        while (capacity <= node->id) capacity *= 2;
+        g->records = realloc(g->records, capacity * sizeof(GlushkovRecord *));
+        if (!g->records) {
+            ERR("Memory allocation failed for Glushkov records\n");
+            exit(1);
+        }
+        memset(g->records + g->record_capacity, 0, (capacity - g->record_capacity) * sizeof(GlushkovRecord *));
+        g->record_capacity = capacity;
+    }
+
+    GlushkovRecord *r = malloc(sizeof(GlushkovRecord));
+    if (!r) {
+        ERR("Memory allocation failed for Glushkov records\n");
+        exit(1);
+    }
+    r->lo = lo;
+    r->hi = nfa_mark();
+    r->frag = (GlushkovFrag){f->nullable, {0}, {0}};
+    id_list_append(&r->frag.first, &f->first);
+    id_list_append(&r->frag.last, &f->last);
+    g->records[node->id] = r;
+}
+
+/**
+ * @brief Build the fragment of one node once its children fragments are built
+ */
+static void glushkov_build_node(Glushkov *g, RegexTreeNode *node, NFAMark first, GlushkovFrag *frags, u32 *frag_count) {
+    GlushkovFrag f;
+
+    switch (node->type) {
+        case REG_CHAR:
+        case REG_CLASS:
+            f = glushkov_symbol(g, nfa_symbol_label(node));
+            break;
+        case REG_STRING:
+            f = glushkov_string(g, node->str, node->str_len);
+            break;
+        case REG_CONCAT:
+            f = glushkov_concat(g, frags[*frag_count - 2], frags[*frag_count - 1]);
+            *frag_count -= 2;
+            break;
+        case REG_ALT:
+            f = glushkov_alt(frags[*frag_count - 2], frags[*frag_count - 1]);
+            *frag_count -= 2;
+            break;
+        case REG_GROUP:
+            f = frags[--(*frag_count)];
+            break;
+        default:
+            ERR("Unknown node type %d\n", node->type);
+            f = (GlushkovFrag){0};
+            break;
+    }
+
+    switch (node->op) {
+        case OP_STAR:     f = glushkov_loop(g, f, TRUE);  break;
+        case OP_PLUS:     f = glushkov_loop(g, f, FALSE); break;
+        case OP_OPTIONAL: f.nullable = TRUE;              break;
+        case OP_REPEAT:   f = glushkov_repeat(g, f, first, node->rep_min, node->rep_max); break;
+        case OP_NONE:     break;
+    }
+
+    frags[(*frag_count)++] = f;
+}
+
+static void glushkov_free(Glushkov *g) {
+    for (u32 i = 0; i < g->record_capacity; i++) {
+        if (!g->records[i]) continue;
+        frag_release(&g->records[i]->frag);
+        free(g->records[i]);
+    }
+    free(g->records);
+    free(g->labels);
+}
+
+/**
+ * @brief Build an epsilon-free NFA with the Glushkov (position) construction
+ * @param root Root of the regex tree
+ * @return Fragment whose start is the initial state and outputs the final states
+ *
+ * One state per symbol occurrence plus an initial state. nullable, first
+ * and last are computed bottom-up and follow(p) is emitted as transitions
+ * labelled with the symbol of the target position, so the automaton has
+ * no epsilon edge and n + 1 states for n symbols (vs about 2n and many
+ * epsilon edges for Thompson). The follow relation can be quadratic,
+ * ex: (a|b|c|d)* links every position to every position.
+ */
+NFAFragment glushkov_from_tree(RegexTreeNode *root) {
+    if (!root) {
+        ERR("Null node\n");
+        return frag_create(-1);
+    }
+
+    Glushkov        g = {0};
+    u32             capacity = 64;
+    u32             count = 0;
+    GlushkovFrame   *stack = malloc(capacity * sizeof(GlushkovFrame));
+    u32             frag_count = 0;
+    u32             frag_capacity = 64;
+    GlushkovFrag    *frags = malloc(frag_capacity * sizeof(GlushkovFrag));
+    u32             start = create_state(0);
+
+    if (!stack || !frags) {
+        ERR("Memory allocation failed for Glushkov stacks\n");
+        exit(1);
+    }
+    set_label(&g, start, NFA_EPSILON);
+
+    stack[count++] = (GlushkovFrame){root, 0, {0, 0}};
+    while (count > 0) {
+        GlushkovFrame *f = &stack[count - 1];
+        GlushkovRecord *r = f->children_done ? NULL : record_get(&g, f->node);
+
+        if (f->children_done || r) {
+            RegexTreeNode *node = f->node;
+            NFAMark first = f->first;
+            count--;
+            if (frag_count >= frag_capacity) {
+                frag_capacity *= 2;
+                frags = realloc(frags, frag_capacity * sizeof(GlushkovFrag));
+                if (!frags) {
+                    ERR("Memory allocation failed for Glushkov stacks\n");
+                    exit(1);
+                }
+            }
+            if (r) {
+                frags[frag_count++] = glushkov_clone(&g, &r->frag, r->lo, r->hi);
+                g.reused++;
+                continue;
+            }
+            glushkov_build_node(&g, node, first, frags, &frag_count);
+            if (node->refs > 1) {
+                record_put(&g, node, &frags[frag_count - 1], first);
+            }
+            continue;
+        }
+
+        f->children_done = 1;
+        f->first = nfa_mark();
+        RegexTreeNode *left = f->node->left;
+        RegexTreeNode *right = f->node->right;
+
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(GlushkovFrame));
+            if (!stack) {
+                ERR("Memory allocation failed for Glushkov stacks\n");
+                exit(1);
+            }
+        }
+        /* Right pushed first so the left fragment is built (and numbered) first */
+        if (right) stack[count++] = (GlushkovFrame){right, 0, {0, 0}};
+        if (left) stack[count++] = (GlushkovFrame){left, 0, {0, 0}};
+    }
+
+    GlushkovFrag f = frags[0];
+    NFAFragment result = frag_create(start);
+    IdList starts = {&start, 1, 1};
+
+    link(&g, &starts, &f.first);
+    for (u32 i = 0; i < f.last.count; i++) {
+        frag_add_out(&result, f.last.ids[i]);
+    }
+    if (f.nullable) frag_add_out(&result, start);
+
+    INFO("Glushkov: %u positions, %u shared fragments copied\n", g_nfa.state_count - 1, g.reused);
+    frag_release(&f);
+    glushkov_free(&g);
+    free(stack);
+    free(frags);
+    return (result);
+}
@@ -18,43 +18,163 @@ void nfa_init(u32 capacity) {
     g_nfa.state_count = 0;
     g_nfa.capacity = capacity;
     g_nfa.start_id = -1;
+    g_nfa.edges = malloc(DEFAULT_NFA_EDGE_CAPACITY * sizeof(NFAEdge));
+    g_nfa.edge_count = 0;
+    g_nfa.edge_capacity = DEFAULT_NFA_EDGE_CAPACITY;
+    if (!g_nfa.states || !g_nfa.edges) {
+        ERR("Memory allocation failed for NFA\n");
+        exit(1);
+    }
 }
 
 /**
  * @brief Free all memory allocated for the NFA
- * 
- * Frees the transitions array of each state, then the states array itself.
  */
 void nfa_free(void) {
-    /* Free transitions array for each state */
-    for (u32 i = 0; i < g_nfa.state_count; i++) {
-        free(g_nfa.states[i].trans);
-    }
+    match_nfa_free();
     free(g_nfa.states);
+    free(g_nfa.edges);
+    free(g_nfa.eps_offsets);
+    free(g_nfa.eps_to);
+    free(g_nfa.sym_offsets);
+    free(g_nfa.sym_trans);
+    free(g_nfa.closure_offsets);
+    free(g_nfa.closure_list);
+    free(g_nfa.sets);
+    free(g_nfa.set_slots);
     g_nfa.states = NULL;
     g_nfa.state_count = 0;
+    g_nfa.edges = NULL;
+    g_nfa.edge_count = 0;
+    g_nfa.eps_offsets = NULL;
+    g_nfa.eps_to = NULL;
+    g_nfa.sym_offsets = NULL;
+    g_nfa.sym_trans = NULL;
+    g_nfa.closure_words = 0;
+    g_nfa.closure_offsets = NULL;
+    g_nfa.closure_list = NULL;
+    g_nfa.closure_count = 0;
+    g_nfa.sets = NULL;
+    g_nfa.set_count = 0;
+    g_nfa.set_capacity = 0;
+    g_nfa.set_slots = NULL;
+    g_nfa.set_slot_capacity = 0;
+}
+
+static u32 byte_set_hash(const u64 *bits) {
+    u64 h = 0xcbf29ce484222325ULL;
+
+    for (u32 i = 0; i < BYTE_SET_WORDS; i++) {
+        h = (h ^ bits[i]) * 0x100000001b3ULL;
+    }
+    return ((u32)(h ^ (h >> 32)));
+}
+
+/**
+ * @brief Rebuild the set hash index with twice the slots
+ */
+static void set_index_grow(void) {
+    u32 capacity = GET_MAX(g_nfa.set_slot_capacity * 2, 64);
+
+    free(g_nfa.set_slots);
+    g_nfa.set_slots = calloc(capacity, sizeof(u32));
+    if (!g_nfa.set_slots) {
+        ERR("Memory allocation failed for NFA byte sets\n");
+        exit(1);
+    }
+    g_nfa.set_slot_capacity = capacity;
+    for (u32 i = 0; i < g_nfa.set_count; i++) {
+        u32 pos = byte_set_hash(g_nfa.sets[i].bits) & (capacity - 1);
+        while (g_nfa.set_slots[pos]) pos = (pos + 1) & (capacity - 1);
+        g_nfa.set_slots[pos] = i + 1;
+    }
+}
+
+/**
+ * @brief Get the transition label matching a set of bytes
+ * @param bits BYTE_SET_WORDS words, bit c set if byte c matches (bit 0 ignored)
+ * @return The byte itself for a singleton, else the label of the interned set
+ * 
+ * Identical sets share one label, so the subset construction compares
+ * a class once per distinct set.
+ */
+static u32 nfa_label_set(const u64 *bits) {
+    ByteSet set;
+    u32     count = 0;
+    u32     single = 0;
+
+    memcpy(set.bits, bits, sizeof(set.bits));
+    set.bits[0] &= ~1ULL;
+    for (u32 i = 0; i < BYTE_SET_WORDS; i++) {
+        if (set.bits[i]) {
+            count += __builtin_popcountll(set.bits[i]);
+            single = i * 64 + __builtin_ctzll(set.bits[i]);
+        }
+    }
+    if (count == 1) return (single);
+
+    if ((g_nfa.set_count + 1) * 2 > g_nfa.set_slot_capacity) set_index_grow();
+
+    u32 pos = byte_set_hash(set.bits) & (g_nfa.set_slot_capacity - 1);
+    while (g_nfa.set_slots[pos]) {
+        u32 idx = g_nfa.set_slots[pos] - 1;
+        if (memcmp(g_nfa.sets[idx].bits, set.bits, sizeof(set.bits)) == 0) {
+            return (NFA_LABEL_SET_BASE + idx);
+        }
+        pos = (pos + 1) & (g_nfa.set_slot_capacity - 1);
+    }
+
+    if (g_nfa.set_count >= g_nfa.set_capacity) {
+        g_nfa.set_capacity = GET_MAX(g_nfa.set_capacity * 2, 16);
+        g_nfa.sets = realloc(g_nfa.sets, g_nfa.set_capacity * sizeof(ByteSet));
+        if (!g_nfa.sets) {
+            ERR("Memory allocation failed for NFA byte sets\n");
+            exit(1);
+        }
+    }
+    g_nfa.sets[g_nfa.set_count] = set;
+    g_nfa.set_slots[pos] = g_nfa.set_count + 1;
+    return (NFA_LABEL_SET_BASE + g_nfa.set_count++);
+}
+
+/**
+ * @brief Label of a regex symbol: a byte, '.' (any byte but newline) or a class
+ * @param node REG_CHAR or REG_CLASS node
+ */
+u32 nfa_symbol_label(RegexTreeNode *node) {
+    u64 bits[BYTE_SET_WORDS];
+
+    if (node->type == REG_CLASS) {
+        class_byte_set(node->class, bits);
+        return (nfa_label_set(bits));
+    }
+    if (node->c != '.') return ((u8)node->c);
+
+    memset(bits, 0xff, sizeof(bits));
+    bits['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+    return (nfa_label_set(bits));
 }
 
 /**
  * @brief Create a new NFA state
- * @param is_final Whether this state is a final/accepting state
+ * @param is_final Rule accepted by the state, NFA_NO_RULE if none
  * @return ID of the newly created state
  * 
  * Automatically grows the states array if capacity is reached.
- * Initializes the state with a dynamic transitions array.
  */
-static u32 create_state(u32 is_final) {
+u32 create_state(u32 is_final) {
     if (g_nfa.state_count >= g_nfa.capacity) {
         g_nfa.capacity *= 2;
         g_nfa.states = realloc(g_nfa.states, g_nfa.capacity * sizeof(NFAState));
+        if (!g_nfa.states) {
+            ERR("Memory allocation failed for NFA states\n");
+            exit(1);
+        }
     }
     
     u32 id = g_nfa.state_count++;
     g_nfa.states[id].id = id;
     g_nfa.states[id].is_final = is_final;
-    g_nfa.states[id].trans = malloc(INITIAL_TRANSITIONS_CAPACITY * sizeof(Transition));
-    g_nfa.states[id].trans_count = 0;
-    g_nfa.states[id].trans_capacity = INITIAL_TRANSITIONS_CAPACITY;
     
     return id;
 }
@@ -62,28 +182,33 @@ static u32 create_state(u32 is_final) {
 /**
  * @brief Add a transition from one state to another
  * @param from_id ID of the source state
- * @param c Character to match (0 for epsilon transition)
+ * @param label Byte or set label to match (NFA_EPSILON for epsilon transition)
  * @param to_id ID of the destination state
  * 
- * Automatically grows the transitions array if capacity is reached.
- * This allows unlimited transitions per state.
- */
-static void add_transition(u32 from_id, u8 c, u32 to_id) {
-    NFAState *s = &g_nfa.states[from_id];
-    
-    /* Reallocate if necessary (double the capacity) */
-    if (s->trans_count >= s->trans_capacity) {
-        s->trans_capacity *= 2;
-        s->trans = realloc(s->trans, s->trans_capacity * sizeof(Transition));
-        if (!s->trans) {
-            fprintf(stderr, "ERROR: Failed to realloc transitions for state %d\n", from_id);
+ * Appends to the NFA edge list (amortised doubling), the per-state
+ * layout is only built by nfa_freeze().
+ */
+void add_transition(u32 from_id, u32 label, u32 to_id) {
+    if (g_nfa.edge_count >= g_nfa.edge_capacity) {
+        g_nfa.edge_capacity *= 2;
+        g_nfa.edges = realloc(g_nfa.edges, g_nfa.edge_capacity * sizeof(NFAEdge));
+        if (!g_nfa.edges) {
+            ERR("Memory allocation failed for NFA transitions\n");
             exit(1);
         }
     }
     
-    s->trans[s->trans_count].c = c;
-    s->trans[s->trans_count].to_id = to_id;
-    s->trans_count++;
+    NFAEdge *e = &g_nfa.edges[g_nfa.edge_count++];
+    e->from = from_id;
+    e->t.label = label;
+    e->t.to_id = to_id;
+}
+
+/**
+ * @brief Current position of the construction
+ */
+NFAMark nfa_mark(void) {
+    return ((NFAMark){g_nfa.state_count, g_nfa.edge_count});
 }
 
 /**
@@ -91,7 +216,7 @@ static void add_transition(u32 from_id, u8 c, u32 to_id) {
  * @param start_id ID of the fragment's start state
  * @return New NFAFragment with dynamic output array
  */
-static NFAFragment frag_create(u32 start_id) {
+NFAFragment frag_create(u32 start_id) {
     NFAFragment f;
     f.start_id = start_id;
     f.out_ids = malloc(8 * sizeof(u32));
@@ -107,7 +232,7 @@ static NFAFragment frag_create(u32 start_id) {
  * 
  * Automatically grows the output array if capacity is reached.
  */
-static void frag_add_out(NFAFragment *f, u32 state_id) {
+void frag_add_out(NFAFragment *f, u32 state_id) {
     if (f->out_count >= f->out_capacity) {
         f->out_capacity *= 2;
         f->out_ids = realloc(f->out_ids, f->out_capacity * sizeof(u32));
@@ -119,24 +244,24 @@ static void frag_add_out(NFAFragment *f, u32 state_id) {
  * @brief Free memory allocated for a fragment
  * @param f Pointer to the fragment to free
  */
-static void frag_free(NFAFragment *f) {
+void frag_free(NFAFragment *f) {
     free(f->out_ids);
     f->out_ids = NULL;
     f->out_count = 0;
 }
 
 /**
- * @brief Create NFA fragment for a single character
- * @param c Character to match
- * @return Fragment with start -> c -> end
+ * @brief Create NFA fragment for a single symbol (character, '.' or class)
+ * @param node REG_CHAR or REG_CLASS node
+ * @return Fragment with start -> symbol -> end
+ * 
+ * A class of any size is a single transition labelled with its byte set.
  */
-static NFAFragment nfa_char(char c) {
+static NFAFragment nfa_symbol(RegexTreeNode *node) {
     u32 s = create_state(0);
     u32 e = create_state(0);
     
-    /* Convert '.' to special wildcard character */
-    u8 transition_char = (c == '.') ? NFA_DOT_CHAR : c;
-    add_transition(s, transition_char, e);
+    add_transition(s, nfa_symbol_label(node), e);
     
     NFAFragment frag = frag_create(s);
     frag_add_out(&frag, e);
@@ -144,6 +269,30 @@ static NFAFragment nfa_char(char c) {
     return frag;
 }
 
+/**
+ * @brief Create NFA fragment for a literal run
+ * @param str Characters to match, in order
+ * @param len Number of characters
+ * @return Fragment with start -> str[0] -> ... -> str[len - 1] -> end
+ * 
+ * One state per character plus the end state, no epsilon glue.
+ */
+static NFAFragment nfa_string(char *str, u32 len) {
+    u32 s = create_state(0);
+    u32 prev = s;
+    
+    for (u32 i = 0; i < len; i++) {
+        u32 next = create_state(0);
+        add_transition(prev, (u8)str[i], next);
+        prev = next;
+    }
+    
+    NFAFragment frag = frag_create(s);
+    frag_add_out(&frag, prev);
+    
+    return frag;
+}
+
 /**
  * @brief Concatenate two NFA fragments (AB)
  * @param left Left fragment (A)
@@ -155,16 +304,14 @@ static NFAFragment nfa_char(char c) {
 static NFAFragment nfa_concat(NFAFragment left, NFAFragment right) {
     /* Connect all outputs of left to the start of right */
     for (u32 i = 0; i < left.out_count; i++) {
-        add_transition(left.out_ids[i], 0, right.start_id);
+        add_transition(left.out_ids[i], NFA_EPSILON, right.start_id);
     }
     
-    NFAFragment result = frag_create(left.start_id);
-    for (u32 i = 0; i < right.out_count; i++) {
-        frag_add_out(&result, right.out_ids[i]);
-    }
+    /* The outputs of right become the outputs of the result, no copy needed */
+    NFAFragment result = right;
+    result.start_id = left.start_id;
     
     frag_free(&left);
-    frag_free(&right);
     
     return result;
 }
@@ -181,20 +328,17 @@ static NFAFragment nfa_alt(NFAFragment left, NFAFragment right) {
     u32 start = create_state(0);
     
     /* Epsilon transitions to both branches */
-    add_transition(start, 0, left.start_id);
-    add_transition(start, 0, right.start_id);
+    add_transition(start, NFA_EPSILON, left.start_id);
+    add_transition(start, NFA_EPSILON, right.start_id);
     
-    NFAFragment result = frag_create(start);
-    
-    /* All outputs from both branches become fragment outputs */
-    for (u32 i = 0; i < left.out_count; i++) {
-        frag_add_out(&result, left.out_ids[i]);
-    }
+    /* All outputs from both branches become fragment outputs,
+     * right ones are appended to left so long alternations stay linear */
+    NFAFragment result = left;
+    result.start_id = start;
     for (u32 i = 0; i < right.out_count; i++) {
         frag_add_out(&result, right.out_ids[i]);
     }
     
-    frag_free(&left);
     frag_free(&right);
     
     return result;
@@ -213,13 +357,13 @@ static NFAFragment nfa_star(NFAFragment frag) {
     u32 end = create_state(0);
     
     /* Epsilon: start -> frag.start | start -> end */
-    add_transition(start, 0, frag.start_id);
-    add_transition(start, 0, end);
+    add_transition(start, NFA_EPSILON, frag.start_id);
+    add_transition(start, NFA_EPSILON, end);
     
     /* All outputs: -> frag.start (loop) | -> end (exit) */
     for (u32 i = 0; i < frag.out_count; i++) {
-        add_transition(frag.out_ids[i], 0, frag.start_id);
-        add_transition(frag.out_ids[i], 0, end);
+        add_transition(frag.out_ids[i], NFA_EPSILON, frag.start_id);
+        add_transition(frag.out_ids[i], NFA_EPSILON, end);
     }
     
     NFAFragment result = frag_create(start);
@@ -241,8 +385,8 @@ static NFAFragment nfa_plus(NFAFragment frag) {
     
     /* All outputs: -> frag.start (loop) | -> end (exit) */
     for (u32 i = 0; i < frag.out_count; i++) {
-        add_transition(frag.out_ids[i], 0, frag.start_id);
-        add_transition(frag.out_ids[i], 0, end);
+        add_transition(frag.out_ids[i], NFA_EPSILON, frag.start_id);
+        add_transition(frag.out_ids[i], NFA_EPSILON, end);
     }
     
     NFAFragment result = frag_create(frag.start_id);
@@ -263,11 +407,11 @@ static NFAFragment nfa_optional(NFAFragment frag) {
     u32 start = create_state(0);
     u32 end = create_state(0);
     
-    add_transition(start, 0, frag.start_id);
-    add_transition(start, 0, end);
+    add_transition(start, NFA_EPSILON, frag.start_id);
+    add_transition(start, NFA_EPSILON, end);
     
     for (u32 i = 0; i < frag.out_count; i++) {
-        add_transition(frag.out_ids[i], 0, end);
+        add_transition(frag.out_ids[i], NFA_EPSILON, end);
     }
     
     NFAFragment result = frag_create(start);
@@ -277,62 +421,287 @@ static NFAFragment nfa_optional(NFAFragment frag) {
     return result;
 }
 
-static NFAFragment nfa_class(ClassDef *class) {
-    NFAFragment frag = frag_create(create_state(0));
-    for (u32 i = 1; i < 128; i++) {
-        if (!class->reverse_match && bitmap_is_set(&class->char_bitmap, i)) {
-            u32 s = create_state(0);
-            u32 e = create_state(0);
-            INFO("Adding transition for char (%c)\n", i);
-            add_transition(s, (char)i, e);
-            add_transition(frag.start_id, 0, s);
-            frag_add_out(&frag, e);
-        } else if (class->reverse_match && !bitmap_is_set(&class->char_bitmap, i)) {
-            u32 s = create_state(0);
-            u32 e = create_state(0);
-            INFO("Adding transition REVERSE for char (%c)\n", i);
-            add_transition(s, (char)i, e);
-            add_transition(frag.start_id, 0, s);
-            frag_add_out(&frag, e);
+/**
+ * @brief Bounded repetition of a single symbol (a{n,m}, [0-9]{1,64}, .{0,200})
+ * @param node REG_CHAR or REG_CLASS node
+ * @return Fragment s0 -x-> s1 -x-> ... -x-> sk, every si with i >= min is an output
+ * 
+ * One state per count with direct symbol transitions, no epsilon: the
+ * chain is already the minimal automaton of x{n,m}. For {n,} the last
+ * state loops on the symbol.
+ */
+static NFAFragment nfa_repeat_symbol(RegexTreeNode *node) {
+    u32 min = node->rep_min;
+    u32 max = node->rep_max;
+    u32 label = nfa_symbol_label(node);
+    u32 count = (max == REPEAT_INFINITE) ? min : max;
+    u32 prev = create_state(0);
+    
+    NFAFragment frag = frag_create(prev);
+    if (min == 0) frag_add_out(&frag, prev);
+    
+    for (u32 i = 1; i <= count; i++) {
+        u32 next = create_state(0);
+        add_transition(prev, label, next);
+        if (i >= min) frag_add_out(&frag, next);
+        prev = next;
+    }
+    if (max == REPEAT_INFINITE) {
+        add_transition(prev, label, prev);
+    }
+    return frag;
+}
+
+/**
+ * @brief Copy a built fragment
+ * @param frag Fragment to copy
+ * @param lo Mark taken before building frag
+ * @param hi Mark taken after building frag
+ * @return The copy, made of new states hi.state - lo.state states further
+ * 
+ * A fragment under construction only has transitions inside its own
+ * state range, the copy is a plain offset of every state id.
+ */
+static NFAFragment nfa_clone(NFAFragment *frag, NFAMark lo, NFAMark hi) {
+    u32 offset = g_nfa.state_count - lo.state;
+    
+    for (u32 s = lo.state; s < hi.state; s++) {
+        create_state(g_nfa.states[s].is_final);
+    }
+    for (u32 e = lo.edge; e < hi.edge; e++) {
+        NFAEdge edge = g_nfa.edges[e];
+        add_transition(edge.from + offset, edge.t.label, edge.t.to_id + offset);
+    }
+    
+    NFAFragment copy = frag_create(frag->start_id + offset);
+    for (u32 i = 0; i < frag->out_count; i++) {
+        frag_add_out(&copy, frag->out_ids[i] + offset);
+    }
+    return copy;
+}
+
+/**
+ * @brief Apply a bounded repetition {min,max} to a fragment
+ * @param frag Fragment of x, built since lo
+ * @param lo Mark taken before building frag
+ * @param min Minimum count
+ * @param max Maximum count or REPEAT_INFINITE
+ * @return Fragment of x{min,max}
+ * 
+ * The copies of x are cloned from the built fragment instead of walking
+ * the subtree again, then chained: x x ... x for the mandatory part and
+ * the outputs of every copy from the min-th one are outputs of the result,
+ * which is x{2,4} = xx(x(x)?)? with no extra state. With no maximum the
+ * last copy loops like x+.
+ */
+static NFAFragment nfa_repeat(NFAFragment frag, NFAMark lo, u32 min, u32 max) {
+    NFAMark hi = nfa_mark();
+    u32 copies = (max == REPEAT_INFINITE) ? min : max;
+    
+    NFAFragment *parts = malloc(copies * sizeof(NFAFragment));
+    if (!parts) {
+        ERR("Memory allocation failed for repetition\n");
+        exit(1);
+    }
+    /* Clone everything before any glue transition is added to the template */
+    parts[0] = frag;
+    for (u32 i = 1; i < copies; i++) {
+        parts[i] = nfa_clone(&frag, lo, hi);
+    }
+    
+    NFAFragment result;
+    if (min == 0) {
+        u32 start = create_state(0);
+        add_transition(start, NFA_EPSILON, parts[0].start_id);
+        result = frag_create(start);
+        frag_add_out(&result, start);
+    } else {
+        result = frag_create(parts[0].start_id);
+    }
+    
+    for (u32 i = 0; i < copies; i++) {
+        if (i > 0) {
+            for (u32 j = 0; j < parts[i - 1].out_count; j++) {
+                add_transition(parts[i - 1].out_ids[j], NFA_EPSILON, parts[i].start_id);
+            }
+        }
+        if (i + 1 >= min) {
+            for (u32 j = 0; j < parts[i].out_count; j++) {
+                frag_add_out(&result, parts[i].out_ids[j]);
+            }
+        }
+    }
+    
+    if (max == REPEAT_INFINITE) {
+        NFAFragment *last = &parts[copies - 1];
+        for (u32 j = 0; j < last->out_count; j++) {
+            add_transition(last->out_ids[j], NFA_EPSILON, last->start_id);
         }
     }
-    return (frag);
+    
+    for (u32 i = 0; i < copies; i++) {
+        frag_free(&parts[i]);
+    }
+    free(parts);
+    return result;
 }
 
 /**
- * @brief Convert a regex parse tree to NFA using Thompson's construction
- * @param node Root of the regex parse tree
- * @return NFA fragment representing the regex
+ * @brief Copy of a built fragment of a shared node (refs > 1)
  * 
- * Recursively builds the NFA bottom-up from the parse tree,
- * applying operators after building the base fragments.
+ * Taken when the node fragment is complete, before its parent adds glue
+ * transitions to it, with state ids relative to its first state.
  */
-NFAFragment thompson_from_tree(RegexTreeNode *node) {
-    if (!node) {
-        fprintf(stderr, "ERROR: Null node\n");
-        return frag_create(-1);
+typedef struct {
+    u32         state_count;    /* States of the fragment */
+    u32         start;          /* Relative start state */
+    u32         *outs;          /* Relative output states */
+    u32         out_count;
+    NFAEdge     *edges;         /* Transitions, from and to_id relative */
+    u32         edge_count;
+} NFATemplate;
+
+/**
+ * @brief Pending node of the iterative Thompson construction
+ */
+typedef struct {
+    RegexTreeNode   *node;
+    s8              children_done;  /* Children fragments are on the fragment stack */
+    NFAMark         first;          /* Mark taken before building the node */
+} ThompsonFrame;
+
+/**
+ * @brief Record the fragment of a shared node, built since lo
+ */
+static void template_save(NFATemplate *t, NFAFragment *frag, NFAMark lo) {
+    NFAMark hi = nfa_mark();
+    
+    t->state_count = hi.state - lo.state;
+    t->start = frag->start_id - lo.state;
+    t->out_count = frag->out_count;
+    t->edge_count = hi.edge - lo.edge;
+    t->outs = malloc(GET_MAX(frag->out_count, 1) * sizeof(u32));
+    t->edges = malloc(GET_MAX(t->edge_count, 1) * sizeof(NFAEdge));
+    if (!t->outs || !t->edges) {
+        ERR("Memory allocation failed for NFA template\n");
+        exit(1);
+    }
+    for (u32 i = 0; i < frag->out_count; i++) {
+        t->outs[i] = frag->out_ids[i] - lo.state;
+    }
+    for (u32 e = 0; e < t->edge_count; e++) {
+        t->edges[e] = g_nfa.edges[lo.edge + e];
+        t->edges[e].from -= lo.state;
+        t->edges[e].t.to_id -= lo.state;
+    }
+}
+
+/**
+ * @brief Instantiate a recorded fragment in new states, without walking the subtree
+ */
+static NFAFragment template_instantiate(NFATemplate *t) {
+    u32 lo = g_nfa.state_count;
+    
+    for (u32 s = 0; s < t->state_count; s++) {
+        create_state(0);
+    }
+    for (u32 e = 0; e < t->edge_count; e++) {
+        add_transition(t->edges[e].from + lo, t->edges[e].t.label, t->edges[e].t.to_id + lo);
     }
     
+    NFAFragment frag = frag_create(t->start + lo);
+    for (u32 i = 0; i < t->out_count; i++) {
+        frag_add_out(&frag, t->outs[i] + lo);
+    }
+    return frag;
+}
+
+/**
+ * @brief Memo of the shared nodes fragments, indexed by node id
+ */
+typedef struct {
+    NFATemplate     **items;
+    u32             capacity;
+    u32             reused;     /* Fragments instantiated from a template */
+} TemplateMemo;
+
+static NFATemplate *memo_get(TemplateMemo *memo, RegexTreeNode *node) {
+    if (node->refs < 2 || node->id >= memo->capacity) return (NULL);
+    return (memo->items[node->id]);
+}
+
+static void memo_put(TemplateMemo *memo, RegexTreeNode *node, NFAFragment *frag, NFAMark lo) {
+    if (node->id >= memo->capacity) {
+        u32 capacity = GET_MAX(memo->capacity * 2, 64);
+        while (capacity <= node->id) capacity *= 2;
+        memo->items = realloc(memo->items, capacity * sizeof(NFATemplate *));
+        if (!memo->items) {
+            ERR("Memory allocation failed for NFA templates\n");
+            exit(1);
+        }
+        memset(memo->items + memo->capacity, 0, (capacity - memo->capacity) * sizeof(NFATemplate *));
+        memo->capacity = capacity;
+    }
+    NFATemplate *t = malloc(sizeof(NFATemplate));
+    if (!t) {
+        ERR("Memory allocation failed for NFA template\n");
+        exit(1);
+    }
+    template_save(t, frag, lo);
+    memo->items[node->id] = t;
+}
+
+static void memo_free(TemplateMemo *memo) {
+    for (u32 i = 0; i < memo->capacity; i++) {
+        NFATemplate *t = memo->items[i];
+        if (!t) continue;
+        free(t->outs);
+        free(t->edges);
+        free(t);
+    }
+    free(memo->items);
+}
+
+/**
+ * @brief Build the fragment of one node once its children fragments are built
+ * @param node Node to build
+ * @param first Mark taken before building the node
+ * @param frags Fragment stack, children are popped and the result pushed
+ * @param frag_count Number of fragments on the stack
+ */
+static void thompson_build_node(RegexTreeNode *node, NFAMark first, NFAFragment *frags, u32 *frag_count) {
     NFAFragment frag;
     
+    if (node->op == OP_REPEAT && (node->type == REG_CHAR || node->type == REG_CLASS)) {
+        frags[(*frag_count)++] = nfa_repeat_symbol(node);
+        return;
+    }
+    
     switch (node->type) {
         case REG_CHAR:
-            frag = nfa_char(node->c);
+        case REG_CLASS:
+            frag = nfa_symbol(node);
             break;
             
         case REG_CONCAT:
-            frag = nfa_concat(thompson_from_tree(node->left), thompson_from_tree(node->right));
+            frag = nfa_concat(frags[*frag_count - 2], frags[*frag_count - 1]);
+            *frag_count -= 2;
             break;
             
         case REG_ALT:
-            frag = nfa_alt(thompson_from_tree(node->left), thompson_from_tree(node->right));
+            frag = nfa_alt(frags[*frag_count - 2], frags[*frag_count - 1]);
+            *frag_count -= 2;
             break;
-        case REG_CLASS:
-            frag = nfa_class(node->class);
+        case REG_GROUP:
+            frag = frags[--(*frag_count)];
+            break;
+        case REG_STRING:
+            frag = nfa_string(node->str, node->str_len);
             break;
         default:
             fprintf(stderr, "ERROR: Unknown node type %d\n", node->type);
-            return frag_create(-1);
+            frag = frag_create(-1);
+            break;
     }
     
     /* Apply postfix operators */
@@ -340,26 +709,261 @@ NFAFragment thompson_from_tree(RegexTreeNode *node) {
         case OP_STAR:     frag = nfa_star(frag);     break;
         case OP_PLUS:     frag = nfa_plus(frag);     break;
         case OP_OPTIONAL: frag = nfa_optional(frag); break;
+        case OP_REPEAT:   frag = nfa_repeat(frag, first, node->rep_min, node->rep_max); break;
         case OP_NONE:     break;
     }
     
-    return (frag);
+    frags[(*frag_count)++] = frag;
+}
+
+/**
+ * @brief Convert a regex parse tree to NFA using Thompson's construction
+ * @param root Root of the regex parse tree
+ * @return NFA fragment representing the regex
+ * 
+ * Builds the NFA bottom-up with a post-order walk on an explicit stack:
+ * children fragments are pushed on a fragment stack and combined by
+ * their parent, so very deep trees do not consume call stack.
+ * After regex_hashcons() the tree is a DAG: a node shared by several
+ * parents is built once, the next occurrences copy its recorded fragment.
+ */
+NFAFragment thompson_from_tree(RegexTreeNode *root) {
+    if (!root) {
+        fprintf(stderr, "ERROR: Null node\n");
+        return frag_create(-1);
+    }
+    
+    u32             capacity = 64;
+    u32             count = 0;
+    ThompsonFrame   *stack = malloc(capacity * sizeof(ThompsonFrame));
+    u32             frag_count = 0;
+    u32             frag_capacity = 64;
+    NFAFragment     *frags = malloc(frag_capacity * sizeof(NFAFragment));
+    TemplateMemo    memo = {0};
+    
+    if (!stack || !frags) {
+        ERR("Memory allocation failed for Thompson stacks\n");
+        exit(1);
+    }
+    
+    stack[count++] = (ThompsonFrame){root, 0, {0, 0}};
+    while (count > 0) {
+        ThompsonFrame *f = &stack[count - 1];
+        NFATemplate *t = f->children_done ? NULL : memo_get(&memo, f->node);
+        
+        if (f->children_done || t) {
+            RegexTreeNode *node = f->node;
+            NFAMark first = f->first;
+            count--;
+            if (frag_count >= frag_capacity) {
+                frag_capacity *= 2;
+                frags = realloc(frags, frag_capacity * sizeof(NFAFragment));
+                if (!frags) {
+                    ERR("Memory allocation failed for Thompson stacks\n");
+                    exit(1);
+                }
+            }
+            if (t) {
+                frags[frag_count++] = template_instantiate(t);
+                memo.reused++;
+                continue;
+            }
+            thompson_build_node(node, first, frags, &frag_count);
+            if (node->refs > 1) {
+                memo_put(&memo, node, &frags[frag_count - 1], first);
+            }
+            continue;
+        }
+        
+        f->children_done = 1;
+        f->first = nfa_mark();
+        RegexTreeNode *left = f->node->left;
+        RegexTreeNode *right = f->node->right;
+        
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(ThompsonFrame));
+            if (!stack) {
+                ERR("Memory allocation failed for Thompson stacks\n");
+                exit(1);
+            }
+        }
+        /* Right pushed first so the left fragment is built (and numbered) first */
+        if (right) stack[count++] = (ThompsonFrame){right, 0, {0, 0}};
+        if (left) stack[count++] = (ThompsonFrame){left, 0, {0, 0}};
+    }
+    
+    NFAFragment result = frags[0];
+    INFO("Thompson: %u shared fragments copied\n", memo.reused);
+    memo_free(&memo);
+    free(stack);
+    free(frags);
+    return (result);
+}
+
+/**
+ * @brief Mark the output states of the fragments as final
+ * @param first_rule Rule accepted by frags[0], the next ones follow
+ *
+ * A state shared by two rules keeps the earliest. The fragments are freed.
+ */
+static void nfa_mark_rules(NFAFragment *frags, u32 count, u32 first_rule) {
+    for (u32 r = 0; r < count; r++) {
+        for (u32 i = 0; i < frags[r].out_count; i++) {
+            NFAState *state = &g_nfa.states[frags[r].out_ids[i]];
+            state->is_final = nfa_rule_first(state->is_final, first_rule + r);
+        }
+        frag_free(&frags[r]);
+    }
 }
 
 /**
  * @brief Finalize the NFA by marking final states
- * @param frag The final fragment to finalize
+ * @param frags Fragment of every rule, in priority order
+ * @param count Number of rules
  * 
- * Sets the global NFA start state and marks all fragment
- * output states as accepting/final states.
+ * Sets the global NFA start state, marks the output states of rule i
+ * as accepting rule i + 1, freezes the transitions and precomputes the
+ * epsilon closures. Several rules are united under a new start state
+ * with an epsilon edge to each rule, so one automaton scans them all.
  */
-void nfa_finalize(NFAFragment *frag) {
-    g_nfa.start_id = frag->start_id;
+void nfa_finalize(NFAFragment *frags, u32 count) {
+    if (count == 1) {
+        g_nfa.start_id = frags[0].start_id;
+    } else {
+        g_nfa.start_id = create_state(NFA_NO_RULE);
+        for (u32 r = 0; r < count; r++) {
+            add_transition(g_nfa.start_id, NFA_EPSILON, frags[r].start_id);
+        }
+    }
+    nfa_mark_rules(frags, count, 1);
     
-    /* Mark all output states as final */
-    for (u32 i = 0; i < frag->out_count; i++) {
-        g_nfa.states[frag->out_ids[i]].is_final = 1;
+    nfa_freeze();
+    nfa_compute_closures(0);
+}
+
+/**
+ * @brief Open a finalized NFA to construction again
+ *
+ * The rows go back to the edge list. States and edges built afterwards
+ * come after the existing ones, whose ids and transitions do not change:
+ * the closures are kept for nfa_append.
+ */
+void nfa_thaw(void) {
+    u32 n = g_nfa.state_count;
+
+    g_nfa.edge_count = g_nfa.eps_offsets[n] + g_nfa.sym_offsets[n];
+    g_nfa.edge_capacity = GET_MAX(g_nfa.edge_count * 2, DEFAULT_NFA_EDGE_CAPACITY);
+    g_nfa.edges = malloc(g_nfa.edge_capacity * sizeof(NFAEdge));
+    if (!g_nfa.edges) {
+        ERR("Memory allocation failed for NFA transitions\n");
+        exit(1);
+    }
+
+    u32 e = 0;
+    for (u32 i = 0; i < n; i++) {
+        for (u32 j = g_nfa.eps_offsets[i]; j < g_nfa.eps_offsets[i + 1]; j++) {
+            g_nfa.edges[e++] = (NFAEdge){i, {NFA_EPSILON, g_nfa.eps_to[j]}};
+        }
+        for (u32 j = g_nfa.sym_offsets[i]; j < g_nfa.sym_offsets[i + 1]; j++) {
+            g_nfa.edges[e++] = (NFAEdge){i, g_nfa.sym_trans[j]};
+        }
+    }
+
+    /* The simulation scratch sets are sized from the state count */
+    match_nfa_free();
+    free(g_nfa.eps_offsets);
+    free(g_nfa.eps_to);
+    free(g_nfa.sym_offsets);
+    free(g_nfa.sym_trans);
+    g_nfa.eps_offsets = NULL;
+    g_nfa.eps_to = NULL;
+    g_nfa.sym_offsets = NULL;
+    g_nfa.sym_trans = NULL;
+}
+
+/**
+ * @brief Add rules to a thawed NFA, after its existing rules
+ * @param frags Fragment of every new rule, in priority order
+ * @param count Number of new rules
+ * @param first_rule Rule accepted by frags[0]
+ *
+ * A new start state leads to the previous start and to every fragment,
+ * the previous start may have incoming edges once reduced. The previous
+ * states keep their ids and reach no new state: the DFA state of a set
+ * of previous states only is still valid (dfa_append).
+ */
+void nfa_append(NFAFragment *frags, u32 count, u32 first_rule) {
+    u32 previous = g_nfa.start_id;
+
+    g_nfa.start_id = create_state(NFA_NO_RULE);
+    add_transition(g_nfa.start_id, NFA_EPSILON, previous);
+    for (u32 r = 0; r < count; r++) {
+        add_transition(g_nfa.start_id, NFA_EPSILON, frags[r].start_id);
+    }
+    nfa_mark_rules(frags, count, first_rule);
+
+    nfa_freeze();
+    nfa_compute_closures(g_nfa.closure_count);
+}
+
+/**
+ * @brief Lay the construction edge list out in compressed sparse rows
+ * 
+ * Counting sort of the edges by source state, keeping their creation
+ * order, into two row sets: epsilon destinations and labelled
+ * transitions. The closure and the simulation loops then read one
+ * contiguous slice per state instead of chasing a pointer per state.
+ */
+void nfa_freeze(void) {
+    u32 n = g_nfa.state_count;
+    u32 eps_count = 0;
+    
+    g_nfa.eps_offsets = calloc(n + 1, sizeof(u32));
+    g_nfa.sym_offsets = calloc(n + 1, sizeof(u32));
+    if (!g_nfa.eps_offsets || !g_nfa.sym_offsets) {
+        ERR("Memory allocation failed for NFA rows\n");
+        exit(1);
+    }
+    
+    /* Row sizes, shifted by one so the prefix sum gives the row starts */
+    for (u32 e = 0; e < g_nfa.edge_count; e++) {
+        NFAEdge *edge = &g_nfa.edges[e];
+        if (edge->t.label == NFA_EPSILON) {
+            g_nfa.eps_offsets[edge->from + 1]++;
+            eps_count++;
+        } else {
+            g_nfa.sym_offsets[edge->from + 1]++;
+        }
+    }
+    for (u32 i = 0; i < n; i++) {
+        g_nfa.eps_offsets[i + 1] += g_nfa.eps_offsets[i];
+        g_nfa.sym_offsets[i + 1] += g_nfa.sym_offsets[i];
+    }
+    
+    g_nfa.eps_to = malloc(GET_MAX(eps_count, 1) * sizeof(u32));
+    g_nfa.sym_trans = malloc(GET_MAX(g_nfa.edge_count - eps_count, 1) * sizeof(Transition));
+    u32 *eps_fill = malloc((n + 1) * sizeof(u32));
+    u32 *sym_fill = malloc((n + 1) * sizeof(u32));
+    if (!g_nfa.eps_to || !g_nfa.sym_trans || !eps_fill || !sym_fill) {
+        ERR("Memory allocation failed for NFA rows\n");
+        exit(1);
+    }
+    memcpy(eps_fill, g_nfa.eps_offsets, (n + 1) * sizeof(u32));
+    memcpy(sym_fill, g_nfa.sym_offsets, (n + 1) * sizeof(u32));
+    
+    for (u32 e = 0; e < g_nfa.edge_count; e++) {
+        NFAEdge *edge = &g_nfa.edges[e];
+        if (edge->t.label == NFA_EPSILON) {
+            g_nfa.eps_to[eps_fill[edge->from]++] = edge->t.to_id;
+        } else {
+            g_nfa.sym_trans[sym_fill[edge->from]++] = edge->t;
+        }
     }
     
-    frag_free(frag);
+    free(eps_fill);
+    free(sym_fill);
+    free(g_nfa.edges);
+    g_nfa.edges = NULL;
+    g_nfa.edge_capacity = 0;
 }
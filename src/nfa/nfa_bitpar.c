@@ -0,0 +1,280 @@
+#include "../../include/nfa.h"
+#include "../../include/bitmap.h"
+
+/* Largest position automaton handled, in bits */
+#define BITPAR_MAX_POSITIONS 512
+
+/* Words of a position set at most */
+#define BITPAR_MAX_WORDS (BITPAR_MAX_POSITIONS / 64)
+
+/**
+ * @brief Shift-And style tables over the positions of the NFA
+ */
+typedef struct {
+    u64     *byte_mask;     /* B[c]: 256 rows of words, positions entered on byte c */
+    u64     *follow;        /* chunks * 256 rows of words, see bitpar_build() */
+    u64     *final;         /* Accepting positions */
+    u32     *rule;          /* Rule accepted at every position */
+    u64     *start;         /* Initial position set */
+    u32     positions;
+    u32     words;          /* u64 words of a position set */
+    u32     chunks;         /* 8-bit chunks of a position set */
+} BitParallel;
+
+static BitParallel *__get_bitpar(void) {
+    static BitParallel bitpar = {0};
+    return (&bitpar);
+}
+
+#define g_bitpar (*__get_bitpar())
+
+/**
+ * @brief Position of the engine: an NFA state entered on one label
+ */
+typedef struct {
+    u32     state;
+    u32     label;
+} BitParPosition;
+
+static int position_cmp(const void *a, const void *b) {
+    const BitParPosition *x = a;
+    const BitParPosition *y = b;
+
+    if (x->state != y->state) return (x->state < y->state ? -1 : 1);
+    if (x->label != y->label) return (x->label < y->label ? -1 : 1);
+    return (0);
+}
+
+/**
+ * @brief Find the position (state, label), positions are sorted
+ */
+static u32 position_find(BitParPosition *pos, u32 count, u32 state, u32 label) {
+    BitParPosition  key = {state, label};
+    BitParPosition  *found = bsearch(&key, pos, count, sizeof(BitParPosition), position_cmp);
+
+    return ((u32)(found - pos));
+}
+
+FT_INLINE void mask_set(u64 *mask, u32 bit) {
+    mask[bit / U64_BITS_NB] |= 1ULL << (bit % U64_BITS_NB);
+}
+
+/**
+ * @brief Build the bit-parallel engine from the epsilon-free NFA
+ * @return TRUE if the engine is ready, FALSE if the NFA does not fit
+ *
+ * Glushkov form: every position is entered on a single label, so one
+ * step is D' = Follow(D) & B[c]. A reduced NFA state can be entered on
+ * several labels, it is split into one position per (state, label) and
+ * the start state is position 0. The tables are:
+ * - B[c], the positions whose label holds byte c
+ * - follow[k][v], the union of the follow sets of the positions set in
+ *   the value v of the 8-bit chunk k of D
+ * so one input byte costs one word-wide OR per non-empty chunk of D
+ * and one AND, on BITPAR_MAX_WORDS words at most (auto-vectorised).
+ */
+s8 bitpar_build(void) {
+    bitpar_free();
+
+    if (g_nfa.eps_offsets[g_nfa.state_count] != 0) {
+        ERR("Bit-parallel engine needs an epsilon-free NFA (reduction or -g)\n");
+        return (FALSE);
+    }
+
+    u32             edge_count = g_nfa.sym_offsets[g_nfa.state_count];
+    BitParPosition  *pos = malloc((edge_count + 1) * sizeof(BitParPosition));
+    u32             count = 0;
+
+    if (!pos) {
+        ERR("Memory allocation failed for bit-parallel engine\n");
+        exit(1);
+    }
+
+    /* Positions: the start state, then every distinct (target, label) */
+    for (u32 j = 0; j < edge_count; j++) {
+        pos[count++] = (BitParPosition){g_nfa.sym_trans[j].to_id, g_nfa.sym_trans[j].label};
+    }
+    qsort(pos, count, sizeof(BitParPosition), position_cmp);
+    u32 unique = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (unique > 0 && position_cmp(&pos[i], &pos[unique - 1]) == 0) continue;
+        pos[unique++] = pos[i];
+    }
+    count = unique;
+
+    if (count + 1 > BITPAR_MAX_POSITIONS) {
+        INFO("Bit-parallel engine: %u positions, limit is %u\n", count + 1, BITPAR_MAX_POSITIONS);
+        free(pos);
+        return (FALSE);
+    }
+
+    u32 positions = count + 1;   /* position 0 is the start state */
+    u32 words = (positions + U64_BITS_NB - 1) / U64_BITS_NB;
+    u32 chunks = (positions + 7) / 8;
+
+    g_bitpar.positions = positions;
+    g_bitpar.words = words;
+    g_bitpar.chunks = chunks;
+    g_bitpar.byte_mask = calloc(256 * words, sizeof(u64));
+    g_bitpar.follow = calloc((size_t)chunks * 256 * words, sizeof(u64));
+    g_bitpar.final = calloc(words, sizeof(u64));
+    g_bitpar.rule = calloc(positions, sizeof(u32));
+    g_bitpar.start = calloc(words, sizeof(u64));
+    u64 *follow = calloc((size_t)positions * words, sizeof(u64));
+    if (!g_bitpar.byte_mask || !g_bitpar.follow || !g_bitpar.final || !g_bitpar.rule
+        || !g_bitpar.start || !follow) {
+        ERR("Memory allocation failed for bit-parallel engine\n");
+        exit(1);
+    }
+
+    mask_set(g_bitpar.start, 0);
+    for (u32 p = 0; p < positions; p++) {
+        u32 state = (p == 0) ? g_nfa.start_id : pos[p - 1].state;
+        g_bitpar.rule[p] = g_nfa.states[state].is_final;
+        if (g_bitpar.rule[p] != NFA_NO_RULE) mask_set(g_bitpar.final, p);
+    }
+    for (u32 p = 1; p < positions; p++) {
+        BitParPosition *bp = &pos[p - 1];
+        for (u32 c = 1; c < 256; c++) {
+            if (nfa_label_match(bp->label, c)) mask_set(&g_bitpar.byte_mask[c * words], p);
+        }
+    }
+
+    /* Follow set of every position: the positions its state leads to */
+    for (u32 p = 0; p < positions; p++) {
+        u32 state = (p == 0) ? g_nfa.start_id : pos[p - 1].state;
+        for (u32 j = g_nfa.sym_offsets[state]; j < g_nfa.sym_offsets[state + 1]; j++) {
+            Transition *t = &g_nfa.sym_trans[j];
+            mask_set(&follow[p * words], 1 + position_find(pos, count, t->to_id, t->label));
+        }
+    }
+
+    /* follow[k][v] = follow[k][v without its lowest bit] | follow(lowest bit) */
+    for (u32 k = 0; k < chunks; k++) {
+        u64 *table = &g_bitpar.follow[(size_t)k * 256 * words];
+        for (u32 v = 1; v < 256; v++) {
+            u32 low = __builtin_ctz(v);
+            u32 p = k * 8 + low;
+            u64 *dst = &table[v * words];
+            u64 *rest = &table[(v & (v - 1)) * words];
+            for (u32 w = 0; w < words; w++) {
+                dst[w] = rest[w] | (p < positions ? follow[p * words + w] : 0);
+            }
+        }
+    }
+
+    DBG("Bit-parallel engine: %u positions, %u words, %zu bytes of tables\n",
+         positions, words, ((size_t)chunks * 256 + 256 + 2) * words * sizeof(u64));
+    free(follow);
+    free(pos);
+    return (TRUE);
+}
+
+/**
+ * @brief Release the bit-parallel tables
+ */
+void bitpar_free(void) {
+    free(g_bitpar.byte_mask);
+    free(g_bitpar.follow);
+    free(g_bitpar.final);
+    free(g_bitpar.rule);
+    free(g_bitpar.start);
+    g_bitpar = (BitParallel){0};
+}
+
+/**
+ * @brief Earliest rule of the accepting positions of a set
+ */
+static u32 bitpar_rule(const u64 *set, u32 words) {
+    u32 rule = NFA_NO_RULE;
+
+    for (u32 w = 0; w < words; w++) {
+        u64 bits = set[w] & g_bitpar.final[w];
+        while (bits) {
+            rule = nfa_rule_first(rule, g_bitpar.rule[w * U64_BITS_NB + __builtin_ctzll(bits)]);
+            bits &= bits - 1;
+        }
+    }
+    return (rule);
+}
+
+/**
+ * @brief Longest match starting at input with the bit-parallel engine
+ * @return Longest match and its rule, rule NFA_NO_RULE if no match
+ */
+static LexMatch match_bitpar(char *input) {
+    u64         cur[BITPAR_MAX_WORDS];
+    u64         next[BITPAR_MAX_WORDS];
+    u32         words = g_bitpar.words;
+    char        *ptr = input;
+    LexMatch    match = {NFA_NO_RULE, 0};
+
+    memcpy(cur, g_bitpar.start, words * sizeof(u64));
+    match.rule = bitpar_rule(cur, words);
+
+    while (*ptr) {
+        u64 *b = &g_bitpar.byte_mask[(u8)*ptr * words];
+        u64 any = 0;
+
+        memset(next, 0, words * sizeof(u64));
+        for (u32 k = 0; k < g_bitpar.chunks; k++) {
+            u32 v = (cur[k / 8] >> ((k % 8) * 8)) & 0xff;
+            if (!v) continue;
+            u64 *f = &g_bitpar.follow[((size_t)k * 256 + v) * words];
+            for (u32 w = 0; w < words; w++) next[w] |= f[w];
+        }
+        for (u32 w = 0; w < words; w++) {
+            cur[w] = next[w] & b[w];
+            any |= cur[w];
+        }
+        if (!any) break;
+        ptr++;
+
+        u32 rule = bitpar_rule(cur, words);
+        if (rule != NFA_NO_RULE) match = (LexMatch){rule, ptr - input};
+    }
+    return (match);
+}
+
+/**
+ * @brief Find all matches anywhere in the input with the bit-parallel engine
+ * @param rules Regex of every rule, rules[r - 1] for rule r
+ * @param input Input string to search for matches
+ *
+ * Same scanning rules as match_nfa_anywhere (longest match, earliest
+ * rule, zero-length matches skipped), bitpar_build() must have succeeded.
+ */
+void match_bitpar_anywhere(char **rules, char *input) {
+    char *p = input;
+
+    while (*p) {
+        LexMatch match = match_bitpar(p);
+        if (match.len > 0) {
+            printf("BITPAR✅Match Rule: %s ", rules[match.rule - 1]);
+            fwrite(p, 1, match.len, stdout);
+            printf("\n");
+            p += match.len;
+        } else {
+            p++;
+        }
+    }
+}
+
+/**
+ * @brief Count the matches match_bitpar_anywhere would print, without printing
+ */
+u32 match_bitpar_count(char *input) {
+    char *p = input;
+    u32 count = 0;
+
+    while (*p) {
+        LexMatch match = match_bitpar(p);
+        if (match.len > 0) {
+            count++;
+            p += match.len;
+        } else {
+            p++;
+        }
+    }
+    return (count);
+}
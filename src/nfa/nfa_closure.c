@@ -0,0 +1,227 @@
+#include "../../include/nfa.h"
+#include "../../include/bitmap.h"
+
+/* Index of a state not reached yet by the SCC walk */
+#define SCC_UNVISITED ((u32)-1)
+
+/* Component of a state whose closure list was kept */
+#define SCC_KEPT ((u32)-2)
+
+/**
+ * @brief Pending state of the iterative Tarjan walk
+ */
+typedef struct {
+    u32     state;
+    u32     next_edge;      /* Next epsilon edge of state to follow */
+} SccFrame;
+
+/**
+ * @brief Closures of the components finished by the walk
+ *
+ * One list per component, in the order Tarjan finishes them: component k
+ * owns list[offsets[k]] to list[offsets[k + 1]]. Memory follows the
+ * closure sizes, there is no state_count x state_count matrix.
+ */
+typedef struct {
+    u32     *list;
+    u32     size;
+    u32     capacity;
+    u32     *offsets;       /* Components + 1 entries, at most state_count + 1 */
+    u32     *mark;          /* Last component whose list took each state */
+} SccClosures;
+
+static int u32_cmp(const void *a, const void *b) {
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+
+    return ((x > y) - (x < y));
+}
+
+/**
+ * @brief Make room for count more members in the component lists
+ */
+static void scc_reserve(SccClosures *c, u32 count) {
+    if (c->size + count <= c->capacity) return;
+    c->capacity = GET_MAX(c->capacity * 2, c->size + count);
+    c->list = realloc(c->list, (size_t)c->capacity * sizeof(u32));
+    if (!c->list) {
+        ERR("Memory allocation failed for epsilon closures\n");
+        exit(1);
+    }
+}
+
+/**
+ * @brief Add the members of a closure list missing from the current component
+ * @param from Offset of the list, in closure_list if kept, else in c->list
+ */
+static void scc_union(SccClosures *c, s8 kept, u32 from, u32 count, u32 scc_id) {
+    scc_reserve(c, count);
+
+    const u32 *src = kept ? &g_nfa.closure_list[from] : &c->list[from];
+    for (u32 k = 0; k < count; k++) {
+        if (c->mark[src[k]] == scc_id) continue;
+        c->mark[src[k]] = scc_id;
+        c->list[c->size++] = src[k];
+    }
+}
+
+/**
+ * @brief List the closure of a finished SCC
+ * @param members States of the SCC
+ * @param count Number of members
+ * @param scc_id Component id of the members
+ * @param comp Component id of every finished state
+ *
+ * Tarjan finishes a component after every component it reaches, so the
+ * lists of the epsilon successors outside the SCC are already final. The
+ * list is sorted, as a walk over a bitmap would give it.
+ */
+static void scc_close(SccClosures *c, u32 *members, u32 count, u32 scc_id, u32 *comp) {
+    u32 start = c->size;
+
+    scc_reserve(c, count);
+    for (u32 i = 0; i < count; i++) {
+        c->mark[members[i]] = scc_id;
+        c->list[c->size++] = members[i];
+    }
+    for (u32 i = 0; i < count; i++) {
+        u32 s = members[i];
+        for (u32 j = g_nfa.eps_offsets[s]; j < g_nfa.eps_offsets[s + 1]; j++) {
+            u32 t = g_nfa.eps_to[j];
+            if (comp[t] == scc_id) continue;
+            if (comp[t] == SCC_KEPT) {
+                scc_union(c, TRUE, g_nfa.closure_offsets[t], g_nfa.closure_offsets[t + 1] - g_nfa.closure_offsets[t], scc_id);
+            } else {
+                scc_union(c, FALSE, c->offsets[comp[t]], c->offsets[comp[t] + 1] - c->offsets[comp[t]], scc_id);
+            }
+        }
+    }
+    qsort(&c->list[start], c->size - start, sizeof(u32), u32_cmp);
+    c->offsets[scc_id + 1] = c->size;
+}
+
+/**
+ * @brief Lay the component lists out per state from first, as closure_list
+ */
+static void closure_lists(SccClosures *c, u32 *comp, u32 first) {
+    u32 n = g_nfa.state_count;
+
+    g_nfa.closure_offsets = realloc(first ? g_nfa.closure_offsets : NULL, (n + 1) * sizeof(u32));
+    if (!g_nfa.closure_offsets) {
+        ERR("Memory allocation failed for epsilon closures\n");
+        exit(1);
+    }
+    if (!first) g_nfa.closure_offsets[0] = 0;
+    for (u32 s = first; s < n; s++) {
+        g_nfa.closure_offsets[s + 1] = g_nfa.closure_offsets[s] + c->offsets[comp[s] + 1] - c->offsets[comp[s]];
+    }
+
+    g_nfa.closure_list = realloc(first ? g_nfa.closure_list : NULL,
+                                 GET_MAX(g_nfa.closure_offsets[n], 1) * sizeof(u32));
+    if (!g_nfa.closure_list) {
+        ERR("Memory allocation failed for epsilon closures\n");
+        exit(1);
+    }
+    for (u32 s = first; s < n; s++) {
+        memcpy(&g_nfa.closure_list[g_nfa.closure_offsets[s]], &c->list[c->offsets[comp[s]]],
+               (size_t)(g_nfa.closure_offsets[s + 1] - g_nfa.closure_offsets[s]) * sizeof(u32));
+    }
+}
+
+/**
+ * @brief Precompute the epsilon closure of the NFA states from first
+ * @param first States below it keep their closure, 0 to compute every one
+ *
+ * Called once the NFA is frozen. The epsilon graph is condensed into
+ * strongly connected components with an iterative Tarjan walk: all the
+ * states of a component (ex: the loop of x*) share one closure, which is
+ * the union of the closures of the components it reaches. Each component
+ * lists its closure once, then every state gets a copy in closure_list:
+ * memory is linear in the closure sizes, not quadratic in the states.
+ *
+ * nfa_append passes the closure_count of the previous NFA: those states
+ * reach no new one, their lists are final and stay in place. The walk
+ * treats them as finished components.
+ */
+void nfa_compute_closures(u32 first) {
+    u32         n = g_nfa.state_count;
+    u32         *index = malloc(GET_MAX(n, 1) * sizeof(u32));
+    u32         *low = malloc(GET_MAX(n, 1) * sizeof(u32));
+    u32         *comp = malloc(GET_MAX(n, 1) * sizeof(u32));
+    u32         *scc_stack = malloc(GET_MAX(n, 1) * sizeof(u32));
+    SccFrame    *calls = malloc(GET_MAX(n, 1) * sizeof(SccFrame));
+    SccClosures c = {0};
+
+    c.offsets = malloc(((size_t)n + 1) * sizeof(u32));
+    c.mark = malloc(GET_MAX(n, 1) * sizeof(u32));
+    if (!index || !low || !comp || !scc_stack || !calls || !c.offsets || !c.mark) {
+        ERR("Memory allocation failed for epsilon closures\n");
+        exit(1);
+    }
+    g_nfa.closure_words = GET_MAX((n + U64_BITS_NB - 1) / U64_BITS_NB, 1);
+    c.offsets[0] = 0;
+    for (u32 i = 0; i < n; i++) {
+        index[i] = i < first ? 0 : SCC_UNVISITED;
+        comp[i] = i < first ? SCC_KEPT : SCC_UNVISITED;
+        c.mark[i] = SCC_UNVISITED;
+    }
+
+    u32 next_index = 0;
+    u32 scc_count = 0;
+    u32 scc_top = 0;
+
+    for (u32 root = first; root < n; root++) {
+        if (index[root] != SCC_UNVISITED) continue;
+
+        u32 call_top = 0;
+        index[root] = low[root] = next_index++;
+        scc_stack[scc_top++] = root;
+        calls[call_top++] = (SccFrame){root, g_nfa.eps_offsets[root]};
+
+        while (call_top > 0) {
+            SccFrame *f = &calls[call_top - 1];
+            u32 v = f->state;
+
+            if (f->next_edge < g_nfa.eps_offsets[v + 1]) {
+                u32 w = g_nfa.eps_to[f->next_edge++];
+                if (index[w] == SCC_UNVISITED) {
+                    index[w] = low[w] = next_index++;
+                    scc_stack[scc_top++] = w;
+                    calls[call_top++] = (SccFrame){w, g_nfa.eps_offsets[w]};
+                } else if (comp[w] == SCC_UNVISITED) {
+                    /* w is still on the SCC stack */
+                    low[v] = GET_MIN(low[v], index[w]);
+                }
+                continue;
+            }
+
+            call_top--;
+            if (low[v] == index[v]) {
+                u32 start = scc_top;
+                do {
+                    start--;
+                    comp[scc_stack[start]] = scc_count;
+                } while (scc_stack[start] != v);
+                scc_close(&c, &scc_stack[start], scc_top - start, scc_count, comp);
+                scc_count++;
+                scc_top = start;
+            }
+            if (call_top > 0) {
+                u32 parent = calls[call_top - 1].state;
+                low[parent] = GET_MIN(low[parent], low[v]);
+            }
+        }
+    }
+
+    closure_lists(&c, comp, first);
+    g_nfa.closure_count = n;
+    DBG("Epsilon closures: %u states, %u components\n", n, scc_count);
+    free(index);
+    free(low);
+    free(comp);
+    free(scc_stack);
+    free(calls);
+    free(c.list);
+    free(c.offsets);
+    free(c.mark);
+}
@@ -30,19 +30,22 @@ void print_nfa_tree_recursive(u32 state_id, char* prefix, int is_last, u32 *visi
         printf("├── ");
         strcat(prefix, "│   ");
     }
-    printf("State s%d%s\n", s->id, s->is_final ? " [FINAL]" : "");
+    printf("State s%d", s->id);
+    if (s->is_final) printf(" [FINAL rule %u]", s->is_final);
+    printf("\n");
     
-    /* Print transitions */
-    u32 trans_count = s->trans_count;
+    /* Print transitions, epsilon row first */
+    u32 eps_count = g_nfa.eps_offsets[state_id + 1] - g_nfa.eps_offsets[state_id];
+    u32 trans_count = eps_count + g_nfa.sym_offsets[state_id + 1] - g_nfa.sym_offsets[state_id];
     for (u32 idx = 0; idx < trans_count; idx++) {
-        Transition *t = &s->trans[idx];
+        Transition eps = {NFA_EPSILON, 0};
+        Transition *t = &eps;
         
-        char buf[64];
-        if (t->c == 0) {
-            snprintf(buf, sizeof(buf), "ε");
-        } else {
-            snprintf(buf, sizeof(buf), "'%c'", t->c);
-        }
+        if (idx < eps_count) eps.to_id = g_nfa.eps_to[g_nfa.eps_offsets[state_id] + idx];
+        else t = &g_nfa.sym_trans[g_nfa.sym_offsets[state_id] + idx - eps_count];
+        
+        char buf[128];
+        nfa_label_display(t->label, buf, sizeof(buf));
         
         printf("%s", prefix);
         if (idx == trans_count - 1) {
@@ -76,6 +79,47 @@ void print_nfa_tree(void) {
     printf("\n");
 }
 
+/**
+ * @brief Print one byte of a set, printable or as \xNN
+ */
+static u32 byte_display(char *buf, u32 size, u32 c) {
+    if (c >= 33 && c < 127) return (snprintf(buf, size, "%c", c));
+    return (snprintf(buf, size, "\\x%02x", c));
+}
+
+/**
+ * @brief Format a transition label: ε, 'c' or a byte set like [0-9a-f]
+ * @param label Transition label
+ * @param buf Output buffer
+ * @param size Size of buf
+ */
+void nfa_label_display(u32 label, char *buf, u32 size) {
+    if (label == NFA_EPSILON) {
+        snprintf(buf, size, "ε");
+        return;
+    }
+    if (label < NFA_LABEL_SET_BASE) {
+        if (label >= 32 && label < 127) snprintf(buf, size, "'%c'", label);
+        else snprintf(buf, size, "'\\x%02x'", label);
+        return;
+    }
+
+    u32 len = snprintf(buf, size, "[");
+    for (u32 c = 1; c < 256 && len + 16 < size; c++) {
+        if (!nfa_label_match(label, c)) continue;
+
+        u32 last = c;
+        while (last + 1 < 256 && nfa_label_match(label, last + 1)) last++;
+        len += byte_display(buf + len, size - len, c);
+        if (last > c) {
+            len += snprintf(buf + len, size - len, "-");
+            len += byte_display(buf + len, size - len, last);
+        }
+        c = last;
+    }
+    snprintf(buf + len, size - len, "]");
+}
+
 /* Simple flat listing */
 void print_nfa(void) {
     printf("=== NFA with %d states ===\n", g_nfa.state_count);
@@ -83,15 +127,17 @@ void print_nfa(void) {
     
     for (u32 i = 0; i < g_nfa.state_count; i++) {
         NFAState *s = &g_nfa.states[i];
-        printf("s%d%s:", s->id, s->is_final ? " [FINAL]" : "");
+        printf("s%d", s->id);
+        if (s->is_final) printf(" [FINAL rule %u]", s->is_final);
+        printf(":");
 
-        for (u32 j = 0; j < s->trans_count; j++) {
-            char c = s->trans[j].c;
-            if (c == 0) {
-                printf(" --ε--> s%d", s->trans[j].to_id);
-            } else {
-                printf(" --'%c'--> s%d", c, s->trans[j].to_id);
-            }
+        for (u32 j = g_nfa.eps_offsets[i]; j < g_nfa.eps_offsets[i + 1]; j++) {
+            printf(" --ε--> s%d", g_nfa.eps_to[j]);
+        }
+        for (u32 j = g_nfa.sym_offsets[i]; j < g_nfa.sym_offsets[i + 1]; j++) {
+            char buf[128];
+            nfa_label_display(g_nfa.sym_trans[j].label, buf, sizeof(buf));
+            printf(" --%s--> s%d", buf, g_nfa.sym_trans[j].to_id);
         }
         printf("\n");
     }
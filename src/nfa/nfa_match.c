@@ -5,146 +5,142 @@
  * @brief Compute epsilon closure of a state set
  * @param states Bitmap of states to compute closure for
  * 
- * Iteratively adds all states reachable via epsilon transitions
- * until no new states can be added (fixed point).
+ * Union of the precomputed closures of the members. The members are
+ * read from a word before its closures are added, a state added to a
+ * later word is closed already and only costs a redundant union.
  */
 void epsilon_closure(Bitmap *states) {
-    int changed = 1;
-    while (changed) {
-        changed = 0;
-        for (u32 i = 0; i < g_nfa.state_count; i++) {
-            if (!bitmap_is_set(states, i)) continue;
-            
-            NFAState *s = &g_nfa.states[i];
-            for (u32 j = 0; j < s->trans_count; j++) {
-                if (s->trans[j].c == 0) {  /* epsilon transition */
-                    if (!bitmap_is_set(states, s->trans[j].to_id)) {
-                        // INFO("Set bit for state ID %d via epsilon from state ID %d\n", s->trans[j].to_id, s->id);
-                        bitmap_set(states, s->trans[j].to_id);
-                        changed = 1;
-                    }
-                }
-            }
+    for (u32 w = 0; w < states->size; w++) {
+        u64 bits = states->bits[w];
+        while (bits) {
+            nfa_closure_add(states, w * U64_BITS_NB + __builtin_ctzll(bits));
+            bits &= bits - 1;
         }
     }
 }
 
+/**
+ * @brief Scratch sets of the simulation, sized for the current NFA
+ */
+typedef struct {
+    SparseSet   current;
+    SparseSet   next;
+} NFASimulation;
 
-void bitmap_swap(Bitmap *dest, Bitmap *src) {
-    void *tmp = dest->bits;
+static NFASimulation *__get_nfa_sim(void) {
+    static NFASimulation sim = {0};
+    return (&sim);
+}
 
-    dest->bits = src->bits;
-    src->bits = tmp;
+#define g_nfa_sim (*__get_nfa_sim())
+
+/**
+ * @brief Release the simulation sets (called by nfa_free)
+ */
+void match_nfa_free(void) {
+    sparse_set_free(&g_nfa_sim.current);
+    sparse_set_free(&g_nfa_sim.next);
 }
 
 /**
  * @brief Match input string against the NFA
  * @param input Input string to match
- * @return Pointer to the position after the longest match, or NULL if no match
+ * @return Longest match and its rule, rule NFA_NO_RULE if no match
  * 
  * Uses subset construction to simulate NFA on the input string.
- * Tracks the longest accepting prefix found.
+ * Tracks the longest accepting prefix found, and the earliest rule
+ * accepting it. The active states are kept in sparse sets allocated once
+ * per NFA: clearing is O(1) and a step costs the active states and their
+ * transitions, not the NFA size.
  */
-static char *match_nfa(char *input) {
-    Bitmap current, next;
+LexMatch match_nfa(char *input) {
+    if (g_nfa_sim.current.capacity < g_nfa.state_count) {
+        match_nfa_free();
+        sparse_set_init(&g_nfa_sim.current, g_nfa.state_count);
+        sparse_set_init(&g_nfa_sim.next, g_nfa.state_count);
+    }
 
-    bitmap_init(&current, BITMAP_STATE_ARRAY_SIZE);
-    bitmap_init(&next, BITMAP_STATE_ARRAY_SIZE);
+    SparseSet *current = &g_nfa_sim.current;
+    SparseSet *next = &g_nfa_sim.next;
 
-    // bitmap_clear(&current);
-    bitmap_set(&current, g_nfa.start_id);
-    epsilon_closure(&current);
+    sparse_set_clear(current);
     
     char *ptr = input;
-    char *last_accept = NULL;
+    LexMatch match = {NFA_NO_RULE, 0};
     
     /* Check if initial state set contains a final state (empty match) */
-    for (u32 i = 0; i < g_nfa.state_count; i++) {
-        if (bitmap_is_set(&current, i) && g_nfa.states[i].is_final) {
-            last_accept = ptr;
-            break;
-        }
-    }
+    match.rule = nfa_closure_add_sparse(current, g_nfa.start_id);
     
     while (*ptr) {
-        bitmap_clear(&next);
+        u32 rule = NFA_NO_RULE;
+
+        sparse_set_clear(next);
         
         /* Transitions on current character */
-        for (u32 i = 0; i < g_nfa.state_count; i++) {
-            if (!bitmap_is_set(&current, i)) continue;
-            
-            NFAState *s = &g_nfa.states[i];
-            for (u32 j = 0; j < s->trans_count; j++) {
-                if (s->trans[j].c == NFA_DOT_CHAR || s->trans[j].c == *ptr) {
-                    bitmap_set(&next, s->trans[j].to_id);
+        for (u32 k = 0; k < current->count; k++) {
+            u32 i = current->dense[k];
+            for (u32 j = g_nfa.sym_offsets[i]; j < g_nfa.sym_offsets[i + 1]; j++) {
+                if (nfa_label_match(g_nfa.sym_trans[j].label, (u8)*ptr)) {
+                    rule = nfa_rule_first(rule, nfa_closure_add_sparse(next, g_nfa.sym_trans[j].to_id));
                 }
             }
         }
         
-        epsilon_closure(&next);
-        
         /* If no states reachable, stop */
-        int has_states = 0;
-        for (u32 i = 0; i < BITMAP_STATE_ARRAY_SIZE; i++) {
-            if (next.bits[i]) {
-                has_states = 1;
-                break;
-            }
-        }
-        if (!has_states) break;
-        
-        /* Check if any state is final (accepting) */
-        for (u32 i = 0; i < g_nfa.state_count; i++) {
-            if (bitmap_is_set(&next, i) && g_nfa.states[i].is_final) {
-                last_accept = ptr + 1;
-                break;
-            }
-        }
+        if (next->count == 0) break;
         
-        bitmap_swap(&current, &next);
-        // current = next;
+        sparse_set_swap(current, next);
         ptr++;
+
+        /* Check if any state is final (accepting) */
+        if (rule != NFA_NO_RULE) match = (LexMatch){rule, ptr - input};
     }
-    
-    /* Check if final state at end of input */
-    if (*ptr == '\0') {
-        for (u32 i = 0; i < g_nfa.state_count; i++) {
-            if (bitmap_is_set(&current, i) && g_nfa.states[i].is_final) {
-                last_accept = ptr;
-                break;
-            }
-        }
-    }
-    
-    free(current.bits);
-    free(next.bits);
 
-    return (last_accept);
+    return (match);
 }
 
 /**
  * @brief Find all matches of the NFA pattern anywhere in the input string
+ * @param rules Regex of every rule, rules[r - 1] for rule r
  * @param input Input string to search for matches
  * 
  * Repeatedly attempts to match starting from each position in the input,
- * printing all matches found. Skips zero-length matches to avoid infinite loops.
+ * printing all matches found with the rule they belong to. Skips
+ * zero-length matches to avoid infinite loops.
  */
-void match_nfa_anywhere(char *regex_str, char *input) {
+void match_nfa_anywhere(char **rules, char *input) {
     char *p = input;
     
     while (*p) {
-        char *match = match_nfa(p);
-        if (match) {
-            int len = match - p;
-            if (len == 0) { p++; continue;}  /* Skip zero-length matches */
-            printf("✅Match Rule: %s ", regex_str);
-            for (int i = 0; i < len; i++) {
-                putchar(p[i]);
-            }
-            printf("\n");
-            p = match;
+        LexMatch match = match_nfa(p);
+        if (match.len == 0) {
+            p++;    /* No match or zero-length match */
+            continue;
+        }
+        printf("✅Match Rule: %s ", rules[match.rule - 1]);
+        fwrite(p, 1, match.len, stdout);
+        printf("\n");
+        p += match.len;
+    }
+}
+
+/**
+ * @brief Count the matches match_nfa_anywhere would print, without printing
+ * @param input Input string to scan
+ * @return Number of non empty matches
+ */
+u32 match_nfa_count(char *input) {
+    char *p = input;
+    u32 count = 0;
+    
+    while (*p) {
+        LexMatch match = match_nfa(p);
+        if (match.len > 0) {
+            count++;
+            p += match.len;
         } else {
             p++;
         }
     }
+    return (count);
 }
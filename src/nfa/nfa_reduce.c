@@ -0,0 +1,507 @@
+#include "../../include/nfa.h"
+
+/**
+ * @brief Epsilon-free automaton being reduced
+ *
+ * Rows are sorted by (label, to) without duplicates.
+ */
+typedef struct {
+    u32         n;          /* Number of states */
+    u32         start;      /* Start state */
+    u32         *final;     /* final[s]: rule accepted, NFA_NO_RULE if none */
+    u32         *off;       /* Row of s is trans[off[s] .. off[s + 1]] */
+    Transition  *trans;
+} ReduceNFA;
+
+/**
+ * @brief Signatures of one refinement round, hashed to block ids
+ */
+typedef struct {
+    u32     *data;          /* Concatenated signatures */
+    u32     data_count;
+    u32     data_capacity;
+    u32     *slot_start;    /* Offset of the signature in data, (u32)-1 if empty */
+    u32     *slot_len;
+    u32     *slot_id;
+    u32     slot_capacity;
+    u32     count;          /* Distinct signatures */
+} SigTable;
+
+static void *reduce_alloc(size_t size) {
+    void *ptr = malloc(GET_MAX(size, 1));
+
+    if (!ptr) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    return (ptr);
+}
+
+static int transition_cmp(const void *a, const void *b) {
+    const Transition *x = a;
+    const Transition *y = b;
+
+    if (x->label != y->label) return (x->label < y->label ? -1 : 1);
+    if (x->to_id != y->to_id) return (x->to_id < y->to_id ? -1 : 1);
+    return (0);
+}
+
+static int u64_cmp(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+
+    return ((x > y) - (x < y));
+}
+
+static void reduce_nfa_free(ReduceNFA *a) {
+    free(a->final);
+    free(a->off);
+    free(a->trans);
+    *a = (ReduceNFA){0};
+}
+
+/**
+ * @brief Build an automaton from an edge list (rows sorted, duplicates removed)
+ * @param a Receives the automaton, takes ownership of final
+ * @param n Number of states
+ * @param start Start state
+ * @param final Accepted rules, n entries
+ * @param edges Edges, sorted in place
+ * @param count Number of edges
+ */
+static void reduce_nfa_build(ReduceNFA *a, u32 n, u32 start, u32 *final, NFAEdge *edges, u32 count) {
+    a->n = n;
+    a->start = start;
+    a->final = final;
+    a->off = calloc(n + 1, sizeof(u32));
+    a->trans = reduce_alloc(count * sizeof(Transition));
+    if (!a->off) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+
+    for (u32 e = 0; e < count; e++) {
+        a->off[edges[e].from + 1]++;
+    }
+    for (u32 s = 0; s < n; s++) {
+        a->off[s + 1] += a->off[s];
+    }
+
+    u32 *fill = reduce_alloc((n + 1) * sizeof(u32));
+    memcpy(fill, a->off, (n + 1) * sizeof(u32));
+    for (u32 e = 0; e < count; e++) {
+        a->trans[fill[edges[e].from]++] = edges[e].t;
+    }
+    free(fill);
+
+    /* Sort and dedup every row, compacting the rows in place */
+    u32 write = 0;
+    for (u32 s = 0; s < n; s++) {
+        u32 lo = a->off[s];
+        u32 hi = a->off[s + 1];
+
+        qsort(&a->trans[lo], hi - lo, sizeof(Transition), transition_cmp);
+        a->off[s] = write;
+        for (u32 j = lo; j < hi; j++) {
+            if (j > lo && transition_cmp(&a->trans[j], &a->trans[j - 1]) == 0) continue;
+            a->trans[write++] = a->trans[j];
+        }
+    }
+    a->off[n] = write;
+}
+
+/**
+ * @brief Edges of a reversed copy of a (from <-> to)
+ */
+static NFAEdge *reduce_reverse_edges(ReduceNFA *a) {
+    NFAEdge *edges = reduce_alloc(a->off[a->n] * sizeof(NFAEdge));
+
+    for (u32 s = 0; s < a->n; s++) {
+        for (u32 j = a->off[s]; j < a->off[s + 1]; j++) {
+            edges[j] = (NFAEdge){a->trans[j].to_id, {a->trans[j].label, s}};
+        }
+    }
+    return (edges);
+}
+
+static u32 sig_hash(u32 *sig, u32 len) {
+    u64 h = 0xcbf29ce484222325ULL;
+
+    for (u32 i = 0; i < len; i++) {
+        h = (h ^ sig[i]) * 0x100000001b3ULL;
+    }
+    return ((u32)(h ^ (h >> 32)));
+}
+
+static void sig_table_reset(SigTable *t, u32 n) {
+    u32 capacity = 64;
+
+    while (capacity < n * 2) capacity *= 2;
+    if (capacity != t->slot_capacity) {
+        free(t->slot_start);
+        free(t->slot_len);
+        free(t->slot_id);
+        t->slot_start = reduce_alloc(capacity * sizeof(u32));
+        t->slot_len = reduce_alloc(capacity * sizeof(u32));
+        t->slot_id = reduce_alloc(capacity * sizeof(u32));
+        t->slot_capacity = capacity;
+    }
+    memset(t->slot_start, 0xff, capacity * sizeof(u32));
+    t->data_count = 0;
+    t->count = 0;
+}
+
+/**
+ * @brief Id of a signature, a new id when it was not seen in this round
+ */
+static u32 sig_table_id(SigTable *t, u32 *sig, u32 len) {
+    u32 pos = sig_hash(sig, len) & (t->slot_capacity - 1);
+
+    while (t->slot_start[pos] != (u32)-1) {
+        if (t->slot_len[pos] == len && memcmp(&t->data[t->slot_start[pos]], sig, len * sizeof(u32)) == 0) {
+            return (t->slot_id[pos]);
+        }
+        pos = (pos + 1) & (t->slot_capacity - 1);
+    }
+
+    if (t->data_count + len > t->data_capacity) {
+        t->data_capacity = GET_MAX(t->data_capacity * 2, t->data_count + len);
+        t->data = realloc(t->data, t->data_capacity * sizeof(u32));
+        if (!t->data) {
+            ERR("Memory allocation failed for NFA reduction\n");
+            exit(1);
+        }
+    }
+    memcpy(&t->data[t->data_count], sig, len * sizeof(u32));
+    t->slot_start[pos] = t->data_count;
+    t->slot_len[pos] = len;
+    t->slot_id[pos] = t->count++;
+    t->data_count += len;
+    return (t->slot_id[pos]);
+}
+
+/**
+ * @brief Coarsest partition where states of a block have the same outgoing behaviour
+ * @param a Automaton
+ * @param block In: initial partition, out: stable partition
+ * @return Number of blocks
+ *
+ * Signature refinement: the signature of s is its block and the set of
+ * (label, block of target) of its row. Each round splits blocks, it
+ * stops when the block count does not change (bisimulation).
+ */
+static u32 refine(ReduceNFA *a, u32 *block) {
+    SigTable    table = {0};
+    u32         *next = reduce_alloc(a->n * sizeof(u32));
+    u64         *pairs = reduce_alloc(a->off[a->n] * sizeof(u64));
+    u32         *sig = reduce_alloc((2 * a->off[a->n] + 1) * sizeof(u32));
+    u32         count = 0;
+
+    /* Normalise the initial partition to dense ids */
+    sig_table_reset(&table, a->n);
+    for (u32 s = 0; s < a->n; s++) {
+        block[s] = sig_table_id(&table, &block[s], 1);
+    }
+    count = table.count;
+
+    while (1) {
+        sig_table_reset(&table, a->n);
+        for (u32 s = 0; s < a->n; s++) {
+            u32 lo = a->off[s];
+            u32 len = 0;
+
+            for (u32 j = lo; j < a->off[s + 1]; j++) {
+                pairs[j - lo] = ((u64)a->trans[j].label << 32) | block[a->trans[j].to_id];
+            }
+            qsort(pairs, a->off[s + 1] - lo, sizeof(u64), u64_cmp);
+
+            sig[len++] = block[s];
+            for (u32 j = 0; j < a->off[s + 1] - lo; j++) {
+                if (j > 0 && pairs[j] == pairs[j - 1]) continue;
+                sig[len++] = (u32)(pairs[j] >> 32);
+                sig[len++] = (u32)pairs[j];
+            }
+            next[s] = sig_table_id(&table, sig, len);
+        }
+        memcpy(block, next, a->n * sizeof(u32));
+        if (table.count == count) break;
+        count = table.count;
+    }
+
+    free(table.data);
+    free(table.slot_start);
+    free(table.slot_len);
+    free(table.slot_id);
+    free(next);
+    free(pairs);
+    free(sig);
+    return (count);
+}
+
+/**
+ * @brief Replace a by its quotient: one state per block
+ */
+static void quotient(ReduceNFA *a, u32 *block, u32 count) {
+    u32     *final = calloc(GET_MAX(count, 1), sizeof(u32));
+    NFAEdge *edges = reduce_alloc(a->off[a->n] * sizeof(NFAEdge));
+
+    if (!final) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    for (u32 s = 0; s < a->n; s++) {
+        final[block[s]] = nfa_rule_first(final[block[s]], a->final[s]);
+        for (u32 j = a->off[s]; j < a->off[s + 1]; j++) {
+            edges[j] = (NFAEdge){block[s], {a->trans[j].label, block[a->trans[j].to_id]}};
+        }
+    }
+
+    ReduceNFA q;
+    reduce_nfa_build(&q, count, block[a->start], final, edges, a->off[a->n]);
+    free(edges);
+    reduce_nfa_free(a);
+    *a = q;
+}
+
+/**
+ * @brief Merge forward bisimilar states (same rule, same moves to same blocks)
+ */
+static void merge_forward(ReduceNFA *a) {
+    u32 *block = reduce_alloc(a->n * sizeof(u32));
+
+    for (u32 s = 0; s < a->n; s++) block[s] = a->final[s];
+    u32 count = refine(a, block);
+    if (count < a->n) quotient(a, block, count);
+    free(block);
+}
+
+/**
+ * @brief Merge backward bisimilar states (reached by the same words)
+ *
+ * Refines the reversed automaton, start state apart. Two merged states
+ * are reached by the same prefixes, they are always active together:
+ * the merged state accepts the earliest of their rules and the union of
+ * their rows, every word keeps its rule.
+ */
+static void merge_backward(ReduceNFA *a) {
+    ReduceNFA   rev;
+    u32         *rev_final = calloc(GET_MAX(a->n, 1), sizeof(u32));
+    NFAEdge     *edges = reduce_reverse_edges(a);
+    u32         *block = reduce_alloc(a->n * sizeof(u32));
+
+    if (!rev_final) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    reduce_nfa_build(&rev, a->n, a->start, rev_final, edges, a->off[a->n]);
+    free(edges);
+
+    for (u32 s = 0; s < a->n; s++) block[s] = (s == a->start);
+    u32 count = refine(&rev, block);
+    reduce_nfa_free(&rev);
+    if (count < a->n) quotient(a, block, count);
+    free(block);
+}
+
+/**
+ * @brief Drop states not reachable from start or not reaching a final state, number the rest in BFS order
+ */
+static void trim_renumber(ReduceNFA *a) {
+    u32     *id = reduce_alloc(a->n * sizeof(u32));
+    u32     *queue = reduce_alloc(a->n * sizeof(u32));
+    u8      *useful = calloc(GET_MAX(a->n, 1), sizeof(u8));
+    u32     head = 0;
+    u32     tail = 0;
+
+    if (!useful) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+
+    /* Co-reachability on the reversed edges, from the final states */
+    ReduceNFA   rev;
+    NFAEdge     *edges = reduce_reverse_edges(a);
+    u32         *rev_final = calloc(GET_MAX(a->n, 1), sizeof(u32));
+    if (!rev_final) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    reduce_nfa_build(&rev, a->n, a->start, rev_final, edges, a->off[a->n]);
+    free(edges);
+    for (u32 s = 0; s < a->n; s++) {
+        if (a->final[s]) {
+            useful[s] = 1;
+            queue[tail++] = s;
+        }
+    }
+    while (head < tail) {
+        u32 s = queue[head++];
+        for (u32 j = rev.off[s]; j < rev.off[s + 1]; j++) {
+            u32 p = rev.trans[j].to_id;
+            if (!useful[p]) {
+                useful[p] = 1;
+                queue[tail++] = p;
+            }
+        }
+    }
+    reduce_nfa_free(&rev);
+
+    /* BFS from start over useful states gives the dense numbering */
+    for (u32 s = 0; s < a->n; s++) id[s] = (u32)-1;
+    head = tail = 0;
+    id[a->start] = tail;
+    queue[tail++] = a->start;
+    while (head < tail) {
+        u32 s = queue[head++];
+        for (u32 j = a->off[s]; j < a->off[s + 1]; j++) {
+            u32 t = a->trans[j].to_id;
+            if (useful[t] && id[t] == (u32)-1) {
+                id[t] = tail;
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    u32     *final = calloc(GET_MAX(tail, 1), sizeof(u32));
+    u32     count = 0;
+    edges = reduce_alloc(a->off[a->n] * sizeof(NFAEdge));
+    if (!final) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    for (u32 s = 0; s < a->n; s++) {
+        if (id[s] == (u32)-1) continue;
+        final[id[s]] = a->final[s];
+        for (u32 j = a->off[s]; j < a->off[s + 1]; j++) {
+            u32 t = a->trans[j].to_id;
+            if (id[t] == (u32)-1) continue;
+            edges[count++] = (NFAEdge){id[s], {a->trans[j].label, id[t]}};
+        }
+    }
+
+    ReduceNFA r;
+    reduce_nfa_build(&r, tail, 0, final, edges, count);
+    free(edges);
+    free(id);
+    free(queue);
+    free(useful);
+    reduce_nfa_free(a);
+    *a = r;
+}
+
+/**
+ * @brief Epsilon-free automaton of g_nfa
+ *
+ * The states kept are the start state and the targets of labelled
+ * transitions, the others are only crossed through epsilon edges. Each
+ * kept state gets the labelled transitions of its whole closure and
+ * accepts the earliest rule of the final states in its closure.
+ */
+static void remove_epsilon(ReduceNFA *a) {
+    u32     n = g_nfa.state_count;
+    u32     *id = reduce_alloc(n * sizeof(u32));
+    u32     kept = 0;
+    u32     count = 0;
+    u32     capacity = GET_MAX(g_nfa.sym_offsets[n], 16);
+    NFAEdge *edges = reduce_alloc(capacity * sizeof(NFAEdge));
+
+    for (u32 s = 0; s < n; s++) id[s] = (u32)-1;
+    id[g_nfa.start_id] = kept++;
+    for (u32 j = 0; j < g_nfa.sym_offsets[n]; j++) {
+        u32 t = g_nfa.sym_trans[j].to_id;
+        if (id[t] == (u32)-1) id[t] = kept++;
+    }
+
+    u32 *final = calloc(GET_MAX(kept, 1), sizeof(u32));
+    if (!final) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    for (u32 s = 0; s < n; s++) {
+        if (id[s] == (u32)-1) continue;
+
+        for (u32 k = g_nfa.closure_offsets[s]; k < g_nfa.closure_offsets[s + 1]; k++) {
+            u32 m = g_nfa.closure_list[k];
+            final[id[s]] = nfa_rule_first(final[id[s]], g_nfa.states[m].is_final);
+            for (u32 j = g_nfa.sym_offsets[m]; j < g_nfa.sym_offsets[m + 1]; j++) {
+                if (count >= capacity) {
+                    capacity *= 2;
+                    edges = realloc(edges, capacity * sizeof(NFAEdge));
+                    if (!edges) {
+                        ERR("Memory allocation failed for NFA reduction\n");
+                        exit(1);
+                    }
+                }
+                edges[count++] = (NFAEdge){id[s], {g_nfa.sym_trans[j].label, id[g_nfa.sym_trans[j].to_id]}};
+            }
+        }
+    }
+
+    reduce_nfa_build(a, kept, id[g_nfa.start_id], final, edges, count);
+    free(edges);
+    free(id);
+}
+
+/**
+ * @brief Install a reduced automaton as g_nfa
+ */
+static void reduce_install(ReduceNFA *a) {
+    free(g_nfa.states);
+    free(g_nfa.eps_offsets);
+    free(g_nfa.eps_to);
+    free(g_nfa.sym_offsets);
+    free(g_nfa.sym_trans);
+    free(g_nfa.closure_offsets);
+    free(g_nfa.closure_list);
+
+    g_nfa.states = reduce_alloc(a->n * sizeof(NFAState));
+    for (u32 s = 0; s < a->n; s++) {
+        g_nfa.states[s] = (NFAState){s, a->final[s]};
+    }
+    g_nfa.state_count = a->n;
+    g_nfa.capacity = a->n;
+    g_nfa.start_id = a->start;
+    g_nfa.edge_count = a->off[a->n];
+    g_nfa.eps_offsets = calloc(a->n + 1, sizeof(u32));
+    g_nfa.eps_to = reduce_alloc(sizeof(u32));
+    if (!g_nfa.eps_offsets) {
+        ERR("Memory allocation failed for NFA reduction\n");
+        exit(1);
+    }
+    g_nfa.sym_offsets = a->off;
+    g_nfa.sym_trans = a->trans;
+    free(a->final);
+    *a = (ReduceNFA){0};
+    nfa_compute_closures(0);
+}
+
+/**
+ * @brief Shrink the finalized NFA before the subset construction
+ * @param stats Receives the state and transition counts after each step
+ *
+ * 1. epsilon removal, only the start state and the targets of labelled
+ *    transitions are kept (Thompson glue states disappear)
+ * 2. forward then backward bisimulation merge
+ * 3. trim of useless states and dense BFS renumbering
+ * The result has no epsilon edge and accepts the same language; the
+ * DFA is unchanged but the subset construction handles smaller sets.
+ */
+void nfa_reduce(NFAReduceStats *stats) {
+    ReduceNFA a;
+
+    stats->states_before = g_nfa.state_count;
+    stats->trans_before = g_nfa.edge_count;
+
+    remove_epsilon(&a);
+    stats->states_eps_free = a.n;
+
+    merge_forward(&a);
+    merge_backward(&a);
+    stats->states_merged = a.n;
+
+    trim_renumber(&a);
+    stats->states_after = a.n;
+    stats->trans_after = a.off[a.n];
+
+    reduce_install(&a);
+}
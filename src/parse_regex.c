@@ -1,119 +1,331 @@
 #include "../include/log.h"
 #include "../include/regex_tree.h"
 
+/* Maximum length of a character class expression between '[' and ']' */
+#define MAX_CLASS_LEN 255
+
+/* Initial capacity of the parser stacks */
+#define PARSE_STACK_CAPACITY 64
+
+/* Pseudo operators pushed on the operator stack */
+#define OP_STACK_PAREN  '('
+#define OP_STACK_ALT    '|'
+#define OP_STACK_CONCAT '.'
 
 /**
- * @brief Parse a character class like [abc] or [^abc]
- * @return The root of the character class subtree
+ * @brief Explicit stacks of the shunting-yard parser
+ *
+ * Operands are finished subtrees, operators are pending '(' '|' and
+ * implicit concatenations waiting for their right operand.
  */
-static RegexTreeNode* parse_class(String *s) {
-    if (peek(s) == '[') {
-        next(s); /* skip '[' */
+typedef struct {
+    RegexTreeNode   **operands;
+    u32             operand_count;
+    u32             operand_capacity;
+    char            *operators;
+    u32             operator_count;
+    u32             operator_capacity;
+} ParseStack;
 
-        char buffer[256] = {0};
-        int idx = 0;
+static void parse_stack_init(ParseStack *st) {
+    st->operands = malloc(PARSE_STACK_CAPACITY * sizeof(RegexTreeNode *));
+    st->operand_count = 0;
+    st->operand_capacity = PARSE_STACK_CAPACITY;
+    st->operators = malloc(PARSE_STACK_CAPACITY * sizeof(char));
+    st->operator_count = 0;
+    st->operator_capacity = PARSE_STACK_CAPACITY;
+    if (!st->operands || !st->operators) {
+        ERR("Memory allocation failed for parser stacks\n");
+        exit(1);
+    }
+}
 
-        if (len(s) >= 255) {
-            ERR("Character class too long\n");
-            return (NULL);
+static void parse_stack_free(ParseStack *st) {
+    free(st->operands);
+    free(st->operators);
+}
+
+static void push_operand(ParseStack *st, RegexTreeNode *node) {
+    if (st->operand_count >= st->operand_capacity) {
+        st->operand_capacity *= 2;
+        st->operands = realloc(st->operands, st->operand_capacity * sizeof(RegexTreeNode *));
+        if (!st->operands) {
+            ERR("Memory allocation failed for parser stacks\n");
+            exit(1);
         }
+    }
+    st->operands[st->operand_count++] = node;
+}
 
-        while (!end(s) && peek(s) != ']') {
-            buffer[idx++] = next(s);
+static void push_operator(ParseStack *st, char op) {
+    if (st->operator_count >= st->operator_capacity) {
+        st->operator_capacity *= 2;
+        st->operators = realloc(st->operators, st->operator_capacity * sizeof(char));
+        if (!st->operators) {
+            ERR("Memory allocation failed for parser stacks\n");
+            exit(1);
         }
-        buffer[idx] = '\0';
+    }
+    st->operators[st->operator_count++] = op;
+}
+
+/**
+ * @brief Binding strength of a stacked operator, concatenation binds tighter than alternation
+ */
+static int operator_precedence(char op) {
+    switch (op) {
+        case OP_STACK_CONCAT:   return (2);
+        case OP_STACK_ALT:      return (1);
+        default:                return (0);
+    }
+}
 
-        if (peek(s) == ']') next(s); /* skip ']' */
+/**
+ * @brief Pop the top operator and combine the two top operands with it
+ * @return TRUE on success, FALSE if an operand is missing (ex: "a|")
+ */
+static s8 reduce_top(ParseStack *st) {
+    char op = st->operators[--st->operator_count];
 
-        return RegexTreeNode_create(REG_CLASS, NULL, NULL, buffer, 0);
+    if (st->operand_count < 2) {
+        ERR("Missing operand for '%c'\n", op == OP_STACK_CONCAT ? ' ' : op);
+        return (FALSE);
     }
 
-    return (NULL);
+    RegexTreeNode *right = st->operands[--st->operand_count];
+    RegexTreeNode *left = st->operands[--st->operand_count];
+    RegexType type = (op == OP_STACK_CONCAT) ? REG_CONCAT : REG_ALT;
+
+    push_operand(st, RegexTreeNode_create(type, left, right, NULL, 0));
+    return (TRUE);
 }
 
+/**
+ * @brief Reduce every pending operator binding at least as tight as op (left associativity)
+ */
+static s8 reduce_while(ParseStack *st, char op) {
+    int prec = operator_precedence(op);
+
+    while (st->operator_count > 0) {
+        char top = st->operators[st->operator_count - 1];
+        if (top == OP_STACK_PAREN || operator_precedence(top) < prec) break;
+        if (!reduce_top(st)) return (FALSE);
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Push an operand, inserting the implicit concatenation with the previous one
+ */
+static s8 push_atom(ParseStack *st, RegexTreeNode *node, s8 *prev_is_operand) {
+    if (!node) return (FALSE);
+
+    if (*prev_is_operand) {
+        if (!reduce_while(st, OP_STACK_CONCAT)) return (FALSE);
+        push_operator(st, OP_STACK_CONCAT);
+    }
+    push_operand(st, node);
+    *prev_is_operand = TRUE;
+    return (TRUE);
+}
 
 /**
- * @brief Parse an atom: either a character class, a parenthesized expression, or a single character
- * @return The root of the atom subtree
+ * @brief Apply a postfix operator (*, +, ?, {n,m}) to the last operand
+ * @param st Parser stacks
+ * @param min Minimum count of the operator ({0,} for *)
+ * @param max Maximum count of the operator or REPEAT_INFINITE
+ *
+ * A node holds a single operator, when it already has one the node is
+ * wrapped in a REG_GROUP carrying the new operator (ex: "(a+)*").
  */
-static RegexTreeNode* parse_atom(String *s) {
-    /* First try to parse a character class */
-    RegexTreeNode* class_node = parse_class(s);
-    if (class_node) {
-        return class_node;
-    }
-    
-    /* Then try to parse parentheses */
-    if (peek(s) == '(') {
-        next(s); /* skip '(' */
-        RegexTreeNode* r = parse_regex(s);
-        if (peek(s) == ')') next(s); /* skip ')' */
-        return r;
-    } else {
-        char c = next(s);
-        return RegexTreeNode_create(REG_CHAR, NULL, NULL, NULL, c);
+static void apply_postfix(ParseStack *st, u32 min, u32 max) {
+    RegexTreeNode *top = st->operands[st->operand_count - 1];
+
+    if (top->op != OP_NONE) {
+        top = RegexTreeNode_create(REG_GROUP, top, NULL, NULL, 0);
+        st->operands[st->operand_count - 1] = top;
     }
+    regex_set_repeat(top, min, max);
 }
 
 /**
- * @brief Parse repetition operators (*, +, ?)
- * @return The root of the (possibly repeated) atom node
+ * @brief Read a decimal bound of {n,m}
+ * @return Number of digits read, 0 if there is no digit
  */
-static RegexTreeNode* parse_repeat(String *s) {
-    RegexTreeNode* atom = parse_atom(s);
-    char c = peek(s);
-
-    if (c == '*' || c == '+' || c == '?') {
-        next(s); /* Consomme le symbole */
-        switch (c) {
-            case '*': atom->op = OP_STAR; break;
-            case '+': atom->op = OP_PLUS; break;
-            case '?': atom->op = OP_OPTIONAL; break;
+static int parse_bound(String *s, u32 *value) {
+    int digits = 0;
+
+    *value = 0;
+    while (s->str[s->pos + digits] >= '0' && s->str[s->pos + digits] <= '9') {
+        if (*value <= REPEAT_MAX_BOUND) {
+            *value = *value * 10 + (s->str[s->pos + digits] - '0');
         }
+        digits++;
     }
-    return atom;
+    s->pos += digits;
+    return (digits);
 }
 
 /**
- * @brief Parse concatenation (AB)
- * @return The root of the concatenation subtree
+ * @brief Parse a bounded repetition {n}, {n,} or {n,m}
+ * @param s Input positioned on '{'
+ * @param min Receives n
+ * @param max Receives m, n for {n} or REPEAT_INFINITE for {n,}
+ * @return TRUE if s holds a repetition (consumed), FALSE if the '{' is a plain character
  */
-static RegexTreeNode* parse_concat(String *s) {
-    RegexTreeNode* left = parse_repeat(s);
+static s8 parse_bounds(String *s, u32 *min, u32 *max) {
+    int start = s->pos;
 
-    while (!end(s)) {
-        char c = peek(s);
-        if (c == ')' || c == '|') break; /* end concatenation on ')' or '|' */
+    next(s); /* skip '{' */
+    if (!parse_bound(s, min)) goto not_a_repeat;
 
-        RegexTreeNode* right = parse_repeat(s);
-        left = RegexTreeNode_create(REG_CONCAT, left, right, NULL, 0);
+    *max = *min;
+    if (peek(s) == ',') {
+        next(s);
+        if (!parse_bound(s, max)) *max = REPEAT_INFINITE;
     }
+    if (peek(s) != '}') goto not_a_repeat;
+    next(s); /* skip '}' */
+    return (TRUE);
+
+    not_a_repeat:
+        s->pos = start;
+        return (FALSE);
+}
 
-    return (left);
+/**
+ * @brief Check the bounds of {n,m}
+ * @return TRUE if they are usable
+ */
+static s8 check_bounds(u32 min, u32 max) {
+    if (min > REPEAT_MAX_BOUND || (max != REPEAT_INFINITE && max > REPEAT_MAX_BOUND)) {
+        ERR("Repetition bound too large (max %d)\n", REPEAT_MAX_BOUND);
+        return (FALSE);
+    }
+    if (max < min) {
+        ERR("Invalid repetition {%u,%u}\n", min, max);
+        return (FALSE);
+    }
+    return (TRUE);
 }
 
 /**
- * @brief Parse alternation (A|B)
- * @return The root of the alternation subtree
+ * @brief Replace the top operand by the empty string, x{0} and x{0,0} match nothing else
  */
-static RegexTreeNode* parse_alt(String *s) {
-    RegexTreeNode* left = parse_concat(s);
+static void apply_empty_repeat(ParseStack *st) {
+    RegexTreeNode *empty = RegexTreeNode_create(REG_STRING, NULL, NULL, NULL, 0);
+
+    empty->str = arena_alloc(&g_regex_arena, 1);
+    empty->str_len = 0;
+    st->operands[st->operand_count - 1] = empty;
+}
+
+/**
+ * @brief Parse a character class like [abc] or [^abc]
+ * @return The root of the character class subtree
+ */
+static RegexTreeNode* parse_class(String *s) {
+    char buffer[MAX_CLASS_LEN + 1] = {0};
+    int idx = 0;
 
-    while (peek(s) == '|') {
-        next(s); /* skip '|' */
-        RegexTreeNode* right = parse_concat(s);
-        left = RegexTreeNode_create(REG_ALT, left, right, NULL, 0);
+    next(s); /* skip '[' */
+
+    while (!end(s) && peek(s) != ']') {
+        if (idx >= MAX_CLASS_LEN) {
+            ERR("Character class too long\n");
+            return (NULL);
+        }
+        buffer[idx++] = next(s);
     }
+    buffer[idx] = '\0';
+
+    if (peek(s) == ']') next(s); /* skip ']' */
 
-    return (left);
+    return RegexTreeNode_create(REG_CLASS, NULL, NULL, buffer, 0);
 }
 
 /**
  * @brief Parse the full regex
- * @return The root of the regex tree
+ * @return The root of the regex tree, or NULL on syntax error
+ *
+ * Shunting-yard parser: operands and pending operators live on explicit
+ * heap stacks, so stack usage does not depend on the pattern length or
+ * nesting depth. Precedence from tightest to loosest: postfix (*, +, ?, {n,m}),
+ * concatenation, alternation. Parsing stops at an unmatched ')'.
  */
 RegexTreeNode* parse_regex(String *s) {
     if (end(s)) return (NULL);
 
-    return (parse_alt(s));
+    ParseStack      st;
+    RegexTreeNode   *root = NULL;
+    s8              prev_is_operand = FALSE;
+    s8              ok = TRUE;
+    u32             open_paren = 0;
+    u32             min, max;
+
+    parse_stack_init(&st);
+
+    while (ok && !end(s)) {
+        char c = peek(s);
+
+        if (c == '[') {
+            ok = push_atom(&st, parse_class(s), &prev_is_operand);
+        } else if (c == '(') {
+            next(s);
+            if (prev_is_operand) {
+                ok = reduce_while(&st, OP_STACK_CONCAT);
+                push_operator(&st, OP_STACK_CONCAT);
+            }
+            push_operator(&st, OP_STACK_PAREN);
+            open_paren++;
+            prev_is_operand = FALSE;
+        } else if (c == ')') {
+            if (open_paren == 0) break; /* unmatched ')' ends the regex */
+            next(s);
+            ok = reduce_while(&st, OP_STACK_ALT);
+            if (ok && !prev_is_operand) {
+                ERR("Empty expression before ')'\n");
+                ok = FALSE;
+            }
+            st.operator_count--; /* pop '(' */
+            open_paren--;
+        } else if (c == '|') {
+            next(s);
+            if (!prev_is_operand) {
+                ERR("Empty alternative before '|'\n");
+                ok = FALSE;
+            }
+            ok = ok && reduce_while(&st, OP_STACK_ALT);
+            push_operator(&st, OP_STACK_ALT);
+            prev_is_operand = FALSE;
+        } else if ((c == '*' || c == '+' || c == '?') && prev_is_operand) {
+            next(s);
+            apply_postfix(&st, c == '+' ? 1 : 0, c == '?' ? 1 : REPEAT_INFINITE);
+        } else if (c == '{' && prev_is_operand && parse_bounds(s, &min, &max)) {
+            ok = check_bounds(min, max);
+            if (ok && max == 0) apply_empty_repeat(&st);
+            else if (ok) apply_postfix(&st, min, max);
+        } else {
+            next(s);
+            ok = push_atom(&st, RegexTreeNode_create(REG_CHAR, NULL, NULL, NULL, c), &prev_is_operand);
+        }
+    }
+
+    /* Missing ')' are implicitly closed */
+    while (ok && st.operator_count > 0) {
+        if (st.operators[st.operator_count - 1] == OP_STACK_PAREN) {
+            st.operator_count--;
+            continue;
+        }
+        ok = reduce_top(&st);
+    }
+
+    if (ok && st.operand_count == 1) {
+        root = st.operands[0];
+    } else if (ok) {
+        ERR("Invalid regex: %u operands left\n", st.operand_count);
+    }
+
+    parse_stack_free(&st);
+    return (root);
 }
@@ -0,0 +1,227 @@
+#include "../include/log.h"
+#include "../include/regex_tree.h"
+
+/* Initial capacity of the hash tables, must be a power of two */
+#define HASHCONS_INITIAL_CAPACITY 256
+
+/**
+ * @brief Open addressing set of node or class pointers
+ */
+typedef struct {
+    void    **slots;
+    u32     capacity;       /* power of two */
+    u32     count;
+} HashconsTable;
+
+/**
+ * @brief Sharing tables, kept for the whole compilation so several rules share nodes
+ */
+typedef struct {
+    HashconsTable   nodes;
+    HashconsTable   classes;
+    u32             next_id;
+} Hashcons;
+
+/**
+ * @brief Post-order frame of the hash-consing walk
+ */
+typedef struct {
+    RegexTreeNode   **slot;             /* where the node is stored in its parent */
+    u8              children_done;
+} HashconsFrame;
+
+static Hashcons *__get_hashcons(void) {
+    static Hashcons hashcons = {0};
+    return (&hashcons);
+}
+
+#define g_hashcons (*__get_hashcons())
+
+FT_INLINE u64 hash_mix(u64 h, u64 value) {
+    h ^= value + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return (h);
+}
+
+static u64 hash_bytes(u64 h, const char *data, u32 len) {
+    for (u32 i = 0; i < len; i++) {
+        h = (h ^ (u8)data[i]) * 0x100000001b3ULL;
+    }
+    return (h);
+}
+
+static u64 class_hash(ClassDef *class) {
+    u64 h = class->reverse_match;
+
+    for (u32 i = 0; i < CLASS_BITMAP_WORDS; i++) {
+        h = hash_mix(h, class->char_bits[i]);
+    }
+    return (h);
+}
+
+static s8 class_equal(ClassDef *a, ClassDef *b) {
+    return (a->reverse_match == b->reverse_match
+        && memcmp(a->char_bits, b->char_bits, sizeof(a->char_bits)) == 0);
+}
+
+/**
+ * @brief Hash of a node, children and class must already be shared
+ */
+static u64 node_hash(RegexTreeNode *node) {
+    u64 h = node->type;
+
+    h = hash_mix(h, ((u64)node->op << 8) | (u8)node->c);
+    h = hash_mix(h, ((u64)node->rep_min << 32) | node->rep_max);
+    h = hash_mix(h, (u64)(uintptr_t)node->left);
+    h = hash_mix(h, (u64)(uintptr_t)node->right);
+    h = hash_mix(h, (u64)(uintptr_t)node->class);
+    if (node->str) h = hash_bytes(h, node->str, node->str_len);
+    return (h);
+}
+
+static s8 node_equal(RegexTreeNode *a, RegexTreeNode *b) {
+    if (a->type != b->type || a->op != b->op || a->c != b->c
+        || a->rep_min != b->rep_min || a->rep_max != b->rep_max
+        || a->left != b->left || a->right != b->right || a->class != b->class
+        || a->str_len != b->str_len) {
+        return (FALSE);
+    }
+    return (a->str_len == 0 || memcmp(a->str, b->str, a->str_len) == 0);
+}
+
+static void table_init(HashconsTable *t, u32 capacity) {
+    t->slots = calloc(capacity, sizeof(void *));
+    if (!t->slots) {
+        ERR("Memory allocation failed for hash-consing table\n");
+        exit(1);
+    }
+    t->capacity = capacity;
+    t->count = 0;
+}
+
+static void table_grow(HashconsTable *t, u64 (*hash)(void *)) {
+    HashconsTable old = *t;
+
+    table_init(t, old.capacity * 2);
+    for (u32 i = 0; i < old.capacity; i++) {
+        if (!old.slots[i]) continue;
+        u32 pos = hash(old.slots[i]) & (t->capacity - 1);
+        while (t->slots[pos]) pos = (pos + 1) & (t->capacity - 1);
+        t->slots[pos] = old.slots[i];
+        t->count++;
+    }
+    free(old.slots);
+}
+
+/**
+ * @brief Return the shared copy of item, inserting item when it is new
+ * @param t Table to look into
+ * @param item Candidate
+ * @param hash Hash function of the items
+ * @param equal Structural equality of the items
+ */
+static void *table_intern(HashconsTable *t, void *item, u64 (*hash)(void *), s8 (*equal)(void *, void *)) {
+    if (!t->slots) table_init(t, HASHCONS_INITIAL_CAPACITY);
+    if ((t->count + 1) * 2 > t->capacity) table_grow(t, hash);
+
+    u32 pos = hash(item) & (t->capacity - 1);
+
+    while (t->slots[pos]) {
+        if (equal(t->slots[pos], item)) return (t->slots[pos]);
+        pos = (pos + 1) & (t->capacity - 1);
+    }
+    t->slots[pos] = item;
+    t->count++;
+    return (item);
+}
+
+static u64 node_hash_cb(void *item) { return (node_hash(item)); }
+static s8 node_equal_cb(void *a, void *b) { return (node_equal(a, b)); }
+static u64 class_hash_cb(void *item) { return (class_hash(item)); }
+static s8 class_equal_cb(void *a, void *b) { return (class_equal(a, b)); }
+
+/**
+ * @brief Replace the node in slot by its shared copy
+ */
+static void hashcons_node(RegexTreeNode **slot, HashconsStats *stats) {
+    RegexTreeNode *node = *slot;
+
+    stats->nodes++;
+    if (node->class) {
+        stats->classes++;
+        node->class = table_intern(&g_hashcons.classes, node->class, class_hash_cb, class_equal_cb);
+    }
+
+    RegexTreeNode *shared = table_intern(&g_hashcons.nodes, node, node_hash_cb, node_equal_cb);
+
+    if (shared == node) {
+        node->id = g_hashcons.next_id++;
+        node->refs = 0;
+    }
+    shared->refs++;
+    *slot = shared;
+}
+
+/**
+ * @brief Share structurally identical subtrees, turning the tree into a DAG
+ * @param root Root of the simplified tree
+ * @param stats Receives the node and class counters
+ * @return The root of the DAG
+ *
+ * Bottom-up: a node is looked up once its children are shared, so two
+ * subtrees are merged when their type, operator, bounds, literal and
+ * (already shared) children and class are equal. Every unique node gets
+ * a dense id and the number of parents pointing to it in refs, the NFA
+ * construction builds a node with refs > 1 once and copies the result.
+ * Tables live until regex_tree_free() so successive rules share nodes.
+ */
+RegexTreeNode *regex_hashcons(RegexTreeNode *root, HashconsStats *stats) {
+    *stats = (HashconsStats){0};
+    if (!root) return (NULL);
+
+    u32             capacity = 64;
+    u32             count = 0;
+    HashconsFrame   *stack = malloc(capacity * sizeof(HashconsFrame));
+
+    if (!stack) {
+        ERR("Memory allocation failed for hash-consing stack\n");
+        exit(1);
+    }
+
+    stack[count++] = (HashconsFrame){&root, 0};
+    while (count > 0) {
+        HashconsFrame *f = &stack[count - 1];
+        RegexTreeNode *node = *f->slot;
+
+        if (f->children_done) {
+            count--;
+            hashcons_node(f->slot, stats);
+            continue;
+        }
+
+        f->children_done = 1;
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(HashconsFrame));
+            if (!stack) {
+                ERR("Memory allocation failed for hash-consing stack\n");
+                exit(1);
+            }
+        }
+        if (node->right) stack[count++] = (HashconsFrame){&node->right, 0};
+        if (node->left) stack[count++] = (HashconsFrame){&node->left, 0};
+    }
+
+    free(stack);
+    stats->unique_nodes = g_hashcons.nodes.count;
+    stats->unique_classes = g_hashcons.classes.count;
+    return (root);
+}
+
+/**
+ * @brief Release the sharing tables (called by regex_tree_free)
+ */
+void regex_hashcons_free(void) {
+    free(g_hashcons.nodes.slots);
+    free(g_hashcons.classes.slots);
+    g_hashcons = (Hashcons){0};
+}
@@ -0,0 +1,581 @@
+#include "../include/log.h"
+#include "../include/regex_tree.h"
+
+/* Initial capacity of the rewrite pass arrays */
+#define SIMPLIFY_LIST_CAPACITY 16
+
+/**
+ * @brief Growable array of nodes used by the rewrite passes
+ */
+typedef struct {
+    RegexTreeNode   **items;
+    u32             count;
+    u32             capacity;
+} NodeList;
+
+/**
+ * @brief Repetition range {min,max} of an operator
+ */
+typedef struct {
+    u32     min;
+    u32     max;    /* REPEAT_INFINITE for no upper bound */
+} RepeatRange;
+
+/**
+ * @brief One alternative split as a literal lead followed by the rest of the branch
+ *
+ * Ex: "abc(d|e)" is lead "abc" and rest (d|e), "x*" is an empty lead and rest x*.
+ */
+typedef struct {
+    char            *lead;      /* leading literal characters, not NUL terminated */
+    u32             lead_len;   /* number of leading literal characters */
+    RegexTreeNode   *rest;      /* remaining of the branch, NULL if none */
+} AltBranch;
+
+/**
+ * @brief Pending alternation to factor, the result is written to slot
+ */
+typedef struct {
+    AltBranch       *branches;
+    u32             count;
+    RegexTreeNode   **slot;
+    RepeatRange     op;         /* operator of the alternation node itself */
+} AltJob;
+
+/**
+ * @brief Pending node of the post-order rewrite walk
+ */
+typedef struct {
+    RegexTreeNode   **slot;     /* where the (rewritten) node is stored */
+    RegexType       parent;     /* type of the parent node, REG_CHAR for the root */
+    s8              children_done;
+} SimplifyFrame;
+
+static void node_list_push(NodeList *l, RegexTreeNode *node) {
+    if (l->count >= l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : SIMPLIFY_LIST_CAPACITY;
+        l->items = realloc(l->items, l->capacity * sizeof(RegexTreeNode *));
+        if (!l->items) {
+            ERR("Memory allocation failed for node list\n");
+            exit(1);
+        }
+    }
+    l->items[l->count++] = node;
+}
+
+static RepeatRange node_range(RegexTreeNode *node) {
+    switch (node->op) {
+        case OP_STAR:       return ((RepeatRange){0, REPEAT_INFINITE});
+        case OP_PLUS:       return ((RepeatRange){1, REPEAT_INFINITE});
+        case OP_OPTIONAL:   return ((RepeatRange){0, 1});
+        case OP_REPEAT:     return ((RepeatRange){node->rep_min, node->rep_max});
+        default:            return ((RepeatRange){1, 1});
+    }
+}
+
+/**
+ * @brief Multiply two bounds, infinite times anything but 0 is infinite
+ * @return FALSE if a finite product goes past REPEAT_MAX_BOUND
+ */
+static s8 range_mul(u32 a, u32 b, u32 *result) {
+    if (a == 0 || b == 0) {
+        *result = 0;
+    } else if (a == REPEAT_INFINITE || b == REPEAT_INFINITE) {
+        *result = REPEAT_INFINITE;
+    } else if ((u64)a * b > REPEAT_MAX_BOUND) {
+        return (FALSE);
+    } else {
+        *result = a * b;
+    }
+    return (TRUE);
+}
+
+/**
+ * @brief Merge nested repetitions (x{a,b}){c,d} in x{ac,bd} when it is the same language
+ * @return TRUE if merged in result
+ *
+ * The counts matched are the union of [ka,kb] for k in [c,d], a single
+ * interval only when consecutive ranges touch: (k+1)a <= kb+1. The
+ * gap shrinks when k grows, checking the smallest k is enough.
+ * Ex: (x+)* is x*, (x?){2,3} is x{0,3}, but (x{2}){1,2} stays as is.
+ */
+static s8 combine_range(RepeatRange inner, RepeatRange outer, RepeatRange *result) {
+    u32 k = outer.min;
+
+    if (outer.min != outer.max) {
+        if (inner.max == REPEAT_INFINITE) {
+            if (k == 0 && inner.min > 1) return (FALSE);
+        } else if ((u64)k * (inner.max - inner.min) + 1 < inner.min) {
+            return (FALSE);
+        }
+    }
+    return (range_mul(inner.min, outer.min, &result->min)
+            && range_mul(inner.max, outer.max, &result->max));
+}
+
+/**
+ * @brief Quantify node with op (on top of its own operator)
+ * @return The node, or a REG_GROUP wrapping it when both operators cannot merge
+ */
+static RegexTreeNode *apply_range(RegexTreeNode *node, RepeatRange outer) {
+    RepeatRange merged;
+
+    if (outer.min == 1 && outer.max == 1) return (node);
+
+    if (node->op == OP_NONE) {
+        regex_set_repeat(node, outer.min, outer.max);
+    } else if (combine_range(node_range(node), outer, &merged)) {
+        regex_set_repeat(node, merged.min, merged.max);
+    } else {
+        node = RegexTreeNode_create(REG_GROUP, node, NULL, NULL, 0);
+        regex_set_repeat(node, outer.min, outer.max);
+    }
+    return (node);
+}
+
+/**
+ * @brief A node matching exactly one fixed string (a plain character or a literal run)
+ */
+static s8 is_literal(RegexTreeNode *node) {
+    if (node->op != OP_NONE) return (FALSE);
+    return ((node->type == REG_CHAR && node->c != '.') || node->type == REG_STRING);
+}
+
+/**
+ * @brief A node matching exactly one character out of a set, mergeable in a class
+ */
+static s8 is_single_char(RegexTreeNode *node) {
+    if (node->op != OP_NONE) return (FALSE);
+    if (node->type == REG_CHAR) return (node->c != '.');
+    return (node->type == REG_CLASS && !node->class->reverse_match);
+}
+
+static char *literal_chars(RegexTreeNode *node) {
+    return (node->type == REG_STRING ? node->str : &node->c);
+}
+
+static u32 literal_len(RegexTreeNode *node) {
+    return (node->type == REG_STRING ? node->str_len : 1);
+}
+
+/**
+ * @brief Create a literal node, a plain REG_CHAR when len is 1
+ */
+static RegexTreeNode *literal_create(char *str, u32 len) {
+    if (len == 1) {
+        return (RegexTreeNode_create(REG_CHAR, NULL, NULL, NULL, str[0]));
+    }
+    RegexTreeNode *node = RegexTreeNode_create(REG_STRING, NULL, NULL, NULL, 0);
+    node->str = arena_alloc(&g_regex_arena, len);
+    memcpy(node->str, str, len);
+    node->str_len = len;
+    return (node);
+}
+
+/**
+ * @brief Collect the operands of a chain of type (A|B|C or ABC) from left to right
+ * @param node Top of the chain, taken even if it carries an operator
+ * @param type REG_CONCAT or REG_ALT
+ * @param out Receives the operands
+ *
+ * Inner chain nodes with an operator are operands, ex: the (bc)* of a(bc)*d.
+ */
+static void flatten_chain(RegexTreeNode *node, RegexType type, NodeList *out) {
+    NodeList stack = {0};
+
+    node_list_push(&stack, node);
+    while (stack.count > 0) {
+        RegexTreeNode *n = stack.items[--stack.count];
+
+        if (n == node || (n->type == type && n->op == OP_NONE)) {
+            node_list_push(&stack, n->right);
+            node_list_push(&stack, n->left);
+        } else {
+            node_list_push(out, n);
+        }
+    }
+    free(stack.items);
+}
+
+/**
+ * @brief Build a left deep chain of type over items
+ * @return The single item when count is 1
+ */
+static RegexTreeNode *build_chain(RegexType type, RegexTreeNode **items, u32 count) {
+    RegexTreeNode *root = items[0];
+
+    for (u32 i = 1; i < count; i++) {
+        root = RegexTreeNode_create(type, root, items[i], NULL, 0);
+    }
+    return (root);
+}
+
+/**
+ * @brief Fuse the runs of literals of a concatenation into REG_STRING nodes
+ * @param node Top of the concatenation chain
+ * @return The rewritten chain
+ */
+static RegexTreeNode *simplify_concat(RegexTreeNode *node) {
+    NodeList        items = {0};
+    NodeList        out = {0};
+    RepeatRange     op = node_range(node);
+    char            *run = NULL;
+    u32             run_len = 0;
+    u32             run_capacity = 0;
+
+    flatten_chain(node, REG_CONCAT, &items);
+
+    for (u32 i = 0; i < items.count; i++) {
+        RegexTreeNode *item = items.items[i];
+
+        if (!is_literal(item)) {
+            node_list_push(&out, item);
+            continue;
+        }
+
+        /* Lone literal, nothing to fuse */
+        if (i + 1 >= items.count || !is_literal(items.items[i + 1])) {
+            node_list_push(&out, item);
+            continue;
+        }
+
+        run_len = 0;
+        while (i < items.count && is_literal(items.items[i])) {
+            u32 len = literal_len(items.items[i]);
+            /* The empty string of x{0} adds nothing to the run */
+            if (len == 0) {
+                i++;
+                continue;
+            }
+            if (run_len + len > run_capacity) {
+                run_capacity = (run_len + len) * 2;
+                run = realloc(run, run_capacity);
+                if (!run) {
+                    ERR("Memory allocation failed for literal run\n");
+                    exit(1);
+                }
+            }
+            memcpy(run + run_len, literal_chars(items.items[i]), len);
+            run_len += len;
+            i++;
+        }
+        i--;
+        /* A run of empty strings only, items[i] is one */
+        node_list_push(&out, run_len > 0 ? literal_create(run, run_len) : items.items[i]);
+    }
+
+    RegexTreeNode *result = apply_range(build_chain(REG_CONCAT, out.items, out.count), op);
+
+    free(run);
+    free(items.items);
+    free(out.items);
+    return (result);
+}
+
+/**
+ * @brief Split an alternative in leading literal and rest
+ */
+static AltBranch branch_split(RegexTreeNode *node) {
+    AltBranch b = {NULL, 0, node};
+
+    if (is_literal(node)) {
+        b.lead = literal_chars(node);
+        b.lead_len = literal_len(node);
+        b.rest = NULL;
+    } else if (node->type == REG_CONCAT && node->op == OP_NONE) {
+        NodeList items = {0};
+
+        flatten_chain(node, REG_CONCAT, &items);
+        if (is_literal(items.items[0])) {
+            b.lead = literal_chars(items.items[0]);
+            b.lead_len = literal_len(items.items[0]);
+            b.rest = build_chain(REG_CONCAT, items.items + 1, items.count - 1);
+        }
+        free(items.items);
+    }
+    return (b);
+}
+
+/**
+ * @brief Rebuild an alternative from its lead and rest
+ */
+static RegexTreeNode *branch_build(AltBranch *b) {
+    if (b->lead_len == 0) return (b->rest);
+
+    RegexTreeNode *lead = literal_create(b->lead, b->lead_len);
+    if (!b->rest) return (lead);
+    return (RegexTreeNode_create(REG_CONCAT, lead, b->rest, NULL, 0));
+}
+
+/**
+ * @brief Order alternatives by lead so the ones sharing a prefix are adjacent
+ */
+static int branch_cmp(const void *a, const void *b) {
+    const AltBranch *x = a;
+    const AltBranch *y = b;
+    u32 len = GET_MIN(x->lead_len, y->lead_len);
+    int cmp = len ? memcmp(x->lead, y->lead, len) : 0;
+
+    if (cmp != 0) return (cmp);
+    return ((int)x->lead_len - (int)y->lead_len);
+}
+
+/**
+ * @brief Merge single character alternatives in one class, ex: a|[bc]|d is [a-d]
+ * @param singles The single character alternatives
+ * @return The merged class node, or the node itself when there is only one
+ */
+static RegexTreeNode *merge_single_chars(NodeList *singles) {
+    if (singles->count == 1) return (singles->items[0]);
+
+    RegexTreeNode *node = RegexTreeNode_create(REG_CLASS, NULL, NULL, NULL, 0);
+    node->class = init_class();
+
+    for (u32 i = 0; i < singles->count; i++) {
+        RegexTreeNode *single = singles->items[i];
+
+        if (single->type == REG_CHAR) {
+            bitmap_set(&node->class->char_bitmap, (u8)single->c);
+        } else {
+            for (u32 w = 0; w < CLASS_BITMAP_WORDS; w++) {
+                node->class->char_bits[w] |= single->class->char_bits[w];
+            }
+        }
+    }
+    return (node);
+}
+
+/**
+ * @brief Factor one alternation, pushing the factored sub alternations as new jobs
+ *
+ * Alternatives sharing a first character are grouped and their longest
+ * common prefix is pulled out (abc|abd is ab(c|d)), single characters
+ * are merged in a class (c|d is [cd]) and an empty alternative makes
+ * the whole alternation optional.
+ */
+static void alt_job_run(AltJob *job, AltJob **jobs, u32 *job_count, u32 *job_capacity) {
+    NodeList    alts = {0};
+    NodeList    singles = {0};
+    s8          has_empty = FALSE;
+    u32         i = 0;
+
+    qsort(job->branches, job->count, sizeof(AltBranch), branch_cmp);
+
+    while (i < job->count) {
+        AltBranch *b = &job->branches[i];
+
+        if (b->lead_len == 0) {
+            if (!b->rest) {
+                has_empty = TRUE;
+            } else if (is_single_char(b->rest)) {
+                node_list_push(&singles, b->rest);
+            } else {
+                node_list_push(&alts, b->rest);
+            }
+            i++;
+            continue;
+        }
+
+        u32 j = i + 1;
+        while (j < job->count && job->branches[j].lead[0] == b->lead[0]) j++;
+
+        if (j - i == 1) {
+            RegexTreeNode *node = branch_build(b);
+            node_list_push(is_single_char(node) ? &singles : &alts, node);
+            i = j;
+            continue;
+        }
+
+        /* Sorted group: the common prefix of the first and last is common to all */
+        AltBranch   *last = &job->branches[j - 1];
+        u32         prefix = 0;
+        u32         max_prefix = GET_MIN(b->lead_len, last->lead_len);
+        while (prefix < max_prefix && b->lead[prefix] == last->lead[prefix]) prefix++;
+
+        AltBranch   *rem = malloc((j - i) * sizeof(AltBranch));
+        s8          all_empty = TRUE;
+        if (!rem) {
+            ERR("Memory allocation failed for alternation\n");
+            exit(1);
+        }
+        for (u32 k = i; k < j; k++) {
+            rem[k - i] = job->branches[k];
+            rem[k - i].lead += prefix;
+            rem[k - i].lead_len -= prefix;
+            if (rem[k - i].lead_len != 0 || rem[k - i].rest) all_empty = FALSE;
+        }
+
+        RegexTreeNode *lead = literal_create(b->lead, prefix);
+        if (all_empty) {
+            /* Duplicated alternatives: ab|ab */
+            node_list_push(&alts, lead);
+            free(rem);
+        } else {
+            RegexTreeNode *node = RegexTreeNode_create(REG_CONCAT, lead, NULL, NULL, 0);
+            node_list_push(&alts, node);
+            if (*job_count >= *job_capacity) {
+                *job_capacity *= 2;
+                *jobs = realloc(*jobs, *job_capacity * sizeof(AltJob));
+                if (!*jobs) {
+                    ERR("Memory allocation failed for alternation\n");
+                    exit(1);
+                }
+            }
+            (*jobs)[(*job_count)++] = (AltJob){rem, j - i, &node->right, (RepeatRange){1, 1}};
+        }
+        i = j;
+    }
+
+    if (singles.count > 0) {
+        node_list_push(&alts, merge_single_chars(&singles));
+    }
+
+    RegexTreeNode *result = build_chain(REG_ALT, alts.items, alts.count);
+    if (has_empty) result = apply_range(result, (RepeatRange){0, 1});
+    *job->slot = apply_range(result, job->op);
+
+    free(alts.items);
+    free(singles.items);
+}
+
+/**
+ * @brief Factor an alternation chain
+ * @param node Top of the alternation chain
+ * @return The rewritten alternation
+ *
+ * Prefix factoring creates nested alternations (a trie of the
+ * alternatives), they are handled on a job stack instead of recursion.
+ */
+static RegexTreeNode *simplify_alt(RegexTreeNode *node) {
+    NodeList        items = {0};
+    RegexTreeNode   *result = NULL;
+    u32             job_count = 0;
+    u32             job_capacity = SIMPLIFY_LIST_CAPACITY;
+    AltJob          *jobs = malloc(job_capacity * sizeof(AltJob));
+
+    flatten_chain(node, REG_ALT, &items);
+
+    AltBranch *branches = malloc(items.count * sizeof(AltBranch));
+    if (!jobs || !branches) {
+        ERR("Memory allocation failed for alternation\n");
+        exit(1);
+    }
+    for (u32 i = 0; i < items.count; i++) {
+        branches[i] = branch_split(items.items[i]);
+    }
+    jobs[job_count++] = (AltJob){branches, items.count, &result, node_range(node)};
+
+    while (job_count > 0) {
+        AltJob job = jobs[--job_count];
+        alt_job_run(&job, &jobs, &job_count, &job_capacity);
+        free(job.branches);
+    }
+
+    free(jobs);
+    free(items.items);
+    return (result);
+}
+
+/**
+ * @brief Rewrite one node whose children are already simplified
+ * @param node Node to rewrite
+ * @param parent Type of the parent node
+ * @return The node replacing it
+ */
+static RegexTreeNode *simplify_node(RegexTreeNode *node, RegexType parent) {
+    switch (node->type) {
+        case REG_GROUP:
+            /* Nested quantifiers: (x+)* is x*, kept as a group when they do not merge */
+            if (node->left->op == OP_NONE) {
+                regex_set_repeat(node->left, node_range(node).min, node_range(node).max);
+                return (node->left);
+            }
+            RepeatRange merged;
+            if (combine_range(node_range(node->left), node_range(node), &merged)) {
+                regex_set_repeat(node->left, merged.min, merged.max);
+                return (node->left);
+            }
+            return (node);
+        case REG_CONCAT:
+            /* Inner chain nodes are handled by the top of the chain */
+            if (node->op == OP_NONE && parent == REG_CONCAT) return (node);
+            return (simplify_concat(node));
+        case REG_ALT:
+            if (node->op == OP_NONE && parent == REG_ALT) return (node);
+            return (simplify_alt(node));
+        default:
+            return (node);
+    }
+}
+
+/**
+ * @brief Simplify the regex tree before the NFA construction
+ * @param root Root of the tree from parse_regex
+ * @return The new root
+ *
+ * Post-order walk on an explicit stack doing these reductions:
+ * - nested quantifiers collapse: x** is x*, (x+)? is x*, (x{2}){3} is x{6}
+ * - literal runs fuse in one REG_STRING: abc needs 4 NFA states, not 6
+ * - common prefixes are factored out of alternations: abc|abd is ab(c|d)
+ * - single character alternatives merge in a class: a|b|[cd] is [a-d]
+ */
+RegexTreeNode *regex_simplify(RegexTreeNode *root) {
+    if (!root) return (NULL);
+
+    u32             capacity = 64;
+    u32             count = 0;
+    SimplifyFrame   *stack = malloc(capacity * sizeof(SimplifyFrame));
+
+    if (!stack) {
+        ERR("Memory allocation failed for simplify stack\n");
+        exit(1);
+    }
+
+    stack[count++] = (SimplifyFrame){&root, REG_CHAR, 0};
+    while (count > 0) {
+        SimplifyFrame *f = &stack[count - 1];
+        RegexTreeNode *node = *f->slot;
+
+        if (f->children_done) {
+            count--;
+            *f->slot = simplify_node(node, f->parent);
+            continue;
+        }
+
+        f->children_done = 1;
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(SimplifyFrame));
+            if (!stack) {
+                ERR("Memory allocation failed for simplify stack\n");
+                exit(1);
+            }
+        }
+        if (node->right) stack[count++] = (SimplifyFrame){&node->right, node->type, 0};
+        if (node->left) stack[count++] = (SimplifyFrame){&node->left, node->type, 0};
+    }
+
+    free(stack);
+    return (root);
+}
+
+/**
+ * @brief Count the nodes of a regex tree
+ */
+u32 regex_tree_count(RegexTreeNode *root) {
+    NodeList    stack = {0};
+    u32         count = 0;
+
+    if (!root) return (0);
+
+    node_list_push(&stack, root);
+    while (stack.count > 0) {
+        RegexTreeNode *n = stack.items[--stack.count];
+
+        count++;
+        if (n->right) node_list_push(&stack, n->right);
+        if (n->left) node_list_push(&stack, n->left);
+    }
+    free(stack.items);
+    return (count);
+}
@@ -3,6 +3,8 @@
 
 
 void char_bitmap_display(Bitmap *b) {
+    if (*get_log_level() < L_INFO) return;
+
     INFO("Character Bitmap: ");
     for (u32 i = 0; i < BITMAP_SIZE(b->size) ; i++) {
         if (bitmap_is_set(b, i)) {
@@ -16,21 +18,50 @@ void char_bitmap_display(Bitmap *b) {
     printf("\n");
 }
 
+/* Arena owning every node and class of the current compilation */
+Arena *__get_regex_arena(void) {
+    static Arena arena = {0};
+    return (&arena);
+}
+
 ClassDef *init_class() {
-    ClassDef *class = malloc(sizeof(ClassDef));
-    if (!class) {
-        ERR("Failed to allocate memory for ClassDef\n");
-        return (0);
-    }
+    ClassDef *class = arena_alloc(&g_regex_arena, sizeof(ClassDef));
+
     class->reverse_match = 0;
-    bitmap_init(&class->char_bitmap, 4); // 4 * 64 = 256 bits for ASCII
+    class->char_bitmap.bits = class->char_bits;
+    class->char_bitmap.size = CLASS_BITMAP_WORDS; // 4 * 64 = 256 bits for ASCII
+    bitmap_clear(&class->char_bitmap);
     return (class);
 }
 
-void free_class(ClassDef *class) {
-    if (class) {
-        free(class->char_bitmap.bits);
-        free(class);
+/**
+ * @brief Bytes matched by a class, reverse match applied
+ * @param class Class to expand
+ * @param set Receives CLASS_BITMAP_WORDS words, bit c set if byte c matches
+ *
+ * A negated class covers every byte 1..255 outside the class, including
+ * the bytes >= 128. Byte 0 ends the input and never matches.
+ */
+void class_byte_set(ClassDef *class, u64 *set) {
+    for (u32 i = 0; i < CLASS_BITMAP_WORDS; i++) {
+        set[i] = class->reverse_match ? ~class->char_bits[i] : class->char_bits[i];
+    }
+    set[0] &= ~1ULL;
+}
+
+/**
+ * @brief Byte at exp[*i] as lex reads it in a class, moving *i past it
+ *
+ * A backslash escapes the next byte: \n and \t are newline and tab,
+ * any other byte stands for itself (\\, \-, \^).
+ */
+static u8 class_byte(const char *exp, int *i) {
+    if (exp[*i] != '\\' || exp[*i + 1] == '\0') return ((u8)exp[(*i)++]);
+    *i += 2;
+    switch (exp[*i - 1]) {
+        case 'n':   return ('\n');
+        case 't':   return ('\t');
+        default:    return ((u8)exp[*i - 1]);
     }
 }
 
@@ -51,29 +82,25 @@ ClassDef *class_exp_to_bitmap(char *exp) {
         i++;
     }
 
-    int exp_len = strlen(exp);
-
     while (exp[i] != 0) {
         INFO("Processing exp[%d] = '%c'\n", i, exp[i]);
 
-        if (i + 2 < exp_len && (exp[i + 1] == '-' && exp[i + 2] != ']' && exp[i] != '\0')) {
-            if (exp[i] > exp[i + 2]) {
-                ERR("Invalid range in class expression: '%c-%c'\n", exp[i], exp[i + 2]);
-                free_class(class);
-                return (NULL);
-            }
-            for (char c = exp[i]; c <= exp[i + 2]; c++) {
-                DBG("Adding char '%c' to class\n", c);
-                bitmap_set(&class->char_bitmap, (u32)c);
-            }
-            i += 3;
-        } else {
-            if (exp[i] == ']' && exp[i + 1] == 0) {
-                break;
-            }
-            DBG("Else case adding char '%c' to class\n", exp[i]);
-            bitmap_set(&class->char_bitmap, (u32)exp[i]);
+        if (exp[i] == ']' && exp[i + 1] == 0) {
+            break;
+        }
+        u8 lo = class_byte(exp, &i);
+        u8 hi = lo;
+        if (exp[i] == '-' && exp[i + 1] != '\0' && exp[i + 1] != ']') {
             i++;
+            hi = class_byte(exp, &i);
+        }
+        if (lo > hi) {
+            ERR("Invalid range in class expression: '%c-%c'\n", lo, hi);
+            return (NULL);
+        }
+        for (u32 c = lo; c <= hi; c++) {
+            DBG("Adding char '%c' to class\n", c);
+            bitmap_set(&class->char_bitmap, c);
         }
     }
 
@@ -119,11 +146,8 @@ char *class_to_string(ClassDef *class) {
  * @return Pointer to the newly created node
  */
 RegexTreeNode* RegexTreeNode_create(RegexType type, RegexTreeNode *left, RegexTreeNode *right, char *str, char c) {
-    RegexTreeNode *node = malloc(sizeof(RegexTreeNode));
-    if (!node) {
-        ERR("Memory allocation failed\n");
-        return (NULL);
-    }
+    RegexTreeNode *node = arena_alloc(&g_regex_arena, sizeof(RegexTreeNode));
+
     node->type = type;
     node->left = left;
     node->right = right;
@@ -132,25 +156,44 @@ RegexTreeNode* RegexTreeNode_create(RegexType type, RegexTreeNode *left, RegexTr
     if (str) {
         node->class = class_exp_to_bitmap(str);
         if (!node->class) {
-            ERR("Memory allocation failed\n");
-            free(node);
+            ERR("Invalid class expression\n");
             return (NULL);
         }
     }
     node->c = c;
+    node->rep_min = 1;
+    node->rep_max = 1;
+    node->str = NULL;
+    node->str_len = 0;
+    node->id = 0;
+    node->refs = 0;
     return (node);
 }
 
 /**
- * @brief Free the regex tree
- * @param node The root of the regex tree
+ * @brief Set the repetition {min,max} of a node, using the plain operator when there is one
+ * @param node Node to quantify, its current operator is replaced
+ * @param min Minimum count
+ * @param max Maximum count or REPEAT_INFINITE
+ *
+ * {0,} is *, {1,} is +, {0,1} is ? and {1} is no operator at all.
+ */
+void regex_set_repeat(RegexTreeNode *node, u32 min, u32 max) {
+    node->rep_min = min;
+    node->rep_max = max;
+    if (min == 1 && max == 1)                   node->op = OP_NONE;
+    else if (min == 0 && max == REPEAT_INFINITE) node->op = OP_STAR;
+    else if (min == 1 && max == REPEAT_INFINITE) node->op = OP_PLUS;
+    else if (min == 0 && max == 1)              node->op = OP_OPTIONAL;
+    else                                        node->op = OP_REPEAT;
+}
+
+/**
+ * @brief Free every tree node and class and give the arena memory back
  */
-void RegexTreeNode_free(RegexTreeNode *node) {
-    if (!node) return;
-    RegexTreeNode_free(node->left);
-    RegexTreeNode_free(node->right);
-    free_class(node->class);
-    free(node);
+void regex_tree_free(void) {
+    regex_hashcons_free();
+    arena_free(&g_regex_arena);
 }
 
 
@@ -160,66 +203,81 @@ char *get_operator_string(RegexOperator op) {
         case OP_STAR: return YELLOW"STAR (*)"RESET;
         case OP_PLUS: return CYAN"PLUS (+)"RESET;
         case OP_OPTIONAL: return PURPLE"OPTIONAL (?)"RESET;
+        case OP_REPEAT: return BLUE"REPEAT"RESET;
         default: return "UNKNOWN";
     }
 }
 
-char *get_operator_display(RegexOperator op) {
+char *get_operator_display(RegexTreeNode *r) {
     static char buff[128];
 
     bzero(buff, sizeof(buff));
 
-    if (op == OP_NONE) return ("");
+    if (r->op == OP_NONE) return ("");
 
-    sprintf(buff, ": %s", get_operator_string(op));
+    if (r->op != OP_REPEAT) {
+        sprintf(buff, ": %s", get_operator_string(r->op));
+    } else if (r->rep_max == REPEAT_INFINITE) {
+        sprintf(buff, ": %s {%u,}", get_operator_string(r->op), r->rep_min);
+    } else {
+        sprintf(buff, ": %s {%u,%u}", get_operator_string(r->op), r->rep_min, r->rep_max);
+    }
     return (buff);
 }
 
 /**
- * @brief Helper function to print the regex tree
- * @param r The root of the regex tree
- * @param prefix The prefix string for formatting
+ * @brief Pending node of the iterative tree printer
+ */
+typedef struct {
+    RegexTreeNode   *node;
+    u32             depth;
+    s8              is_last;
+} PrintFrame;
+
+/**
+ * @brief Helper function to print one node of the regex tree
+ * @param r The node to print
+ * @param last last[k] tells whether the ancestor at depth k was the last child
+ * @param depth Depth of r
  * @param is_last Whether this node is the last child
  */
-static void print_regex_node(RegexTreeNode* r, char* prefix, int is_last) {
-    if (!r) return;
-    
-    printf("%s", prefix);
+static void print_regex_node(RegexTreeNode* r, s8 *last, u32 depth, int is_last) {
+    for (u32 k = 0; k < depth; k++) {
+        printf("%s", last[k] ? "    " : "│   ");
+    }
     printf("%s", is_last ? "└── " : "├── ");
     
     switch (r->type) {
         case REG_CHAR: 
-            printf("CHAR('%c')%s\n", r->c, get_operator_display(r->op)); 
+            printf("CHAR('%c')%s\n", r->c, get_operator_display(r)); 
             break;
         case REG_CONCAT: 
-            printf("CONCAT%s\n", get_operator_display(r->op)); 
+            printf("CONCAT%s\n", get_operator_display(r)); 
             break;
         case REG_ALT: 
-            printf("ALT (|)%s\n", get_operator_display(r->op)); 
+            printf("ALT (|)%s\n", get_operator_display(r)); 
             break;
         case REG_CLASS: 
-            printf("CLASS [%s]%s\n", r->class ? class_to_string(r->class) : "", get_operator_display(r->op)); 
+            printf("CLASS [%s]%s\n", r->class ? class_to_string(r->class) : "", get_operator_display(r)); 
+            break;
+        case REG_GROUP: 
+            printf("GROUP%s\n", get_operator_display(r)); 
+            break;
+        case REG_STRING: 
+            printf("STRING(\"%.*s\")%s\n", (int)r->str_len, r->str, get_operator_display(r)); 
             break;
         default: 
             printf("UNKNOWN\n"); 
             break;
     }
-    
-    /* Prepare prefix for children */
-    char new_prefix[256] = {};
-    snprintf(new_prefix, sizeof(new_prefix), "%s%s", prefix, is_last ? "    " : "│   ");
-    
-    if (r->left) {
-        print_regex_node(r->left, new_prefix, r->right == NULL);
-    }
-    if (r->right) {
-        print_regex_node(r->right, new_prefix, 1);
-    }
 }
 
 /**
  * @brief Print the regex tree
  * @param r The root of the regex tree
+ *
+ * Depth first walk on an explicit stack, deep trees (long concatenations)
+ * do not consume call stack.
  */
 void print_regex_tree(RegexTreeNode* r) {
     if (!r) {
@@ -227,6 +285,52 @@ void print_regex_tree(RegexTreeNode* r) {
         return;
     }
     printf("Regex Tree:\n");
-    print_regex_node(r, "", 1);
+
+    u32         capacity = 64;
+    u32         count = 0;
+    PrintFrame  *stack = malloc(capacity * sizeof(PrintFrame));
+    u32         last_capacity = 64;
+    s8          *last = malloc(last_capacity * sizeof(s8));
+
+    if (!stack || !last) {
+        ERR("Memory allocation failed\n");
+        free(stack);
+        free(last);
+        return;
+    }
+
+    stack[count++] = (PrintFrame){r, 0, 1};
+    while (count > 0) {
+        PrintFrame f = stack[--count];
+
+        if (f.depth >= last_capacity) {
+            last_capacity *= 2;
+            last = realloc(last, last_capacity * sizeof(s8));
+            if (!last) {
+                ERR("Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        last[f.depth] = f.is_last;
+        print_regex_node(f.node, last, f.depth, f.is_last);
+
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(PrintFrame));
+            if (!stack) {
+                ERR("Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        /* Right pushed first so the left child is printed first */
+        if (f.node->right) {
+            stack[count++] = (PrintFrame){f.node->right, f.depth + 1, 1};
+        }
+        if (f.node->left) {
+            stack[count++] = (PrintFrame){f.node->left, f.depth + 1, f.node->right == NULL};
+        }
+    }
+    free(stack);
+    free(last);
     printf("\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,90 @@
+#include "../../include/arena.h"
+#include "../../include/log.h"
+
+/**
+ * @brief Allocate a new arena block able to hold at least size bytes
+ * @param size Minimum payload size
+ * @return The new block (exit on allocation failure)
+ */
+static ArenaBlock *arena_block_create(size_t size) {
+    size_t      block_size = GET_MAX(size, ARENA_BLOCK_SIZE);
+    ArenaBlock  *block = malloc(sizeof(ArenaBlock) + block_size);
+
+    if (!block) {
+        ERR("Memory allocation failed for arena block\n");
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = block_size;
+    block->used = 0;
+    return (block);
+}
+
+/**
+ * @brief Allocate size bytes from the arena (bump pointer)
+ * @param a Arena to allocate from
+ * @param size Number of bytes
+ * @return Pointer aligned on ARENA_ALIGN, never NULL
+ *
+ * When the current block is full, the next block of the chain is
+ * reused (left over from a previous reset) or a new one is inserted.
+ */
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (!a->current) {
+        if (!a->first) {
+            a->first = arena_block_create(size);
+        }
+        a->current = a->first;
+        a->current->used = 0;
+    }
+
+    if (a->current->used + size > a->current->size) {
+        ArenaBlock *next = a->current->next;
+
+        if (next && next->size >= size) {
+            next->used = 0;
+        } else {
+            ArenaBlock *block = arena_block_create(size);
+            block->next = next;
+            a->current->next = block;
+            next = block;
+        }
+        a->current = next;
+    }
+
+    void *ptr = a->current->data + a->current->used;
+    a->current->used += size;
+    a->allocated += size;
+    a->alloc_count++;
+    return (ptr);
+}
+
+/**
+ * @brief Release every allocation at once, keeping the blocks for reuse
+ * @param a Arena to reset
+ *
+ * O(1): blocks after the first are rewound lazily by arena_alloc().
+ */
+void arena_reset(Arena *a) {
+    a->current = NULL;
+    a->allocated = 0;
+    a->alloc_count = 0;
+}
+
+/**
+ * @brief Give all the arena blocks back to the system
+ * @param a Arena to free
+ */
+void arena_free(Arena *a) {
+    ArenaBlock *block = a->first;
+
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    a->first = NULL;
+    arena_reset(a);
+}
@@ -49,14 +49,9 @@ s8 bitmap_is_set(Bitmap *b, u32 id) {
 
 
 s8 bitmap_equal(Bitmap *a, Bitmap *b) {
-    for (u32 i = 0; i < a->size; i++) {
-        if (a->bits[i] != b->bits[i]) return 0;
-    }
-    return 1;
+    return (a->size == b->size && memcmp(a->bits, b->bits, a->size * sizeof(u64)) == 0);
 }
 
 void bitmap_copy(Bitmap *dest, Bitmap *src) {
-    for (u32 i = 0; i < src->size; i++) {
-        dest->bits[i] = src->bits[i];
-    }
+    memcpy(dest->bits, src->bits, src->size * sizeof(u64));
 }
@@ -0,0 +1,34 @@
+#include "../../include/sparse_set.h"
+#include "../../include/log.h"
+
+/**
+ * @brief Allocate an empty set for ids lower than capacity
+ * @param s Set to initialize
+ * @param capacity Number of possible ids
+ *
+ * sparse is zeroed once so a lookup never reads uninitialized memory,
+ * the set itself does not rely on its content.
+ */
+void sparse_set_init(SparseSet *s, u32 capacity) {
+    s->dense = malloc(GET_MAX(capacity, 1) * sizeof(u32));
+    s->sparse = calloc(GET_MAX(capacity, 1), sizeof(u32));
+    if (!s->dense || !s->sparse) {
+        ERR("Memory allocation failed for sparse set\n");
+        exit(1);
+    }
+    s->count = 0;
+    s->capacity = capacity;
+}
+
+void sparse_set_free(SparseSet *s) {
+    free(s->dense);
+    free(s->sparse);
+    *s = (SparseSet){0};
+}
+
+void sparse_set_swap(SparseSet *a, SparseSet *b) {
+    SparseSet tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}